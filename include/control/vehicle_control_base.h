@@ -6,11 +6,13 @@
 #include <geometry_msgs/PoseStamped.h>
 
 #include "nbv_exploration/common.h"
+#include "utilities/esdf_map.h"
 
 class VehicleControlBase
 {
 protected:
   bool is_ready_;
+  const EsdfMap* esdf_; // Distance field of the map, NULL if not available
 
 public:
   double distance_threshold_;
@@ -39,6 +41,9 @@ public:
   geometry_msgs::Point getPosition();
   geometry_msgs::Quaternion getOrientation();
   double getYaw();
+  double getObstacleDistance();
+  double getObstacleDistance(Eigen::Vector3d& gradient);
+  void   setDistanceField(const EsdfMap* esdf);
 
   double getAngularDistance(geometry_msgs::Pose p1, geometry_msgs::Pose p2);
   double getDistance(geometry_msgs::Pose p1, geometry_msgs::Pose p2);
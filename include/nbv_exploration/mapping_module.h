@@ -1,7 +1,10 @@
 #ifndef SENSING_AND_MAPPING_H
 #define SENSING_AND_MAPPING_H
 
+#include <atomic>
+#include <deque>
 #include <iostream>
+#include <thread>
 #include <ros/ros.h>
 #include <ros/package.h>
 
@@ -40,18 +43,16 @@
 
 #include "nbv_exploration/common.h"
 #include "nbv_exploration/symmetry_detector.h"
+#include "utilities/depth_kernel.h"
+#include "utilities/esdf_map.h"
+#include "utilities/lock_free_queue.h"
+#include "utilities/occupancy_key_batch.h"
+#include "utilities/point_hash_grid.h"
+#include "utilities/voxel_grid_accumulator.h"
+#include "utilities/voxel_hash.h"
 
 typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::PointCloud2, sensor_msgs::PointCloud2> sync_policy;
 
-struct OctomapKeyCompare {
-  bool operator() (const octomap::OcTreeKey& lhs, const octomap::OcTreeKey& rhs) const
-  {
-    size_t h1 = size_t(lhs.k[0]) + 1447*size_t(lhs.k[1]) + 345637*size_t(lhs.k[2]);
-    size_t h2 = size_t(rhs.k[0]) + 1447*size_t(rhs.k[1]) + 345637*size_t(rhs.k[2]);
-    return h1< h2;
-  }
-};
-
 struct NormalHistogram{
   int size;
   int histogram[6];
@@ -87,11 +88,60 @@ public:
     double density;
   };
 
+  // Depth messages waiting to be converted, one per camera
+  struct DepthJob{
+    std::vector<sensor_msgs::PointCloud2ConstPtr> msgs;
+    uint camera_flags;
+  };
+
+  // Depth scan of a single camera in the world frame
+  struct DepthView{
+    boost::shared_ptr<octomap::Pointcloud> scan; // All pixels, invalid ones pushed beyond max range
+    octomap::point3d origin;
+    octomap::point3d sensor_dir;
+  };
+
+  // Planar scan handed to computeTreeUpdatePlanar(), the scan is not owned
+  struct PlanarScan{
+    const octomap::Pointcloud* scan;
+    octomap::point3d origin;
+    octomap::point3d sensor_dir;
+  };
+
+  // Classes of a voxel, as isNodeFree(), isNodeOccupied() and isNodeUnknown() tell them apart
+  enum VoxelClass {VOXEL_MISSING, VOXEL_FREE, VOXEL_UNKNOWN, VOXEL_OCCUPIED};
+
+  // Voxels of octree_ changed by one integration
+  struct MapChangeBlock{
+    unsigned long version;             // Map version right after the integration
+    std::vector<VoxelChange> changes;
+  };
+
+  // Depth frame waiting to be integrated, all views are fused in a single octree update
+  // Buffers are reused from frame to frame
+  struct DepthFrame{
+    std::vector<DepthView> views;
+    PointCloudXYZ::Ptr cloud_distance;           // Points within max_rgbd_range_, all views
+    uint camera_flags;
+  };
+
   // =========
   // Methods
   // =========
   MappingModule(const ros::NodeHandle& nh_, const ros::NodeHandle& nh_private_);
-  MappingModule(){}
+  MappingModule():
+    is_depth_pipeline_running_(false),
+    depth_job_queue_(NULL),
+    depth_frame_queue_(NULL),
+    density_frame_queue_(NULL),
+    depth_frame_pool_(NULL),
+    map_version_(0),
+    is_esdf_enabled_(false),
+    is_tracking_frontiers_(false),
+    map_change_log_size_(0),
+    map_changes_count_(0),
+    map_changes_start_(0)
+  {}
   ~MappingModule();
   bool commandGetCameraData();
   bool commandFinalMapLoad();
@@ -105,6 +155,11 @@ public:
 
   double getAveragePointDensity();
   int getDensityAtOcTreeKey(octomap::OcTreeKey key);
+  EsdfMap* getEsdf();
+  void getFrontierCells(std::vector<octomap::OcTreeKey>& keys);
+  void getLowDensityCells(std::vector<octomap::OcTreeKey>& keys);
+  bool getMapChanges(unsigned long since_version, std::vector<VoxelChange>& changes);
+  unsigned long getMapVersion();
   NormalHistogram getNormalHistogramAtOcTreeKey(octomap::OcTreeKey key);
   octomap::OcTree*   getOctomap();
   octomap::OcTree*   getOctomapPredicted();
@@ -114,6 +169,7 @@ public:
   bool isNodeFree(octomap::OcTreeNode node);
   bool isNodeOccupied(octomap::OcTreeNode node);
   bool isNodeUnknown(octomap::OcTreeNode node);
+  bool isTrackingFrontiers();
 
   void run();
 
@@ -127,26 +183,55 @@ private:
   // =========
   void addPointCloudToPointCloud(const PointCloudXYZ::Ptr& cloud_in, PointCloudXYZ::Ptr& cloud_out, double filter_res);
   void addPointCloudToPointCloud(const PointCloudXYZ::Ptr& cloud_in, PointCloudXYZ::Ptr& cloud_out);
+  void addPointCloudToAccumulator(const PointCloudXYZ::Ptr& cloud_in);
   void addPredictedPointCloudToTree(octomap::OcTree* octree_in, PointCloudXYZ cloud_in);
-  void addPointCloudToTree(octomap::OcTree* octree_in, PointCloudXYZ cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar=false);
+  void addPointCloudToTree(octomap::OcTree* octree_in, const PointCloudXYZ& cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar=false);
+  void addPointCloudToTree(octomap::OcTree* octree_in, const octomap::Pointcloud& ocCloud, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar=false);
+  void addPointCloudsToTree(octomap::OcTree* octree_in, const std::vector<DepthView>& views, double range);
+
+  void commitMapChanges(std::vector<VoxelChange>* changes);
+  void evaluateFrontierCandidates(bool is_rebuild);
+  VoxelClass getVoxelClass(float log_odds);
+  bool isFrontierCell(const octomap::OcTreeKey& key);
+  void rebuildFrontierCells();
+  void updateFrontierCells(const std::vector<VoxelChange>& changes);
+  std::vector<VoxelChange>* getChangeBuffer(octomap::OcTree* octree_in);
+  void invalidateMapChanges();
 
   void callbackScan(const sensor_msgs::LaserScan& laser_msg);
   void callbackDepth(const sensor_msgs::PointCloud2& cloud_msg);
   void callbackDepth2(const sensor_msgs::PointCloud2& cloud_msg);
   void callbackDepthSync(const sensor_msgs::PointCloud2ConstPtr& cloud_msg1, const sensor_msgs::PointCloud2ConstPtr& cloud_msg2);
   void createMaxRangeCloud();
-  PointCloudXYZ::Ptr correctDepth(const sensor_msgs::PointCloud2& input_msg);
-  void processDepth(const sensor_msgs::PointCloud2& cloud_msg);
+  bool convertDepth(const sensor_msgs::PointCloud2& cloud_msg, DepthView& view, PointCloudXYZ& cloud_distance);
+  bool convertDepthFrame(const std::vector<const sensor_msgs::PointCloud2*>& cloud_msgs, DepthFrame& frame);
+  void enqueueDepth(const std::vector<sensor_msgs::PointCloud2ConstPtr>& cloud_msgs, uint camera_flags);
+  bool ingestDepth(const sensor_msgs::PointCloud2& input_msg, const Eigen::Matrix4d& tf_eigen, DepthView& view, PointCloudXYZ& cloud_distance);
+  void integrateDepth(DepthFrame& frame);
+  void processDepth(const std::vector<const sensor_msgs::PointCloud2*>& cloud_msgs);
+  void startDepthPipeline();
+  void stopDepthPipeline();
+  void workerDepthConversion();
+  void workerDepthDensity();
+  void workerDepthIntegration();
 
   void computeTreeUpdatePlanar(octomap::OcTree* octree_in, const octomap::Pointcloud& scan,
                         const octomap::point3d& origin, octomap::point3d& sensor_dir,
-                        octomap::KeySet& free_cells, octomap::KeySet& occupied_cells,
+                        OccupancyKeyBatch& key_batch,
+                        double maxrange);
+  // Same for the scans of several cameras, their rays are shared by the same threads
+  void computeTreeUpdatePlanar(octomap::OcTree* octree_in, const std::vector<PlanarScan>& scans,
+                        OccupancyKeyBatch& key_batch,
                         double maxrange);
 
   void initializeParameters();
   void initializeTopicHandlers();
   void processScans();
-  void updatePrediction(octomap::OcTree* octree_in, PointCloudXYZ cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar);
+  void rebuildDensityIndex();
+  void updateRayBundleOrder();
+  void resetAccumulatorFromPointCloud();
+  void updatePrediction(octomap::OcTree* octree_in, const PointCloudXYZ& cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar);
+  void updatePrediction(octomap::OcTree* octree_in, const octomap::Pointcloud& ocCloud, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar);
 
   // =========
   // Variables
@@ -178,6 +263,10 @@ private:
   int ray_skipping_horizontal_;
   int ray_skipping_vertical_;
 
+  int ray_bundle_size_;       // Side of a square pixel bundle traversed together, 0 or 1 disables bundles
+  int ray_bundle_cache_size_; // Recently emitted free cells remembered per thread
+  std::vector<int> ray_bundle_order_;
+
   // == Booleans
   bool is_debugging_; //Set to true to see debug text
   bool is_debug_load_state_;
@@ -186,10 +275,12 @@ private:
   bool is_filling_octomap_;
   bool is_filling_octomap_continuously_;
   bool getCameraData;
-  uint camera_done_flags_;
+  std::atomic<uint> camera_done_flags_;
+  std::atomic<uint> camera_queued_flags_; // Cameras whose frame for the current request entered the pipeline
   uint all_done_flags_;
   bool is_scanning_;
   bool is_checking_symmetry_;
+  bool is_ray_skipping_adaptive_;
   bool is_integrating_prediction_;
   bool skip_load_map_;
 
@@ -200,13 +291,39 @@ private:
 
 
   // == Point clouds and octrees
-  PointCloudXYZ::Ptr cloud_ptr_rgbd_;
+  PointCloudXYZ::Ptr cloud_ptr_rgbd_; // Snapshot of rgbd_accumulator_, refreshed by getPointCloud()
+  VoxelGridAccumulator rgbd_accumulator_;
+  OccupancyKeyBatch key_batch_; // Scratch buffers for camera updates, guarded by mutex_octo
+  bool is_rgbd_cloud_outdated_;
   PointCloudXYZ::Ptr cloud_ptr_profile_;
   PointCloudXYZ::Ptr cloud_ptr_profile_symmetry_;
   octomap::OcTree* octree_;
   octomap::OcTree* octree_prediction_;
-  std::map<octomap::OcTreeKey, VoxelDensity, OctomapKeyCompare> voxel_densities_;
-  std::map<octomap::OcTreeKey, NormalHistogram, OctomapKeyCompare> voxel_normals_;
+  VoxelHashMap<VoxelDensity> voxel_densities_;
+  VoxelHashMap<NormalHistogram> voxel_normals_;
+  PointHashGrid density_index_; // Neighbor index over cloud_ptr_rgbd_ used for voxel densities
+  std::atomic<unsigned long> map_version_; // Bumped whenever the octree or voxel densities change
+
+  // == Distance field of octree_, updated with each integration under mutex_octo
+  bool is_esdf_enabled_;
+  double esdf_max_distance_;
+  EsdfMap esdf_;
+
+  // == Frontier and low density voxels, guarded by mutex_frontiers
+  bool is_tracking_frontiers_;
+  double low_density_threshold_;
+  VoxelHashSet frontier_cells_;   // Unknown voxels of octree_ next to both free and occupied voxels
+  VoxelHashSet low_density_cells_; // Voxels with a point density below low_density_threshold_
+  VoxelHashSet frontier_candidates_; // Scratch for updateFrontierCells(), guarded by mutex_octo
+  std::vector<octomap::OcTreeKey> frontier_candidate_keys_;
+  std::vector<unsigned char> frontier_candidate_status_;
+
+  // == Change log of octree_, guarded by mutex_changes
+  int map_change_log_size_;                  // Max changes kept, 0 disables the log
+  std::deque<MapChangeBlock> map_changes_;
+  long map_changes_count_;
+  unsigned long map_changes_start_;          // The log holds every change made after this version
+  std::vector<VoxelChange> change_buffer_;   // Changes of the integration in progress, guarded by mutex_octo
 
   // == Strings
   std::string filename_octree_;
@@ -246,6 +363,22 @@ private:
   message_filters::Subscriber<sensor_msgs::PointCloud2> *depth2_sub;
   message_filters::Synchronizer<sync_policy> *sync;
 
+  // == Depth pipeline
+  // callback -> conversion -> integration -> density, each stage on its own thread
+  bool is_depth_pipeline_enabled_;
+  bool is_depth_dropping_when_full_; // Drop incoming frames instead of blocking the callback
+  bool is_depth_fusing_cameras_;     // Integrate synchronized cameras as one octree update
+  int depth_queue_size_;
+  std::atomic<long> depth_frames_dropped_;
+  std::atomic<bool> is_depth_pipeline_running_;
+  LockFreeQueue<DepthJob>*   depth_job_queue_;
+  LockFreeQueue<DepthFrame>* depth_frame_queue_;
+  LockFreeQueue<DepthFrame>* density_frame_queue_;
+  LockFreeQueue<DepthFrame>* depth_frame_pool_; // Retired frames whose buffers can be reused
+  DepthFrame depth_frame_sync_;                  // Buffers for the synchronous path
+  DepthKernel depth_kernel_;                     // Used by whichever thread converts depth frames
+  std::vector<std::thread> depth_workers_;
+
 private:
   friend class boost::serialization::access;
 
@@ -289,12 +422,18 @@ private:
 
 
     // == Point clouds and octrees
+    if (Archive::is_saving::value)
+      getPointCloud();
+
     ar & cloud_ptr_rgbd_;
+
+    if (Archive::is_loading::value)
+      resetAccumulatorFromPointCloud();
     //PointCloudXYZ::Ptr cloud_ptr_profile_;
     //PointCloudXYZ::Ptr cloud_ptr_profile_symmetry_;
     //octomap::OcTree* octree_;
     //octomap::OcTree* octree_prediction_;
-    //std::map<octomap::OcTreeKey, int, OctomapKeyCompare> voxel_densities_;
+    //VoxelHashMap<VoxelDensity> voxel_densities_;
 
     // == Strings
     ar & filename_octree_;
@@ -16,6 +16,7 @@
 #include "nbv_exploration/common.h"
 #include "nbv_exploration/nbv_history.h"
 #include "nbv_exploration/mapping_module.h"
+#include "utilities/collision_index.h"
 
 
 class ViewGeneratorBase
@@ -30,7 +31,10 @@ protected:
   double nav_bounds_x_max_, nav_bounds_y_max_, nav_bounds_z_max_;
   double nav_bounds_x_min_, nav_bounds_y_min_, nav_bounds_z_min_;
   bool is_debug_;
-  std::vector<fcl::CollisionObject*> collision_boxes_;
+  CollisionIndex collision_index_; // Occupied voxels of the octree, bucketed for sphere queries
+  octomap::OcTree* collision_tree_;        // Tree the index follows
+  unsigned long collision_version_;        // Map version the index is known to include
+  std::vector<VoxelChange> map_changes_;   // Scratch buffer for the changes since collision_version_
   
 public:
   // ==========
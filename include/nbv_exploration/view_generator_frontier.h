@@ -8,13 +8,9 @@
 
 #include "nbv_exploration/view_generator_base.h"
 #include "nbv_exploration/common.h"
+#include "utilities/voxel_clusterer.h"
 
 
-struct KeyIndex{
-  octomap::OcTreeKey key;
-  int index;
-};
-
 class ViewGeneratorFrontier : public ViewGeneratorBase
 {
 public:
@@ -28,8 +24,12 @@ protected:
   int nearest_frontiers_count_; // number of frontiers to extract when finding the nearest frontiers
   double cylinder_radius_; //radius of sampling cylinder
   double cylinder_height_;
+  bool is_using_entropy_frontiers_; // Also generate views around the frontier cells, not only low density ones
 
   ros::Publisher pub_vis_frontier_points_;
+  VoxelClusterer clusterer_;
+  VoxelClusterer density_clusterer_;  // Keeps the low density clusters between iterations
+  VoxelClusterer frontier_clusterer_; // Same for the frontier cells tracked by the mapping module
 
   std::vector<std::vector<octomap::OcTreeKey> > findFrontierAdjacencies(std::vector<octomap::OcTreeKey>& cells);
   std::vector<octomap::OcTreeKey> findFrontierCells();
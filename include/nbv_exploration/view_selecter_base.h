@@ -18,11 +18,55 @@
 
 #include "nbv_exploration/view_generator_base.h"
 #include "nbv_exploration/mapping_module.h"
+#include "utilities/dense_voxel_grid.h"
+#include "utilities/depth_rasterizer.h"
+#include "utilities/ray_marcher.h"
+#include "utilities/ray_sampler.h"
+#include "utilities/ray_template_cache.h"
+#include "utilities/voxel_hash.h"
+#include "utilities/voxel_state_cache.h"
 
 
 class ViewSelecterBase
 {
 public:
+  // How candidates find the first voxel hit by each ray
+  enum VisibilityType {VISIBILITY_RAYCAST, VISIBILITY_ZBUFFER};
+
+  // How far plane rays are laid out
+  enum RaySampling {RAY_SAMPLING_GRID, RAY_SAMPLING_BANDS};
+
+  // Evaluation state of a single candidate pose
+  // Candidates are scored concurrently, so anything written during evaluation lives here
+  struct ViewContext{
+    geometry_msgs::Pose pose;
+    const RayTemplateCache::Bundle* rays; // Far plane rays at the pose, owned by ray_cache_
+    visualization_msgs::Marker ray_msg;
+    RayMarcher ray_marcher;
+    DepthRasterizer rasterizer;
+    DepthRasterizer rasterizer_predicted;
+    std::vector<int> predicted_hits;      // Per ray, first voxel hit in predicted_keys_, -1 if none (z-buffer only)
+
+    // Scratch sets of unique voxels, cleared by each utility that uses them
+    // Their storage is kept between evaluations, so steady state evaluation does not allocate
+    VoxelHashSet keys;
+    VoxelHashSet keys_predicted;
+    VoxelHashMap<octomap::OcTreeNode*> key_nodes;
+
+    double utility;
+    float utility_density;
+    float utility_distance;
+    float utility_entropy;
+    float utility_prediction;
+    int   occupied_voxels;
+
+    long  cache_hits;
+    long  cache_misses;
+
+    double utility_coarse; // Cheap estimate used to prune candidates before full evaluation
+    bool   is_pruned;
+  };
+
   int   info_iteration_;
   float info_distance_total_;
   float info_entropy_total_;
@@ -35,12 +79,6 @@ public:
   float info_selected_utility_prediction_;
   int   info_selected_occupied_voxels_;
 
-  float temp_utility_density_;
-  float temp_utility_distance_;
-  float temp_utility_entropy_;
-  float temp_utility_prediction_;
-  int   temp_occupied_voxels_;
-
   ViewSelecterBase();
 
   void evaluate();
@@ -74,11 +112,57 @@ protected:
   bool is_debug_;
   bool must_see_occupied_;
   bool is_ignoring_clamping_entropies_;
+  bool is_drawing_rays_;                   // Ray markers are only built when someone listens
   
   std::vector<Eigen::Vector3d> rays_far_plane_;
-  std::vector<octomap::point3d> rays_far_plane_at_pose_;
+  std::vector<float> rays_start_;          // Distance along each ray where it starts, with depth bands
+  std::vector<float> rays_range_;          // Distance along each ray to the far plane, with depth bands
+  std::vector<int>   rays_parent_;         // Ray each one continues, with depth bands
+  int    rays_h_count_;                    // Layout of rays_far_plane_ as a grid, horizontal major (0 with depth bands)
+  int    rays_v_count_;
+  double rays_step_;                       // Grid spacing on the far plane
+  int    ray_sampling_;
+  int    ray_jitter_;                      // RaySampler::Jitter, depth bands only
+  int    ray_budget_;                      // Max rays per camera, 0 for no limit
+  RaySampler ray_sampler_;
+  std::vector<int> rays_coarse_idx_;       // Sparse subset of rays_far_plane_ for coarse estimates
+  RayTemplateCache ray_cache_;             // Rays of all cameras per candidate orientation
+  int ray_cache_size_;                     // Orientations kept between evaluations
+
+  // Coarse-to-fine evaluation
+  bool is_coarse_pruning_;
+  int  coarse_top_k_;                      // Candidates evaluated at full resolution
+  int  coarse_ray_step_;                   // Every n-th ray horizontally and vertically
+  int  coarse_depth_;                      // Octree depth whose voxel size is used to step along coarse rays
+  int  coarse_check_interval_;             // Every n-th evaluation scores all candidates to check the pruning, 0 never
+  int  coarse_evaluations_;
+  std::vector<ViewContext> view_contexts_; // One per generated pose, buffers reused between iterations
+  DenseVoxelGrid grid_;                    // Snapshot of tree_ within the object bounds, kept by update()
+  unsigned long grid_version_;             // Map version the snapshot is known to include
+  double grid_entropy_;                    // Total entropy of the snapshot, kept in double while updated incrementally
+  int grid_full_update_interval_;          // Iterations between full rebuilds, which also reset entropy drift
+  int grid_updates_since_full_;
+  std::vector<VoxelChange> map_changes_;
+
+  // Software z-buffer visibility
+  int   visibility_type_;
+  std::vector<octomap::OcTreeKey> occupied_keys_;
+  std::vector<float> occupied_x_;          // Centers of the occupied voxels in the snapshot, drawn for each view
+  std::vector<float> occupied_y_;
+  std::vector<float> occupied_z_;
+  bool is_rendering_predicted_;            // Predicted voxels are drawn too, see updatePredictedVoxels()
+  DenseVoxelGrid grid_predicted_;          // Snapshot of the predicted tree within the same bounds
+  std::vector<octomap::OcTreeKey> predicted_keys_;
+  std::vector<float> predicted_x_;         // Centers of the occupied voxels in the predicted snapshot
+  std::vector<float> predicted_y_;
+  std::vector<float> predicted_z_;
+
+  // Voxel states shared by all candidates of an evaluation round
+  VoxelStateCache voxel_cache_;
+  int voxel_cache_size_;                 // Max entries, 0 disables the cache
+  unsigned long voxel_cache_version_;    // Map version the cached states were read from
+  octomap::OcTree* voxel_cache_tree_;
   
-  visualization_msgs::Marker ray_msg;
   visualization_msgs::Marker trajectory_msg;
 
   // Topic handlers
@@ -93,25 +177,37 @@ protected:
   bool isNodeOccupied(octomap::OcTreeNode node);
   bool isNodeUnknown(octomap::OcTreeNode node);
   bool isPointInBounds(octomap::point3d &p);
+  void updateOccupiedVoxels();
+  void updatePredictedVoxels(octomap::OcTree* tree_predicted);
+  void updateSnapshot(const octomap::point3d& min, const octomap::point3d& max);
+  void updateVoxelCache();
 
   void   getCameraRotationMtxs();
   double getNodeOccupancy(octomap::OcTreeNode* node);
   double getNodeEntropy(octomap::OcTreeNode* node);
   int    getPointCountAtOcTreeKey(octomap::OcTreeKey key);
+  VoxelStateCache::VoxelState getVoxelState(ViewContext& ctx, const octomap::OcTreeKey& key, octomap::OcTreeNode* node);
 
+  void   castRays(ViewContext& ctx, const octomap::point3d& origin);
+  void   castRaysZBuffer(ViewContext& ctx, const octomap::point3d& origin);
+  bool   castRayPredicted(ViewContext& ctx, octomap::OcTree* tree_predicted, int ray, const octomap::point3d& origin,
+                          const octomap::point3d& dir, double range, octomap::point3d& endpoint);
   double computeRelativeRays();
-  void   computeRaysAtPose(geometry_msgs::Pose p);
+  void   computeRaysAtPose(ViewContext& ctx);
+  void   evaluateCandidate(ViewContext& ctx);
+  double estimateUtilityCoarse(ViewContext& ctx);
+  int    pruneCandidates();
 
 
-  double calculateIG(geometry_msgs::Pose p);
+  double calculateIG(ViewContext& ctx);
   double calculateDistance(geometry_msgs::Pose p);
   double calculateAngularDistance(geometry_msgs::Pose p);
-  virtual double calculateUtility(geometry_msgs::Pose p);
+  virtual double calculateUtility(ViewContext& ctx);
   
 
-  void addToRayMarkers(octomap::point3d origin, octomap::point3d endpoint);
-  void clearRayMarkers();
-  void publishRayMarkers();
+  void addToRayMarkers(ViewContext& ctx, octomap::point3d origin, octomap::point3d endpoint);
+  void clearRayMarkers(ViewContext& ctx);
+  void publishRayMarkers(ViewContext& ctx);
   void publishPose(geometry_msgs::Pose p);
   void publishTrajectory();
 };
@@ -26,7 +26,7 @@ public:
   ViewSelecterIg();
 
 protected:
-  double calculateUtility(geometry_msgs::Pose p);
+  double calculateUtility(ViewContext& ctx);
   std::string getMethodName();
 };
 
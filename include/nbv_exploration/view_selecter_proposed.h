@@ -26,9 +26,9 @@ public:
   ViewSelecterProposed();
 
 protected:
-  double calculateUtility(geometry_msgs::Pose p);
+  double calculateUtility(ViewContext& ctx);
   std::string getMethodName();
-  void insertKeyIfUnique(std::set<octomap::OcTreeKey, OctomapKeyCompare>& list, octomap::OcTreeKey key);
+  void insertKeyIfUnique(VoxelHashSet& list, octomap::OcTreeKey key);
   void update();
 
   octomap::OcTree* tree_predicted_;
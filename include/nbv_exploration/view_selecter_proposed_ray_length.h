@@ -27,7 +27,7 @@ public:
 
 protected:
   octomap::OcTree* tree_predicted_;
-  double calculateUtility(geometry_msgs::Pose p);
+  double calculateUtility(ViewContext& ctx);
   std::string getMethodName();
   void update();
 };
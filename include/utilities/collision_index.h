@@ -0,0 +1,55 @@
+#ifndef COLLISION_INDEX_H
+#define COLLISION_INDEX_H
+
+#include <vector>
+
+#include <octomap/octomap.h>
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/voxel_hash.h"
+
+/*
+ * Spatial index of occupied voxels for sphere collision queries
+ *
+ * Voxels are identified by their octree key and bucketed into cubic cells of
+ * size "cell_size", each voxel in the cell holding its center. A sphere query
+ * only visits the cells overlapping the sphere's bounding box (grown by half
+ * a voxel) and tests the voxels found there exactly, so its cost depends on
+ * the local density of voxels rather than on the size of the map. With the
+ * cell size on the order of the sphere radius, a query visits at most 64
+ * cells.
+ *
+ * Voxels are inserted and erased one at a time, so the index can follow the
+ * changes of each integration. Memory is bounded by the number of occupied
+ * voxels: empty cells are released.
+ *
+ * A sphere collides with a voxel if the closest point of the voxel lies
+ * within the radius, as fcl::collide() of a sphere and a box reports it.
+ */
+class CollisionIndex
+{
+public:
+  CollisionIndex();
+
+  void   clear();
+  bool   empty() const { return size_ == 0; }
+  // Both return true if the index changed
+  bool   erase(const octomap::OcTreeKey& key);
+  bool   insert(const octomap::OcTreeKey& key);
+  bool   isSphereColliding(const octomap::point3d& center, double radius) const;
+  void   setCellSize(double cell_size);
+  // Voxel size of the keys, the index is cleared if it changes
+  void   setResolution(double resolution);
+  size_t size() const  { return size_; }
+
+private:
+  double cell_size_;
+  double resolution_;
+  size_t size_;
+  VoxelHashMap<std::vector<octomap::OcTreeKey> > cells_; // Voxels whose center lies in each cell
+
+  bool getCellKey(const octomap::OcTreeKey& key, octomap::OcTreeKey& cell_key) const;
+  octomap::point3d keyToCoord(const octomap::OcTreeKey& key) const;
+};
+
+#endif // COLLISION_INDEX_H
@@ -0,0 +1,107 @@
+#ifndef DENSE_VOXEL_GRID_H
+#define DENSE_VOXEL_GRID_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+/*
+ * Dense snapshot of the octree within a bounding box
+ *
+ * Every voxel of the box is stored as one byte: its log-odds quantized to
+ * 1/127 of the largest clamping threshold, or UNKNOWN if no node covers it.
+ * Clamped values map to fixed codes, so clamping checks are exact. Pruned
+ * leaves are expanded into all the voxels they cover.
+ *
+ * build() walks the tree once, skipping subtrees outside the box, and fills
+ * disjoint subtrees in parallel. Occupancy and entropy of each code are
+ * tabulated, so sums over the box become a histogram of codes.
+ *
+ * Between builds, the snapshot can follow the tree through the voxels changed
+ * by each update (see OccupancyKeyBatch::updateTree()).
+ */
+class DenseVoxelGrid
+{
+public:
+  static const int8_t UNKNOWN = -128;
+
+  DenseVoxelGrid();
+
+  // Snapshot of the voxels whose keys lie between the keys of min and max (inclusive)
+  void build(octomap::OcTree* tree, const octomap::point3d& min, const octomap::point3d& max);
+  void clear();
+  bool isSnapshotOf(const octomap::OcTree* tree, const octomap::point3d& min, const octomap::point3d& max) const;
+
+  // Sets the voxel to its new log-odds, returns the change of getEntropySum(ignore_clamping)
+  // Voxels outside the box are ignored, applying a change twice has no further effect
+  double applyChange(const octomap::OcTreeKey& key, float log_odds, bool ignore_clamping);
+
+  bool contains(const octomap::OcTreeKey& key) const
+  {
+    return !codes_.empty() &&
+        key[0] >= min_key_[0] && key[0] <= max_key_[0] &&
+        key[1] >= min_key_[1] && key[1] <= max_key_[1] &&
+        key[2] >= min_key_[2] && key[2] <= max_key_[2];
+  }
+
+  // key must be contained in the grid
+  int8_t getCode(const octomap::OcTreeKey& key) const
+  {
+    return codes_[getIndex(key)];
+  }
+
+  bool   isKnown(int8_t code) const          { return code != UNKNOWN; }
+  float  getLogOdds(int8_t code) const       { return code == UNKNOWN ? 0 : code*scale_; }
+  double getOccupancy(int8_t code) const     { return occupancy_[code+128]; }
+  double getEntropy(int8_t code, bool ignore_clamping) const
+  {
+    return ignore_clamping ? entropy_unclamped_[code+128] : entropy_[code+128];
+  }
+
+  // Sum of getEntropy() over the whole box
+  double getEntropySum(bool ignore_clamping) const;
+
+  // Keys of the known voxels with at least the given log-odds, in storage order
+  void getKeysAbove(float log_odds, std::vector<octomap::OcTreeKey>& keys) const;
+
+  size_t size() const { return codes_.size(); }
+  const octomap::OcTreeKey& getMinKey() const { return min_key_; }
+  const octomap::OcTreeKey& getMaxKey() const { return max_key_; }
+
+private:
+  struct Block{
+    octomap::OcTreeNode* node;
+    unsigned int base[3]; // Lowest key covered by the node
+    int level;            // Node covers 2^level voxels per axis
+  };
+
+  octomap::OcTree* tree_;
+  std::vector<int8_t> codes_; // x major, z fastest
+  octomap::OcTreeKey min_key_;
+  octomap::OcTreeKey max_key_;
+  size_t size_[3];
+
+  float scale_;               // Log-odds per code step
+  float clamp_min_;
+  float clamp_max_;
+  int8_t clamp_min_code_;
+  int8_t clamp_max_code_;
+  double occupancy_[256];     // Per code, offset by 128
+  double entropy_[256];
+  double entropy_unclamped_[256]; // 0 at or beyond the clamping thresholds
+
+  size_t getIndex(const octomap::OcTreeKey& key) const
+  {
+    return ((size_t)(key[0]-min_key_[0])*size_[1] + (key[1]-min_key_[1]))*size_[2] + (key[2]-min_key_[2]);
+  }
+
+  int8_t toCode(float log_odds) const;
+  void   computeTables();
+  void   expandBlock(const Block& b, std::vector<Block>& children);
+  void   fillBlock(const Block& b, int8_t code);
+};
+
+#endif // DENSE_VOXEL_GRID_H
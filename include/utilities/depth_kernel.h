@@ -0,0 +1,61 @@
+#ifndef DEPTH_KERNEL_H
+#define DEPTH_KERNEL_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <Eigen/Core>
+#include <pcl/point_types.h>
+
+/*
+ * Vectorized correction and rigid transform of an organized depth frame
+ *
+ * Points are first deinterleaved into structure-of-arrays buffers. run() then
+ * replaces non-finite points with the matching entry of the max range table,
+ * applies the sensor to world transform and flags points whose depth (camera
+ * z) is within range, processing 8 (AVX2) or 4 (SSE2) points per instruction.
+ * The backend is picked at runtime, with a scalar fallback on other CPUs.
+ *
+ * All buffers are kept between frames.
+ */
+class DepthKernel
+{
+public:
+  enum Backend {AUTO, SCALAR, SSE2, AVX2};
+
+  DepthKernel();
+
+  // Deinterleave float32 x/y/z fields of an organized cloud (e.g. PointCloud2 data)
+  void load(const uint8_t* data, int width, int height, size_t point_step, size_t row_step,
+            int offset_x, int offset_y, int offset_z);
+  void run(const Eigen::Matrix4d& transform, float max_depth);
+
+  void    setBackend(Backend b);
+  Backend getBackend();
+  void    setMaxRangeTable(const pcl::PointXYZ* table, int count);
+
+  int size() const { return count_; }
+
+  // Results of run(), world frame
+  const float*   getX() const { return &out_x_[0]; }
+  const float*   getY() const { return &out_y_[0]; }
+  const float*   getZ() const { return &out_z_[0]; }
+  const uint8_t* getNearMask() const { return &is_near_[0]; }
+
+  static bool isAVX2Supported();
+
+private:
+  Backend backend_;
+  int count_;
+
+  std::vector<float> in_x_, in_y_, in_z_;
+  std::vector<float> max_x_, max_y_, max_z_;
+  std::vector<float> out_x_, out_y_, out_z_;
+  std::vector<uint8_t> is_near_;
+
+  void runScalar(const float* m, float max_depth, int start, int end);
+  void runSSE2(const float* m, float max_depth, int start, int end);
+  void runAVX2(const float* m, float max_depth, int start, int end);
+};
+
+#endif // DEPTH_KERNEL_H
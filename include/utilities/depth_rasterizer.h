@@ -0,0 +1,63 @@
+#ifndef DEPTH_RASTERIZER_H
+#define DEPTH_RASTERIZER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+
+/*
+ * Software z-buffer for voxel visibility
+ *
+ * Instead of marching every pixel ray through the map, voxels are drawn into
+ * a depth buffer: each one is projected once, and only the pixels within its
+ * projected bounds test their ray against the voxel's box. The nearest box
+ * entry wins, so every pixel ends up with the same first hit a traversal of
+ * its ray would find.
+ *
+ * The camera follows the view selecter's ray layout: x looks forward, pixel
+ * (i,j) looks along (1, min_h + i*step, min_v + j*step) and pixels are stored
+ * with j fastest. Voxel centers are given as separate x/y/z arrays, so the
+ * projection runs as a plain loop over floats that the compiler vectorizes.
+ *
+ * Buffers are kept between calls, use one rasterizer per thread.
+ */
+class DepthRasterizer
+{
+public:
+  DepthRasterizer();
+
+  // Slopes of the first pixel and between pixels
+  void setCamera(int width, int height, float min_h, float min_v, float step);
+
+  // rotation maps camera to world axes. Voxels are axis aligned cubes of the given half size,
+  // drawn if their center lies within the pixel's ray up to the far plane at max_depth (camera x)
+  void render(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& origin,
+              const float* x, const float* y, const float* z, int count,
+              float half_size, float max_depth);
+
+  // Distance from the origin at which the pixel's ray enters its voxel, infinity if none
+  float getDepth(int pixel) const { return depth_[pixel]; }
+  // Index of the pixel's voxel in the arrays given to render(), -1 if none
+  int   getVoxel(int pixel) const { return voxel_[pixel]; }
+
+  int size() const { return width_*height_; }
+
+private:
+  int width_;
+  int height_;
+  float min_h_;
+  float min_v_;
+  float step_;
+
+  std::vector<float> depth_;
+  std::vector<int>   voxel_;
+
+  // Per pixel: inverse of the world direction of its ray, and squared ray length
+  std::vector<float> inv_x_, inv_y_, inv_z_;
+  std::vector<float> range_sq_;
+
+  // Camera frame coordinates of the voxels being drawn
+  std::vector<float> cam_f_, cam_h_, cam_v_;
+};
+
+#endif // DEPTH_RASTERIZER_H
@@ -0,0 +1,84 @@
+#ifndef ESDF_MAP_H
+#define ESDF_MAP_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+#include "utilities/occupancy_key_batch.h"
+
+/*
+ * Euclidean distance field of the occupied voxels of an octree
+ *
+ * A dense grid over a fixed box, aligned with the octree voxels, stores for
+ * each cell the distance to the nearest occupied voxel center and which voxel
+ * that is. Distances are capped at max_distance, farther cells keep the cap.
+ * Distance queries are then a lookup in the grid. The gradient of the field
+ * points away from the nearest obstacle, so it is read from the stored
+ * obstacle index rather than by differencing neighbors.
+ *
+ * The field is maintained incrementally from the voxel changes of each
+ * integration: new obstacles propagate their distance outwards (breadth
+ * first over 26 neighbors, keeping the nearest obstacle of each cell), and
+ * removed obstacles first clear every cell they were nearest to, then let
+ * the surrounding cells propagate into the cleared region. Only cells near a
+ * change are visited. Each obstacle keeps the cells it is nearest to in a
+ * linked list, so clearing them does not search the grid.
+ *
+ * Unknown voxels count as free. Occupied voxels outside the box are ignored.
+ */
+class EsdfMap
+{
+public:
+  EsdfMap();
+
+  // Empties the field, the box is rounded outwards to whole voxels
+  void reset(const octomap::point3d& min, const octomap::point3d& max, double resolution, double max_distance);
+
+  // Rebuilds the field from the voxels of the tree within the box, occupied at or above the threshold
+  void build(octomap::OcTree* tree, float occupied_log_odds);
+  // Applies the changes of one integration, voxels are occupied at or above the threshold
+  void update(const std::vector<VoxelChange>& changes, float occupied_log_odds);
+
+  bool   contains(const octomap::point3d& p) const;
+  // Distance to the nearest occupied voxel center, max_distance outside the box or when farther
+  double getDistance(const octomap::point3d& p) const;
+  // Same, with the unit gradient (away from the nearest obstacle, zero if none or on it). Returns false outside the box
+  bool   getDistanceAndGradient(const octomap::point3d& p, double& distance, Eigen::Vector3d& gradient) const;
+  double getMaxDistance() const { return max_distance_; }
+  double getResolution() const  { return resolution_; }
+
+  long getUpdatedCellCount() const { return updated_cells_; }
+
+private:
+  double resolution_;
+  double max_distance_;
+  octomap::point3d box_min_;
+  octomap::point3d box_max_;
+  int origin_key_[3]; // Octree key of cell (0,0,0)
+  int size_[3];
+
+  std::vector<float> distance_;
+  std::vector<int>   obstacle_;       // Index of the nearest occupied cell, -1 if none within max_distance
+  std::vector<unsigned char> occupied_;
+  std::vector<int>   next_;           // Circular list of the cells sharing a nearest obstacle, through the obstacle
+  std::vector<int>   prev_;
+
+  // Scratch queues, kept between updates
+  std::vector<int> queue_lower_;
+  std::vector<int> queue_raise_;
+
+  long updated_cells_;
+
+  int  getIndex(const octomap::OcTreeKey& key) const;
+  int  getIndex(const octomap::point3d& p) const;
+  void getCell(int idx, int* cell) const;
+  void link(int idx, int obstacle);
+  void unlink(int idx);
+  void setObstacle(int idx, bool is_occupied);
+  void propagate();
+};
+
+#endif // ESDF_MAP_H
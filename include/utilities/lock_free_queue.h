@@ -0,0 +1,245 @@
+#ifndef LOCK_FREE_QUEUE_H
+#define LOCK_FREE_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Bounded lock-free queue (D. Vyukov's array based MPMC queue)
+ *
+ * Each slot carries a sequence number telling producers and consumers whether
+ * it is free or filled for the current lap, so any number of producers and
+ * consumers can use the queue without locks. tryPush() fails when the queue is
+ * full, leaving the backpressure or drop policy to the caller.
+ *
+ * push() and pop() block instead, for threads that have nothing else to do.
+ * They sleep on a condition variable until the other side makes room or adds
+ * an item, or until close() is called. The lock is only taken to sleep and to
+ * wake sleepers: the try functions read an atomic count of sleepers and skip
+ * the wake up when there are none.
+ */
+template <typename T>
+class LockFreeQueue
+{
+public:
+  LockFreeQueue(size_t capacity = 8):
+    sleepers_(0),
+    is_closed_(false)
+  {
+    // Rounded up to a power of 2
+    size_t cap = 2;
+    while (cap < capacity)
+      cap <<= 1;
+
+    mask_ = cap - 1;
+    slots_ = std::vector<Slot>(cap);
+    for (size_t i=0; i<cap; i++)
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+
+  bool tryPush(const T& item)
+  {
+    if (!tryPushNoWake(item))
+      return false;
+
+    wake();
+    return true;
+  }
+
+  bool tryPop(T& item)
+  {
+    if (!tryPopNoWake(item))
+      return false;
+
+    wake();
+    return true;
+  }
+
+  // Both return false once the queue is closed
+  bool push(const T& item)
+  {
+    if (is_closed_)
+      return false;
+    if (tryPush(item))
+      return true;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    startSleeping();
+
+    bool is_pushed;
+    while (!(is_pushed = tryPushNoWake(item)) && !is_closed_)
+      cond_.wait(lock);
+
+    sleepers_.fetch_sub(1);
+    lock.unlock();
+
+    if (is_pushed)
+      wake();
+    return is_pushed;
+  }
+
+  bool pop(T& item)
+  {
+    if (is_closed_)
+      return false;
+    if (tryPop(item))
+      return true;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    startSleeping();
+
+    bool is_popped;
+    while (!(is_popped = tryPopNoWake(item)) && !is_closed_)
+      cond_.wait(lock);
+
+    sleepers_.fetch_sub(1);
+    lock.unlock();
+
+    if (is_popped)
+      wake();
+    return is_popped;
+  }
+
+  // Wakes every blocked push() and pop(), items still queued are left to the try functions
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_closed_ = true;
+    }
+    cond_.notify_all();
+  }
+
+  size_t capacity() const
+  {
+    return mask_ + 1;
+  }
+
+  // Approximate while other threads are pushing or popping
+  size_t size() const
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+private:
+  struct Slot{
+    std::atomic<size_t> sequence;
+    T item;
+
+    Slot() : sequence(0) {}
+    Slot(const Slot& other) : sequence(other.sequence.load()), item(other.item) {}
+  };
+
+  // Head and tail are kept on separate cache lines so producers and consumers do not contend
+  char pad0_[64];
+  std::vector<Slot> slots_;
+  size_t mask_;
+  char pad1_[64];
+  std::atomic<size_t> head_;
+  char pad2_[64];
+  std::atomic<size_t> tail_;
+  char pad3_[64];
+
+  // Blocked push() and pop() calls
+  std::atomic<int> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<bool> is_closed_; // Set under mutex_
+
+  void startSleeping()
+  {
+    // Pairs with the fence in wake(): either the sleeper sees the change to the
+    // slots, or the thread that made it sees the sleeper
+    sleepers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void wake()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) == 0)
+      return;
+
+    // A sleeper holds the lock from its last check until it waits
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+    }
+    cond_.notify_all();
+  }
+
+  bool tryPushNoWake(const T& item)
+  {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      Slot& slot = slots_[pos & mask_];
+      size_t seq = slot.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+      if (diff == 0)
+      {
+        // Slot is free for this lap, claim it
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          slot.item = item;
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        // Full
+        return false;
+      }
+      else
+      {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool tryPopNoWake(T& item)
+  {
+    size_t pos = head_.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      Slot& slot = slots_[pos & mask_];
+      size_t seq = slot.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+      if (diff == 0)
+      {
+        // Slot is filled for this lap, claim it
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          item = slot.item;
+          slot.item = T(); // Release anything held by the item
+          slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        // Empty
+        return false;
+      }
+      else
+      {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+#endif // LOCK_FREE_QUEUE_H
@@ -0,0 +1,88 @@
+#ifndef OCCUPANCY_KEY_BATCH_H
+#define OCCUPANCY_KEY_BATCH_H
+
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+#include <octomap/OcTree.h>
+#include <octomap/OcTreeKey.h>
+
+// Log-odds of a voxel before and after an update
+struct VoxelChange{
+  octomap::OcTreeKey key;
+  float log_odds_old; // NaN if the voxel was unknown
+  float log_odds_new;
+};
+
+/*
+ * Flat replacement for the free/occupied octomap::KeySet pair of a scan update
+ *
+ * Each thread appends keys to its own vector, encoded as 48-bit Morton codes.
+ * finalize() sorts and deduplicates the thread buffers in parallel, merges them
+ * and removes free cells that are also occupied. Since Morton order is the
+ * depth-first order of the octree, updateTree() walks the tree once for the
+ * whole batch, splitting the codes among the children of each node. Only the
+ * inner nodes above updated voxels are visited, each of them once, and they are
+ * pruned or refreshed from their children on the way back up, so the tree stays
+ * as compact as with octomap's own (non-lazy) updates.
+ *
+ * The thread buffers keep their capacity between scans. Several scans (e.g. one
+ * per camera) can be added between reset() and finalize(), they are then
+ * merged as a single update where occupied cells win over free ones.
+ *
+ * Rays of a depth frame share the sensor origin, so voxels near the sensor are
+ * crossed by hundreds of rays. With an emission cache enabled, each thread
+ * remembers the most recent free codes it emitted (direct mapped) and skips
+ * repeats before they reach the buffers. Feeding rays in bundles of
+ * neighboring pixels keeps those repeats within the cache. This only saves
+ * the emission, each ray is still traced in full by the caller.
+ *
+ * updateTree() can also report every voxel whose log-odds changed, so
+ * consumers of the map can follow it without rescanning the tree.
+ */
+class OccupancyKeyBatch
+{
+public:
+  OccupancyKeyBatch();
+
+  void addFree(int thread_idx, const octomap::KeyRay& ray);
+  void addFree(int thread_idx, const octomap::OcTreeKey& key);
+  void addOccupied(int thread_idx, const octomap::OcTreeKey& key);
+  void finalize();
+  void reset(int num_threads);
+  void setEmissionCacheSize(int size);
+  void updateTree(octomap::OcTree* tree, float free_log_odds, float occupied_log_odds,
+                  double occupied_min_height = -std::numeric_limits<double>::max(),
+                  std::vector<VoxelChange>* changes = NULL);
+
+  const std::vector<uint64_t>& getFreeCodes() const { return free_codes_; }
+  const std::vector<uint64_t>& getOccupiedCodes() const { return occupied_codes_; }
+  long getSuppressedCount() const;
+
+  static uint64_t keyToMorton(const octomap::OcTreeKey& key);
+  static octomap::OcTreeKey mortonToKey(uint64_t code);
+
+  // Same as tree->updateNode(), appending the voxel to changes (if given) when its log-odds change.
+  // The old log-odds are read during the same descent as the update.
+  static void updateNode(octomap::OcTree* tree, const octomap::OcTreeKey& key, float log_odds,
+                         std::vector<VoxelChange>* changes);
+
+private:
+  std::vector<std::vector<uint64_t> > free_threaded_;
+  std::vector<std::vector<uint64_t> > occupied_threaded_;
+
+  std::vector<uint64_t> free_codes_;
+  std::vector<uint64_t> occupied_codes_;
+  std::vector<uint64_t> occupied_kept_; // Occupied codes above the minimum height, in updateTree()
+
+  int cache_shift_; // 64 - log2(cache size), 0 when the emission cache is disabled
+  std::vector<std::vector<uint64_t> > cache_threaded_;
+  std::vector<long> suppressed_threaded_;
+
+  void resetCaches();
+  void mergeSorted(std::vector<std::vector<uint64_t> >& sorted_in, std::vector<uint64_t>& merged_out);
+  void removeOccupiedFromFree();
+};
+
+#endif // OCCUPANCY_KEY_BATCH_H
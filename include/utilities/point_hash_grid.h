@@ -0,0 +1,42 @@
+#ifndef POINT_HASH_GRID_H
+#define POINT_HASH_GRID_H
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/voxel_hash.h"
+
+/*
+ * Spatial index of points stored in hashed buckets
+ *
+ * Points are bucketed into cubic cells of size "cell_size" so that radius
+ * queries only visit the handful of cells overlapping the search sphere. Each
+ * point also claims a leaf of size "leaf_size" (the voxel grid filter size),
+ * and at most one point is kept per leaf. Inserting a frame therefore costs
+ * O(new points) and never touches the rest of the map.
+ */
+class PointHashGrid
+{
+public:
+  PointHashGrid();
+  PointHashGrid(double cell_size, double leaf_size);
+
+  void   clear();
+  bool   empty();
+  bool   insert(const pcl::PointXYZ& p);
+  int    radiusCount(const pcl::PointXYZ& p, double radius);
+  void   setResolution(double cell_size, double leaf_size);
+  size_t size();
+
+private:
+  double cell_size_;
+  double leaf_size_;
+  size_t point_count_;
+
+  VoxelHashMap<std::vector<pcl::PointXYZ> > buckets_;
+  VoxelHashSet leaves_;
+};
+
+#endif // POINT_HASH_GRID_H
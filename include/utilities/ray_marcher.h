@@ -0,0 +1,94 @@
+#ifndef RAY_MARCHER_H
+#define RAY_MARCHER_H
+
+#include <vector>
+
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+#include "utilities/dense_voxel_grid.h"
+
+/*
+ * Single pass replacement for octomap's castRay() followed by computeRayKeys()
+ *
+ * Each ray is walked once with the same 3D-DDA as castRay(), and the walk
+ * records every voxel it crosses together with its node, up to (and excluding)
+ * the endpoint voxel. Unknown voxels are crossed like free ones, as castRay()
+ * does with ignoreUnknown set.
+ *
+ * Node lookups descend the tree once per block: the descent stops at the
+ * pruned leaf or missing child that covers the voxel, and the following voxels
+ * of the ray that fall in the same block reuse that result. Large free or
+ * unknown regions then cost a single descent instead of one per voxel.
+ *
+ * With a dense snapshot of the tree, voxels it marks as unknown are resolved
+ * without touching the tree at all.
+ *
+ * walkRay() only records the voxels crossed up to a given length, for callers
+ * that know the endpoint from elsewhere (e.g. a depth buffer).
+ *
+ * Results of a batch are stored in flat buffers kept between calls. The tree
+ * is only read, so one marcher per thread can share a tree.
+ */
+class RayMarcher
+{
+public:
+  struct Ray{
+    octomap::point3d    endpoint;       // Center of the endpoint voxel, as returned by castRay()
+    octomap::OcTreeKey  end_key;
+    octomap::OcTreeNode* end_node;      // NULL if the endpoint voxel is unknown
+    bool found_endpoint;                // An occupied voxel was hit within range
+    bool has_end_key;                   // False if the origin is outside the tree
+    int  first;                         // Traversed voxels, in getKeys() and getNodes()
+    int  count;
+  };
+
+  RayMarcher();
+
+  // The grid, if any, must be a snapshot of the current state of the tree
+  void setTree(octomap::OcTree* tree, const DenseVoxelGrid* grid = NULL);
+  void clear();
+
+  // Appends one ray, direction does not need to be normalized
+  bool castRay(const octomap::point3d& origin, const octomap::point3d& direction, double max_range, Ray& ray);
+
+  // Appends one ray whose voxels are recorded up to length without reading the tree (nodes are NULL)
+  // With a snapshot, only the part within it is walked. Endpoint fields are left to the caller
+  Ray& walkRay(const octomap::point3d& origin, const octomap::point3d& direction, double length);
+
+  // Casts all rays from one origin, the length of each ray vector is its max range
+  void castRays(const octomap::point3d& origin, const std::vector<octomap::point3d>& rays);
+  // Same from separate arrays of normalized directions and lengths. With start distances, rays begin
+  // there instead of at the origin. With parents, rays whose parent hit something are not cast (see RaySampler)
+  void castRays(const octomap::point3d& origin, const float* dir_x, const float* dir_y, const float* dir_z,
+                const float* length, int count, const float* start = NULL, const int* parent = NULL);
+
+  const std::vector<Ray>&                  getRays() const  { return rays_; }
+  const std::vector<octomap::OcTreeKey>&   getKeys() const  { return keys_; }
+  const std::vector<octomap::OcTreeNode*>& getNodes() const { return nodes_; }
+
+  long getLookupCount() const   { return lookups_; }
+  long getBlockHitCount() const { return block_hits_; }
+
+private:
+  octomap::OcTree* tree_;
+  const DenseVoxelGrid* grid_;
+
+  std::vector<Ray> rays_;
+  std::vector<octomap::OcTreeKey> keys_;
+  std::vector<octomap::OcTreeNode*> nodes_;
+
+  // Block found by the last descent, covering 2^block_level_ voxels per axis
+  int block_level_; // -1 when no block is cached
+  unsigned int block_key_[3];
+  octomap::OcTreeNode* block_node_;
+
+  long lookups_;
+  long block_hits_;
+
+  bool initTraversal(const octomap::point3d& origin, const octomap::point3d& direction, const octomap::OcTreeKey& key,
+                     int* step, double* t_max, double* t_delta);
+  octomap::OcTreeNode* lookup(const octomap::OcTreeKey& key);
+};
+
+#endif // RAY_MARCHER_H
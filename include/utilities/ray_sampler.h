@@ -0,0 +1,54 @@
+#ifndef RAY_SAMPLER_H
+#define RAY_SAMPLER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+
+/*
+ * Far plane rays whose spacing follows the voxel size at each depth
+ *
+ * A fixed grid of far plane rays is as dense near the sensor as it is at the
+ * far plane, so near voxels are crossed by many rays. Here the frustum is cut
+ * into depth bands, each twice as deep as the previous one, and every band
+ * gets its own grid of rays spaced one voxel apart at the band's far edge.
+ * A ray only covers the depths of its band.
+ *
+ * Grids of consecutive bands nest: each ray continues the ray of the previous
+ * band whose cell contains it (its parent), and is only cast if the parent
+ * was not blocked. Directions are taken at cell centers, or jittered within
+ * the cell (stratified random or Halton).
+ *
+ * With a ray budget, all spacings are widened evenly until the total ray
+ * count fits.
+ */
+class RaySampler
+{
+public:
+  enum Jitter {JITTER_NONE, JITTER_STRATIFIED, JITTER_HALTON};
+
+  struct Ray{
+    Eigen::Vector3d far;  // Camera frame (x forward), ends at the far edge of the band
+    double start;         // Distance along the ray at which its band begins
+    double range;         // Distance along the ray to the far plane, past its band
+    int parent;           // Index of the covering ray in the previous band, -1 in the first band
+    int band;             // 0 is nearest to the sensor
+    int ix, iy;           // Cell within the band's grid
+  };
+
+  RaySampler();
+
+  void setCamera(double fov_h, double fov_v, double range_max);
+
+  // Rays ordered by band, so parents come first. A budget of 0 is unlimited
+  void sample(double resolution, int budget, Jitter jitter, std::vector<Ray>& rays);
+
+private:
+  double slope_h_; // Far plane half extents per unit of depth
+  double slope_v_;
+  double range_max_;
+
+  int countRays(double step, int& bands) const;
+};
+
+#endif // RAY_SAMPLER_H
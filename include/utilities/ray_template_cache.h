@@ -0,0 +1,75 @@
+#ifndef RAY_TEMPLATE_CACHE_H
+#define RAY_TEMPLATE_CACHE_H
+
+#include <map>
+#include <vector>
+
+#include <Eigen/Core>
+
+/*
+ * Far plane rays of all cameras, rotated once per vehicle orientation
+ *
+ * Candidate generators only produce a handful of distinct orientations (e.g.
+ * the yaw steps of a lattice), so the rotated ray bundles are kept per
+ * orientation. Rotations are matched after rounding each matrix entry to
+ * 1e-6, which keeps the reused directions exact to well below a voxel.
+ *
+ * Bundles hold normalized world directions and ray lengths in separate float
+ * arrays. get() is not thread safe, bundles are meant to be looked up before
+ * candidates are evaluated concurrently, and stay valid until clear() or
+ * setRays() with different rays.
+ */
+class RayTemplateCache
+{
+public:
+  struct Bundle{
+    std::vector<float> dir_x;   // Normalized world directions, cameras one after the other
+    std::vector<float> dir_y;
+    std::vector<float> dir_z;
+    std::vector<float> length;  // Distance from the sensor to the end of the ray (far edge of its band, see RaySampler)
+    std::vector<float> start;   // Distance at which the ray starts counting
+    std::vector<float> range;   // Distance from the sensor to the far plane along the ray, whatever its band
+    std::vector<int>   parent;  // Ray continued by this one, -1 if none
+
+    int size() const { return length.size(); }
+  };
+
+  RayTemplateCache();
+
+  // Rays in each camera frame with their start distances, far plane ranges and parents (see RaySampler),
+  // and the camera orientations relative to the vehicle. Rays without a range end at the far plane
+  void setRays(const std::vector<Eigen::Vector3d>& rays, const std::vector<float>& starts, const std::vector<float>& ranges,
+               const std::vector<int>& parents, const std::vector<Eigen::Matrix3d>& cameras);
+  void clear();
+
+  const Bundle& get(const Eigen::Matrix3d& rotation);
+
+  int  size() const { return bundles_.size(); }
+  long getHitCount() const  { return hits_; }
+  long getMissCount() const { return misses_; }
+
+private:
+  struct Key{
+    long q[9];
+    bool operator<(const Key& other) const;
+  };
+
+  std::vector<Eigen::Vector3d> rays_;
+  std::vector<float> starts_;
+  std::vector<float> ranges_;
+  std::vector<int>   parents_;
+  std::vector<Eigen::Matrix3d> cameras_;
+
+  // All cameras, one after the other
+  std::vector<Eigen::Vector3d> rays_vehicle_; // Vehicle frame
+  std::vector<float> starts_vehicle_;
+  std::vector<float> ranges_vehicle_;
+  std::vector<int>   parents_vehicle_;
+
+  std::map<Key, Bundle> bundles_;
+
+  long hits_;
+  long misses_;
+};
+
+#endif // RAY_TEMPLATE_CACHE_H
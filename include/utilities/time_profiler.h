@@ -6,6 +6,7 @@
 #include <chrono>
 #include <fstream>
 #include <map>
+#include <mutex>
 
 class TimeProfiler {
 
@@ -24,13 +25,16 @@ class TimeProfiler {
     void toc(std::string s);
     void stop();
     void stop(std::string s);
+    void record(std::string s, double value);
     void dump();
 
   private:
     bool verbose;
+    std::mutex mutex_entries; // Timers may be started and stopped from several threads
     std::map<std::string,std::chrono::steady_clock::time_point> timers;
     std::map<std::string,ProfilerEntry> entries;
 
+    void addEntryValue(std::string s, double t);
     std::string getEntryTitle(std::string s);
 };
 
@@ -0,0 +1,70 @@
+#ifndef VOXEL_CLUSTERER_H
+#define VOXEL_CLUSTERER_H
+
+#include <atomic>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/voxel_hash.h"
+
+/*
+ * Connected components of a set of voxels
+ *
+ * Two voxels are connected when their keys differ by at most "radius" along
+ * every axis (radius 1 is the usual 26-neighborhood). Keys are indexed in a
+ * hash map, then each key looks up the neighbors in one half of its
+ * neighborhood (the other half looks it up) and joins their components in a
+ * union-find forest. The work is linear in the number of keys, for a fixed
+ * radius.
+ *
+ * The neighbor lookups run concurrently: the forest is updated with
+ * compare-and-swap, always linking the root with the larger index under the
+ * smaller one, so each component ends up rooted at its first key.
+ *
+ * Clusters are returned in the order of their first key, each with its keys in
+ * input order. Buffers are kept between calls.
+ *
+ * update() gives the same clusters for a set of keys that changes a little
+ * between calls. It remembers the components of the previous call and only
+ * clusters again the ones that lost a key or border a new key, together with
+ * the new keys. The others are kept as they are. Clusters then come in no
+ * particular order. cluster() can be called in between without affecting it.
+ */
+class VoxelClusterer
+{
+public:
+  VoxelClusterer();
+
+  // Clusters with fewer than min_size keys are dropped
+  void cluster(const std::vector<octomap::OcTreeKey>& keys, std::vector<std::vector<octomap::OcTreeKey> >& clusters, int min_size = 1);
+  int  getRadius() const { return radius_; }
+  void reset();
+  void setRadius(int radius);
+  // Same as cluster(), reusing the components of the previous call that did not change
+  void update(const std::vector<octomap::OcTreeKey>& keys, std::vector<std::vector<octomap::OcTreeKey> >& clusters, int min_size = 1);
+
+private:
+  int radius_;
+  std::vector<int> offsets_; // Half of the neighborhood, as (dx, dy, dz) triplets
+
+  VoxelHashMap<int> index_;  // Position of each key in the input
+  std::vector<std::atomic<int> > parent_;
+  std::vector<int> cluster_ids_;
+
+  // == State of update()
+  VoxelHashMap<int> labels_;                                  // Component of each key of the previous call
+  std::vector<std::vector<octomap::OcTreeKey> > components_;  // All components, of any size, empty if unused
+  std::vector<int> free_components_;
+  VoxelHashSet current_;
+  std::vector<unsigned char> is_dirty_;                       // Components to cluster again
+  std::vector<int> dirty_;
+  std::vector<octomap::OcTreeKey> pending_;
+  std::vector<std::vector<octomap::OcTreeKey> > reclustered_;
+
+  int  find(int i);
+  void markDirty(int component);
+  void unite(int a, int b);
+};
+
+#endif // VOXEL_CLUSTERER_H
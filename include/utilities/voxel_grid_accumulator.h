@@ -0,0 +1,42 @@
+#ifndef VOXEL_GRID_ACCUMULATOR_H
+#define VOXEL_GRID_ACCUMULATOR_H
+
+#include <limits>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "utilities/voxel_hash.h"
+
+/*
+ * Streaming equivalent of pcl::VoxelGrid
+ *
+ * Points are folded into their leaf as they arrive, keeping a running sum per
+ * leaf. Adding k points costs O(k) regardless of how many leaves are already
+ * stored. The filtered cloud (one centroid per leaf) is only materialized when
+ * getPointCloud() is called.
+ */
+class VoxelGridAccumulator
+{
+public:
+  VoxelGridAccumulator();
+  VoxelGridAccumulator(double leaf_size);
+
+  bool   addPoint(const pcl::PointXYZ& p);
+  int    addPointCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, double min_height = -std::numeric_limits<double>::max());
+  void   clear();
+  void   getPointCloud(pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+  void   setLeafSize(double leaf_size);
+  size_t size();
+
+private:
+  struct Leaf{
+    double x, y, z;
+    int count;
+  };
+
+  double leaf_size_;
+  VoxelHashMap<Leaf> leaves_;
+};
+
+#endif // VOXEL_GRID_ACCUMULATOR_H
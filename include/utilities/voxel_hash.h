@@ -0,0 +1,312 @@
+#ifndef VOXEL_HASH_H
+#define VOXEL_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+
+/*
+ * Open-addressing hash containers keyed on octomap::OcTreeKey
+ *
+ * Each key is packed losslessly into the low 48 bits of a 64-bit word and mixed
+ * with a bijective finalizer, so distinct voxels never compare equal. Keys and
+ * values live in flat arrays probed linearly, which keeps lookups in the
+ * evaluator and mapping loops within a few cache lines.
+ */
+
+namespace voxel_hash
+{
+  // Packed keys only use 48 bits, so an all-ones word can never be a valid key
+  static const uint64_t EMPTY_KEY = ~uint64_t(0);
+
+  static inline uint64_t packKey(const octomap::OcTreeKey& key)
+  {
+    return  uint64_t(key[0]) |
+           (uint64_t(key[1]) << 16) |
+           (uint64_t(key[2]) << 32);
+  }
+
+  static inline octomap::OcTreeKey unpackKey(uint64_t packed)
+  {
+    return octomap::OcTreeKey(
+          octomap::key_type( packed        & 0xFFFF),
+          octomap::key_type((packed >> 16) & 0xFFFF),
+          octomap::key_type((packed >> 32) & 0xFFFF));
+  }
+
+  // Discretizes a coordinate at an arbitrary resolution into a key centered on
+  // the origin, using the same 16-bit layout octomap uses for its own keys
+  static inline bool coordToKey(double x, double y, double z, double res, octomap::OcTreeKey& key)
+  {
+    double c[3] = {x, y, z};
+
+    for (int i=0; i<3; i++)
+    {
+      int k = (int) floor(c[i]/res) + 32768;
+      if (k < 0 || k > 65535)
+        return false;
+
+      key[i] = octomap::key_type(k);
+    }
+
+    return true;
+  }
+
+  // MurmurHash3 64-bit finalizer. It is a bijection, hence lossless.
+  static inline uint64_t mix(uint64_t x)
+  {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+}
+
+
+template <typename T>
+class VoxelHashMap
+{
+public:
+  class iterator
+  {
+  public:
+    iterator(VoxelHashMap* m, size_t i): map_(m), idx_(i) { skipEmpty(); }
+
+    octomap::OcTreeKey key() const { return voxel_hash::unpackKey(map_->keys_[idx_]); }
+    uint64_t packedKey() const     { return map_->keys_[idx_]; }
+    T& value() const               { return map_->values_[idx_]; }
+
+    iterator& operator++()                  { ++idx_; skipEmpty(); return *this; }
+    bool operator==(const iterator& rhs) const { return idx_ == rhs.idx_; }
+    bool operator!=(const iterator& rhs) const { return idx_ != rhs.idx_; }
+
+  private:
+    void skipEmpty()
+    {
+      while (idx_ < map_->keys_.size() && map_->keys_[idx_] == voxel_hash::EMPTY_KEY)
+        ++idx_;
+    }
+
+    VoxelHashMap* map_;
+    size_t idx_;
+  };
+
+  VoxelHashMap(size_t expected_size = 0):
+    size_(0)
+  {
+    allocate(capacityFor(expected_size));
+  }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end()   { return iterator(this, keys_.size()); }
+
+  size_t size() const     { return size_; }
+  bool   empty() const    { return size_ == 0; }
+  size_t capacity() const { return keys_.size(); }
+
+  void clear()
+  {
+    if (size_ == 0)
+      return;
+
+    std::fill(keys_.begin(), keys_.end(), voxel_hash::EMPTY_KEY);
+    std::fill(values_.begin(), values_.end(), T());
+    size_ = 0;
+  }
+
+  void reserve(size_t n)
+  {
+    size_t cap = capacityFor(n);
+    if (cap > keys_.size())
+      rehash(cap);
+  }
+
+  size_t count(const octomap::OcTreeKey& key) const
+  {
+    return find(key) ? 1 : 0;
+  }
+
+  T* find(const octomap::OcTreeKey& key)
+  {
+    size_t i = findSlot(voxel_hash::packKey(key));
+    return i == NOT_FOUND ? NULL : &values_[i];
+  }
+
+  const T* find(const octomap::OcTreeKey& key) const
+  {
+    size_t i = findSlot(voxel_hash::packKey(key));
+    return i == NOT_FOUND ? NULL : &values_[i];
+  }
+
+  // Returns the stored value and whether it was newly inserted
+  std::pair<T*, bool> insert(const octomap::OcTreeKey& key, const T& value)
+  {
+    return insertPacked(voxel_hash::packKey(key), value);
+  }
+
+  T& operator[](const octomap::OcTreeKey& key)
+  {
+    return *insertPacked(voxel_hash::packKey(key), T()).first;
+  }
+
+  bool erase(const octomap::OcTreeKey& key)
+  {
+    size_t i = findSlot(voxel_hash::packKey(key));
+    if (i == NOT_FOUND)
+      return false;
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    size_t mask = keys_.size()-1;
+    size_t j = i;
+    while (true)
+    {
+      j = (j+1) & mask;
+      if (keys_[j] == voxel_hash::EMPTY_KEY)
+        break;
+
+      size_t home = voxel_hash::mix(keys_[j]) & mask;
+      bool in_place = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+      if (in_place)
+        continue;
+
+      keys_[i]   = keys_[j];
+      values_[i] = values_[j];
+      i = j;
+    }
+
+    keys_[i]   = voxel_hash::EMPTY_KEY;
+    values_[i] = T();
+    size_--;
+    return true;
+  }
+
+private:
+  static const size_t NOT_FOUND = size_t(-1);
+
+  std::vector<uint64_t> keys_;
+  std::vector<T> values_;
+  size_t size_;
+
+  // Keep the load factor below 0.7 so linear probe chains stay short
+  static size_t capacityFor(size_t n)
+  {
+    size_t cap = 16;
+    while (cap*7 < n*10)
+      cap <<= 1;
+    return cap;
+  }
+
+  void allocate(size_t cap)
+  {
+    keys_.assign(cap, voxel_hash::EMPTY_KEY);
+    values_.assign(cap, T());
+    size_ = 0;
+  }
+
+  size_t findSlot(uint64_t packed) const
+  {
+    size_t mask = keys_.size()-1;
+    size_t i = voxel_hash::mix(packed) & mask;
+
+    while (true)
+    {
+      if (keys_[i] == packed)
+        return i;
+      if (keys_[i] == voxel_hash::EMPTY_KEY)
+        return NOT_FOUND;
+      i = (i+1) & mask;
+    }
+  }
+
+  std::pair<T*, bool> insertPacked(uint64_t packed, const T& value)
+  {
+    if ((size_+1)*10 > keys_.size()*7)
+      rehash(keys_.size()*2);
+
+    size_t mask = keys_.size()-1;
+    size_t i = voxel_hash::mix(packed) & mask;
+
+    while (true)
+    {
+      if (keys_[i] == packed)
+        return std::make_pair(&values_[i], false);
+
+      if (keys_[i] == voxel_hash::EMPTY_KEY)
+      {
+        keys_[i]   = packed;
+        values_[i] = value;
+        size_++;
+        return std::make_pair(&values_[i], true);
+      }
+      i = (i+1) & mask;
+    }
+  }
+
+  void rehash(size_t cap)
+  {
+    std::vector<uint64_t> old_keys;
+    std::vector<T> old_values;
+    old_keys.swap(keys_);
+    old_values.swap(values_);
+
+    allocate(cap);
+
+    for (size_t i=0; i<old_keys.size(); i++)
+    {
+      if (old_keys[i] != voxel_hash::EMPTY_KEY)
+        insertPacked(old_keys[i], old_values[i]);
+    }
+  }
+};
+
+
+class VoxelHashSet
+{
+public:
+  class iterator
+  {
+  public:
+    iterator(const VoxelHashMap<unsigned char>::iterator& it): it_(it) {}
+
+    octomap::OcTreeKey operator*() const { return it_.key(); }
+    uint64_t packedKey() const           { return it_.packedKey(); }
+
+    iterator& operator++()                  { ++it_; return *this; }
+    bool operator==(const iterator& rhs) const { return it_ == rhs.it_; }
+    bool operator!=(const iterator& rhs) const { return it_ != rhs.it_; }
+
+  private:
+    VoxelHashMap<unsigned char>::iterator it_;
+  };
+
+  VoxelHashSet(size_t expected_size = 0): map_(expected_size) {}
+
+  iterator begin() { return iterator(map_.begin()); }
+  iterator end()   { return iterator(map_.end()); }
+
+  size_t size() const     { return map_.size(); }
+  bool   empty() const    { return map_.empty(); }
+  void   clear()          { map_.clear(); }
+  void   reserve(size_t n){ map_.reserve(n); }
+
+  size_t count(const octomap::OcTreeKey& key) const { return map_.count(key); }
+  bool   erase(const octomap::OcTreeKey& key)       { return map_.erase(key); }
+
+  // Returns true if the key was not already in the set
+  bool insert(const octomap::OcTreeKey& key)
+  {
+    return map_.insert(key, 1).second;
+  }
+
+private:
+  VoxelHashMap<unsigned char> map_;
+};
+
+#endif // VOXEL_HASH_H
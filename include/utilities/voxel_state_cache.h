@@ -0,0 +1,62 @@
+#ifndef VOXEL_STATE_CACHE_H
+#define VOXEL_STATE_CACHE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/voxel_hash.h"
+
+/*
+ * Lock-free cache of per voxel state shared by concurrently evaluated views
+ *
+ * Candidate views of one evaluation round overlap heavily, so the same voxels
+ * are classified over and over. Entries are filled lazily by whichever thread
+ * first needs a voxel, and later readers (from any thread) reuse them.
+ *
+ * The table has a fixed capacity and never rehashes: a key claims its slot
+ * with a CAS and publishes the state through a release store of the ready
+ * flag. Readers that find a slot claimed but not yet ready treat it as a miss
+ * and compute the state themselves. When the probe limit is reached the state
+ * is simply not cached. clear() must not run concurrently with find/insert.
+ */
+class VoxelStateCache
+{
+public:
+  struct VoxelState{
+    double occupancy;  // Probability, 0.5 if unknown
+    double entropy;
+    int    density;    // Point density of occupied voxels, -1 otherwise
+    bool   known;      // Voxel exists in the tree
+  };
+
+  VoxelStateCache(size_t capacity = 1024);
+
+  void reset(size_t capacity);
+  void clear();
+
+  bool find(const octomap::OcTreeKey& key, VoxelState& state) const;
+  void insert(const octomap::OcTreeKey& key, const VoxelState& state);
+
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Slot{
+    std::atomic<uint64_t> key;
+    std::atomic<int> ready;
+    VoxelState state;
+
+    Slot() : key(voxel_hash::EMPTY_KEY), ready(0) {}
+    Slot(const Slot& other) : key(other.key.load()), ready(other.ready.load()), state(other.state) {}
+  };
+
+  static const size_t MAX_PROBES = 32;
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+};
+
+#endif // VOXEL_STATE_CACHE_H
@@ -0,0 +1,170 @@
+/*
+ * Sphere collision queries against the occupied voxels of a map: a linear scan
+ * over all boxes (as ViewGeneratorBase::isCollidingWithOctree() used to do
+ * with fcl::collide()) against CollisionIndex
+ *
+ * The map is the shell of a box shaped building sampled at the voxel size,
+ * queried at random poses around it with the UAV collision radius. The roof
+ * is then erased from the index voxel by voxel, as an integration that frees
+ * it would, and the queries are checked again.
+ *
+ * Usage: rosrun nbv_exploration test_collision_index [building_size] [queries]
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <octomap/octomap.h>
+
+#include "utilities/collision_index.h"
+#include "utilities/time_profiler.h"
+
+TimeProfiler timer;
+
+const double resolution = 0.1;
+const double radius     = 1.0;
+
+struct Box{
+  octomap::OcTreeKey key;
+  octomap::point3d center;
+  double size;
+  bool is_roof;
+};
+
+bool isSphereCollidingLinear(const std::vector<Box>& boxes, const octomap::point3d& p, double r)
+{
+  for (size_t i=0; i<boxes.size(); i++)
+  {
+    double d_sq = 0;
+    for (int k=0; k<3; k++)
+    {
+      double lo = boxes[i].center(k) - boxes[i].size/2;
+      double hi = boxes[i].center(k) + boxes[i].size/2;
+
+      if (p(k) < lo)
+        d_sq += (lo-p(k))*(lo-p(k));
+      else if (p(k) > hi)
+        d_sq += (p(k)-hi)*(p(k)-hi);
+    }
+
+    if (d_sq <= r*r)
+      return true;
+  }
+
+  return false;
+}
+
+double randomIn(double lo, double hi)
+{
+  return lo + (hi-lo)*rand()/RAND_MAX;
+}
+
+int main(int argc, char** argv)
+{
+  double building_size = 10;
+  int query_count = 2000;
+  if (argc > 1)
+    building_size = atof(argv[1]);
+  if (argc > 2)
+    query_count = atoi(argv[2]);
+
+  // ==========
+  // Walls and roof of the building, one voxel thick
+  // ==========
+  std::vector<Box> boxes;
+  double half = building_size/2;
+  double height = building_size/2;
+
+  for (double x=-half; x<half; x+=resolution)
+  {
+    for (double y=-half; y<half; y+=resolution)
+    {
+      for (double z=0; z<height; z+=resolution)
+      {
+        bool is_wall = (x < -half+resolution || x >= half-resolution ||
+                        y < -half+resolution || y >= half-resolution ||
+                        z >= height-resolution);
+        if (!is_wall)
+          continue;
+
+        Box b;
+        b.center = octomap::point3d(x + resolution/2, y + resolution/2, z + resolution/2);
+        b.size = resolution;
+        b.is_roof = (z >= height-resolution);
+        voxel_hash::coordToKey(b.center.x(), b.center.y(), b.center.z(), resolution, b.key);
+        boxes.push_back(b);
+      }
+    }
+  }
+
+  timer.start("[CollisionIndex]build");
+  CollisionIndex index;
+  index.setResolution(resolution);
+  index.setCellSize(radius);
+  for (size_t i=0; i<boxes.size(); i++)
+    index.insert(boxes[i].key);
+  timer.stop("[CollisionIndex]build");
+
+  // ==========
+  // Poses around the building, some of them too close to it
+  // ==========
+  srand(0);
+  std::vector<octomap::point3d> queries;
+  for (int i=0; i<query_count; i++)
+    queries.push_back(octomap::point3d(randomIn(-half-3, half+3), randomIn(-half-3, half+3), randomIn(1, height+3)));
+
+  std::cout << "Boxes: " << boxes.size() << ", queries: " << queries.size() << "\n";
+
+  // ==========
+  // Benchmark, before and after erasing the roof
+  // ==========
+  int mismatches = 0;
+  for (int pass=0; pass<2; pass++)
+  {
+    if (pass == 1)
+    {
+      std::vector<Box> walls;
+      timer.start("[CollisionIndex]erase");
+      for (size_t i=0; i<boxes.size(); i++)
+      {
+        if (boxes[i].is_roof)
+          index.erase(boxes[i].key);
+        else
+          walls.push_back(boxes[i]);
+      }
+      timer.stop("[CollisionIndex]erase");
+      boxes.swap(walls);
+
+      std::cout << "Erased the roof, boxes: " << boxes.size() << ", indexed: " << index.size() << "\n";
+    }
+
+    std::vector<bool> result_linear(queries.size()), result_index(queries.size());
+
+    timer.start("[CollisionIndex]linear");
+    for (size_t i=0; i<queries.size(); i++)
+      result_linear[i] = isSphereCollidingLinear(boxes, queries[i], radius);
+    timer.stop("[CollisionIndex]linear");
+
+    timer.start("[CollisionIndex]index");
+    for (size_t i=0; i<queries.size(); i++)
+      result_index[i] = index.isSphereColliding(queries[i], radius);
+    timer.stop("[CollisionIndex]index");
+
+    int collisions = 0;
+    for (size_t i=0; i<queries.size(); i++)
+    {
+      if (result_linear[i] != result_index[i])
+        mismatches++;
+      if (result_linear[i])
+        collisions++;
+    }
+
+    std::cout << "Colliding: " << collisions << ", mismatches: " << mismatches << "\n";
+  }
+
+  std::cout << "\n";
+  timer.dump();
+
+  return (mismatches == 0 && index.size() == boxes.size()) ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/*
+ * Microbenchmark of depth frame conversion: the PCL path formerly used by
+ * MappingModule::processDepth (fromROSMsg, NaN correction, two
+ * transformPointCloud calls) against DepthKernel on a 640x480 frame
+ *
+ * Usage: rosrun nbv_exploration test_depth_kernel [iterations]
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <octomap/Pointcloud.h>
+#include <pcl/common/transforms.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include "utilities/depth_kernel.h"
+#include "utilities/time_profiler.h"
+
+TimeProfiler timer;
+
+typedef pcl::PointCloud<pcl::PointXYZ> PointCloudXYZ;
+
+const int   width     = 640;
+const int   height    = 480;
+const float max_depth = 5.0;
+
+void convertPCL(const sensor_msgs::PointCloud2& msg, const std::vector<pcl::PointXYZ>& max_range, const Eigen::Matrix4d& tf,
+                PointCloudXYZ::Ptr& cloud_raw, PointCloudXYZ::Ptr& cloud_near)
+{
+  PointCloudXYZ cloud;
+  pcl::fromROSMsg (msg, cloud);
+  cloud_raw = cloud.makeShared();
+
+  for (int i=0; i<cloud_raw->points.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud_raw->points[i];
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+      cloud_raw->points[i] = max_range[i];
+  }
+
+  cloud_near.reset(new PointCloudXYZ);
+  for (int i=0; i<cloud_raw->points.size(); i++)
+  {
+    if (cloud_raw->points[i].z <= max_depth)
+      cloud_near->push_back(cloud_raw->points[i]);
+  }
+
+  pcl::transformPointCloud(*cloud_raw, *cloud_raw, tf);
+  pcl::transformPointCloud(*cloud_near, *cloud_near, tf);
+}
+
+void convertKernel(DepthKernel& kernel, const sensor_msgs::PointCloud2& msg, const Eigen::Matrix4d& tf,
+                   octomap::Pointcloud& scan, PointCloudXYZ& cloud_near)
+{
+  kernel.load(&msg.data[0], msg.width, msg.height, msg.point_step, msg.row_step, 0, 4, 8);
+  kernel.run(tf, max_depth);
+
+  const float* x = kernel.getX();
+  const float* y = kernel.getY();
+  const float* z = kernel.getZ();
+  const uint8_t* is_near = kernel.getNearMask();
+
+  scan.clear();
+  scan.reserve(kernel.size());
+  cloud_near.points.clear();
+  cloud_near.points.reserve(kernel.size());
+
+  for (int i=0; i<kernel.size(); i++)
+  {
+    scan.push_back(x[i], y[i], z[i]);
+    if (is_near[i])
+      cloud_near.points.push_back( pcl::PointXYZ(x[i], y[i], z[i]) );
+  }
+}
+
+int main(int argc, char** argv)
+{
+  int iterations = 100;
+  if (argc > 1)
+    iterations = atoi(argv[1]);
+
+  // ==========
+  // Synthetic frame: a tilted wall with 10% invalid pixels
+  // ==========
+  PointCloudXYZ cloud;
+  std::vector<pcl::PointXYZ> max_range(width*height);
+  srand(0);
+
+  for (int j=0; j<height; j++)
+  {
+    for (int i=0; i<width; i++)
+    {
+      float u = (i - width/2 + 0.5)/(width/2)*0.58;
+      float v = (j - height/2 + 0.5)/(height/2)*0.41;
+      float d = 2 + 6.0*i/width;
+
+      pcl::PointXYZ p(u*d, v*d, d);
+      if (rand()%10 == 0)
+        p.x = p.y = p.z = NAN;
+
+      cloud.points.push_back(p);
+      max_range[j*width + i] = pcl::PointXYZ(u*8.1, v*8.1, 8.1);
+    }
+  }
+  cloud.width  = width;
+  cloud.height = height;
+
+  sensor_msgs::PointCloud2 msg;
+  pcl::toROSMsg(cloud, msg);
+
+  Eigen::Affine3d pose = Eigen::Translation3d(1.0, -2.0, 1.5) * Eigen::AngleAxisd(0.7, Eigen::Vector3d::UnitZ());
+  Eigen::Matrix4d tf = pose.matrix();
+
+  // ==========
+  // Benchmark
+  // ==========
+  PointCloudXYZ::Ptr pcl_raw, pcl_near;
+  for (int it=0; it<iterations; it++)
+  {
+    timer.start("[DepthKernel]pcl");
+    convertPCL(msg, max_range, tf, pcl_raw, pcl_near);
+    timer.stop("[DepthKernel]pcl");
+  }
+
+  const char* names[3] = {"[DepthKernel]scalar", "[DepthKernel]sse2", "[DepthKernel]avx2"};
+  DepthKernel::Backend backends[3] = {DepthKernel::SCALAR, DepthKernel::SSE2, DepthKernel::AVX2};
+
+  for (int b=0; b<3; b++)
+  {
+    DepthKernel kernel;
+    kernel.setBackend(backends[b]);
+    kernel.setMaxRangeTable(&max_range[0], max_range.size());
+
+    if (kernel.getBackend() != backends[b])
+    {
+      std::cout << names[b] << " not supported on this CPU, skipping\n";
+      continue;
+    }
+
+    octomap::Pointcloud scan;
+    PointCloudXYZ near;
+    for (int it=0; it<iterations; it++)
+    {
+      timer.start(names[b]);
+      convertKernel(kernel, msg, tf, scan, near);
+      timer.stop(names[b]);
+    }
+
+    // == Compare with the PCL path
+    double max_error = 0;
+    for (int i=0; i<scan.size(); i++)
+    {
+      max_error = std::max<double>(max_error, fabs(scan[i].x() - pcl_raw->points[i].x));
+      max_error = std::max<double>(max_error, fabs(scan[i].y() - pcl_raw->points[i].y));
+      max_error = std::max<double>(max_error, fabs(scan[i].z() - pcl_raw->points[i].z));
+    }
+
+    std::cout << names[b] << " near points: " << near.points.size() << " (pcl " << pcl_near->points.size() << "), max error: " << max_error << " m\n";
+  }
+  std::cout << "\n";
+
+  timer.dump();
+
+  return 0;
+}
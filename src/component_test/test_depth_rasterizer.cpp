@@ -0,0 +1,338 @@
+/*
+ * Agreement and speed of the two visibility backends of ViewSelecterBase:
+ * ray casting each far plane ray (RayMarcher) against a z-buffer of the
+ * occupied voxels (DepthRasterizer), on a synthetic map seen from a ring of views
+ *
+ * The proposed view selecters also cast every ray through a predicted map.
+ * Its first hits from octomap's castRay() are compared against a second
+ * z-buffer of the predicted occupied voxels, as castRayPredicted() reads them.
+ *
+ * Usage: rosrun nbv_exploration test_depth_rasterizer [iterations]
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+#include "utilities/dense_voxel_grid.h"
+#include "utilities/depth_rasterizer.h"
+#include "utilities/ray_marcher.h"
+#include "utilities/time_profiler.h"
+
+TimeProfiler timer;
+
+const double resolution = 0.1;
+const double fov_h      = 60;
+const double fov_v      = 45;
+const double range_max  = 5.0;
+const double bound      = 2.5;
+const int    view_count = 24;
+
+struct Stats{
+  long rays;
+  long hits;
+  long voxels;
+  double entropy;
+};
+
+// Voxels recorded for a ray that lie in the snapshot, and their entropy
+void addRay(const RayMarcher& marcher, const RayMarcher::Ray& ray, const DenseVoxelGrid& grid, Stats& stats)
+{
+  for (int k=ray.first; k<ray.first+ray.count; k++)
+  {
+    const octomap::OcTreeKey& key = marcher.getKeys()[k];
+    if (!grid.contains(key))
+      continue;
+
+    stats.voxels++;
+    stats.entropy += grid.getEntropy(grid.getCode(key), true);
+  }
+
+  stats.rays++;
+  if (ray.found_endpoint)
+    stats.hits++;
+}
+
+int main(int argc, char** argv)
+{
+  int iterations = 10;
+  if (argc > 1)
+    iterations = atoi(argv[1]);
+
+  // ==========
+  // Synthetic map: a sphere shell on a floor, free space above the floor, unknown below
+  // ==========
+  octomap::OcTree tree(resolution);
+
+  for (double x=-bound; x<bound; x+=resolution)
+  {
+    for (double y=-bound; y<bound; y+=resolution)
+    {
+      for (double z=-bound; z<bound; z+=resolution)
+      {
+        octomap::point3d p(x + resolution/2, y + resolution/2, z + resolution/2);
+        octomap::OcTreeKey key = tree.coordToKey(p);
+        double r = p.norm();
+
+        if ((r > 1.4 && r < 1.6) || p.z() < -1.5)
+          tree.updateNode(key, 3.5f);
+        else if (r > 1.8 && p.z() > 0)
+          tree.updateNode(key, -2.0f);
+        else if (r > 1.6 && rand()%4 == 0)
+          tree.updateNode(key, 0.4f);
+      }
+    }
+  }
+  tree.updateInnerOccupancy();
+
+  // Predicted map: the same shell shifted sideways, only occupied voxels as a prediction holds
+  octomap::OcTree tree_predicted(resolution);
+
+  for (double x=-bound; x<bound; x+=resolution)
+  {
+    for (double y=-bound; y<bound; y+=resolution)
+    {
+      for (double z=-bound; z<bound; z+=resolution)
+      {
+        octomap::point3d p(x + resolution/2, y + resolution/2, z + resolution/2);
+        double r = (p - octomap::point3d(0.4, 0, 0)).norm();
+
+        if (r > 1.3 && r < 1.5)
+          tree_predicted.updateNode(tree_predicted.coordToKey(p), 3.5f);
+      }
+    }
+  }
+  tree_predicted.updateInnerOccupancy();
+
+  octomap::point3d bounds_min(-bound, -bound, -bound);
+  octomap::point3d bounds_max( bound,  bound,  bound);
+
+  DenseVoxelGrid grid;
+  grid.build(&tree, bounds_min, bounds_max);
+
+  std::vector<octomap::OcTreeKey> occupied_keys;
+  grid.getKeysAbove(tree.getOccupancyThresLog(), occupied_keys);
+
+  std::vector<float> occupied_x, occupied_y, occupied_z;
+  for (int i=0; i<occupied_keys.size(); i++)
+  {
+    octomap::point3d p = tree.keyToCoord(occupied_keys[i]);
+    occupied_x.push_back(p.x());
+    occupied_y.push_back(p.y());
+    occupied_z.push_back(p.z());
+  }
+
+  DenseVoxelGrid grid_predicted;
+  grid_predicted.build(&tree_predicted, bounds_min, bounds_max);
+
+  std::vector<octomap::OcTreeKey> predicted_keys;
+  grid_predicted.getKeysAbove(tree_predicted.getOccupancyThresLog(), predicted_keys);
+
+  std::vector<float> predicted_x, predicted_y, predicted_z;
+  for (int i=0; i<predicted_keys.size(); i++)
+  {
+    octomap::point3d p = tree_predicted.keyToCoord(predicted_keys[i]);
+    predicted_x.push_back(p.x());
+    predicted_y.push_back(p.y());
+    predicted_z.push_back(p.z());
+  }
+
+  // ==========
+  // Far plane rays, laid out as in ViewSelecterBase::computeRelativeRays()
+  // ==========
+  double deg2rad = M_PI/180;
+  double min_x = -range_max * tan(fov_h/2 * deg2rad);
+  double min_y = -range_max * tan(fov_v/2 * deg2rad);
+
+  std::vector<Eigen::Vector3d> rays_far_plane;
+  int h_count = 0;
+  for (double x = min_x; x <= -min_x; x += resolution, h_count++)
+    for (double y = min_y; y <= -min_y; y += resolution)
+      rays_far_plane.push_back(Eigen::Vector3d(range_max, x, y));
+  int v_count = rays_far_plane.size()/h_count;
+
+  std::cout << "Occupied voxels: " << occupied_keys.size() << ", predicted: " << predicted_keys.size() << ", rays per view: " << rays_far_plane.size() << "\n";
+
+  // ==========
+  // Views on a ring around the object, looking at its center
+  // ==========
+  std::vector<Eigen::Matrix3d> rotations;
+  std::vector<Eigen::Vector3d> positions;
+  for (int v=0; v<view_count; v++)
+  {
+    double yaw = 2*M_PI*v/view_count;
+    Eigen::Vector3d position (4.5*cos(yaw), 4.5*sin(yaw), 0.5 + 0.1*v/view_count);
+
+    Eigen::Vector3d forward = -position.normalized();
+    Eigen::Vector3d left    = Eigen::Vector3d::UnitZ().cross(forward).normalized();
+    Eigen::Matrix3d rotation;
+    rotation.col(0) = forward;
+    rotation.col(1) = left;
+    rotation.col(2) = forward.cross(left);
+
+    rotations.push_back(rotation);
+    positions.push_back(position);
+  }
+
+  // ==========
+  // Benchmark
+  // ==========
+  RayMarcher marcher_raycast, marcher_zbuffer;
+  DepthRasterizer rasterizer, rasterizer_predicted;
+  rasterizer.setCamera(h_count, v_count, min_x/range_max, min_y/range_max, resolution/range_max);
+  rasterizer_predicted.setCamera(h_count, v_count, min_x/range_max, min_y/range_max, resolution/range_max);
+
+  marcher_raycast.setTree(&tree, &grid);
+  marcher_zbuffer.setTree(&tree, &grid);
+
+  long rays_same = 0, rays_near = 0, rays_total = 0;
+  long predicted_same = 0, predicted_near = 0, predicted_hits_raycast = 0, predicted_hits_zbuffer = 0;
+  std::vector<octomap::point3d> predicted_ends;
+  std::vector<char> predicted_found;
+  Stats stats_raycast = {0, 0, 0, 0};
+  Stats stats_zbuffer = {0, 0, 0, 0};
+
+  for (int it=0; it<iterations; it++)
+  {
+    for (int v=0; v<view_count; v++)
+    {
+      octomap::point3d origin (positions[v][0], positions[v][1], positions[v][2]);
+
+      std::vector<octomap::point3d> rays;
+      for (int r=0; r<rays_far_plane.size(); r++)
+      {
+        Eigen::Vector3d p = rotations[v]*rays_far_plane[r];
+        rays.push_back(octomap::point3d(p[0], p[1], p[2]));
+      }
+
+      // == Ray casting
+      timer.start("[DepthRasterizer]raycast");
+      marcher_raycast.castRays(origin, rays);
+      timer.stop("[DepthRasterizer]raycast");
+
+      // == Z-buffer, as in ViewSelecterBase::castRaysZBuffer()
+      timer.start("[DepthRasterizer]zbuffer");
+      marcher_zbuffer.clear();
+
+      timer.start("[DepthRasterizer]zbuffer-render");
+      rasterizer.render(rotations[v], positions[v],
+                        occupied_x.data(), occupied_y.data(), occupied_z.data(), occupied_x.size(),
+                        resolution/2, range_max);
+      timer.stop("[DepthRasterizer]zbuffer-render");
+
+      for (int r=0; r<rays.size(); r++)
+      {
+        double range = rays[r].norm();
+        int voxel = rasterizer.getVoxel(r);
+
+        double length = range;
+        if (voxel >= 0)
+          length = rasterizer.getDepth(r) - 1e-3*resolution;
+
+        RayMarcher::Ray& marched = marcher_zbuffer.walkRay(origin, rays[r], length);
+        if (voxel >= 0)
+        {
+          marched.endpoint = tree.keyToCoord(occupied_keys[voxel]);
+          marched.end_key = occupied_keys[voxel];
+          marched.has_end_key = true;
+          marched.found_endpoint = true;
+        }
+      }
+      timer.stop("[DepthRasterizer]zbuffer");
+
+      // == Predicted map, cast ray by ray as the proposed selecters did, then drawn once
+      predicted_ends.resize(rays.size());
+      predicted_found.resize(rays.size());
+
+      timer.start("[DepthRasterizer]predicted-raycast");
+      for (int r=0; r<rays.size(); r++)
+        predicted_found[r] = tree_predicted.castRay(origin, rays[r], predicted_ends[r], true, rays[r].norm());
+      timer.stop("[DepthRasterizer]predicted-raycast");
+
+      timer.start("[DepthRasterizer]predicted-zbuffer");
+      rasterizer_predicted.render(rotations[v], positions[v],
+                                  predicted_x.data(), predicted_y.data(), predicted_z.data(), predicted_x.size(),
+                                  resolution/2, range_max);
+      timer.stop("[DepthRasterizer]predicted-zbuffer");
+
+      if (it > 0)
+        continue;
+
+      // == Compare first hits in the predicted map
+      for (int r=0; r<rays.size(); r++)
+      {
+        int voxel = rasterizer_predicted.getVoxel(r);
+        bool hit_a = predicted_found[r];
+        bool hit_b = voxel >= 0;
+
+        predicted_hits_raycast += hit_a;
+        predicted_hits_zbuffer += hit_b;
+
+        if (!hit_a && !hit_b)
+        {
+          predicted_same++;
+          predicted_near++;
+        }
+        else if (hit_a && hit_b)
+        {
+          octomap::OcTreeKey key_a = tree_predicted.coordToKey(predicted_ends[r]);
+          int dist = 0;
+          for (int i=0; i<3; i++)
+            dist = std::max(dist, abs((int)key_a[i] - (int)predicted_keys[voxel][i]));
+
+          if (dist == 0)
+            predicted_same++;
+          if (dist <= 1)
+            predicted_near++;
+        }
+      }
+
+      // == Compare first hits within the snapshot, and the voxels in front of them
+      for (int r=0; r<rays.size(); r++)
+      {
+        const RayMarcher::Ray& a = marcher_raycast.getRays()[r];
+        const RayMarcher::Ray& b = marcher_zbuffer.getRays()[r];
+
+        bool hit_a = a.found_endpoint && grid.contains(a.end_key);
+        bool hit_b = b.found_endpoint;
+
+        rays_total++;
+        if (!hit_a && !hit_b)
+        {
+          rays_same++;
+          rays_near++;
+        }
+        else if (hit_a && hit_b)
+        {
+          int dist = 0;
+          for (int i=0; i<3; i++)
+            dist = std::max(dist, abs((int)a.end_key[i] - (int)b.end_key[i]));
+
+          if (dist == 0)
+            rays_same++;
+          if (dist <= 1)
+            rays_near++;
+        }
+
+        addRay(marcher_raycast, a, grid, stats_raycast);
+        addRay(marcher_zbuffer, b, grid, stats_zbuffer);
+      }
+    }
+  }
+
+  std::cout << "Same first hit: " << 100.0*rays_same/rays_total << "%, within one voxel: " << 100.0*rays_near/rays_total << "%\n";
+  std::cout << "Hits:      raycast " << stats_raycast.hits << ", zbuffer " << stats_zbuffer.hits << "\n";
+  std::cout << "Voxels:    raycast " << stats_raycast.voxels << ", zbuffer " << stats_zbuffer.voxels << "\n";
+  std::cout << "Entropy:   raycast " << stats_raycast.entropy << ", zbuffer " << stats_zbuffer.entropy << "\n";
+  std::cout << "Predicted: same first hit " << 100.0*predicted_same/rays_total << "%, within one voxel: " << 100.0*predicted_near/rays_total << "%, "
+            << "hits raycast " << predicted_hits_raycast << ", zbuffer " << predicted_hits_zbuffer << "\n\n";
+
+  timer.dump();
+
+  return 0;
+}
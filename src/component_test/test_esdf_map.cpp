@@ -0,0 +1,196 @@
+/*
+ * Incremental distance field: EsdfMap::update() against the distance to the
+ * nearest occupied voxel found by brute force
+ *
+ * Obstacles are inserted at random in the box for a number of rounds, as the
+ * changes of an integration would report them, then removed at random for
+ * the remaining rounds. After each round the field is queried at random
+ * points and at the voxels that just changed. The field must never be below
+ * the true distance (collision checks rely on it) and only exceed it by the
+ * propagation error, less than a voxel diagonal.
+ *
+ * The gradient must be a unit vector pointing away from an occupied voxel at
+ * the returned distance, and zero where no obstacle is in range.
+ *
+ * Usage: rosrun nbv_exploration test_esdf_map [changes_per_round] [queries]
+ */
+
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <octomap/octomap.h>
+
+#include "utilities/esdf_map.h"
+#include "utilities/time_profiler.h"
+#include "utilities/voxel_hash.h"
+
+TimeProfiler timer;
+
+const double resolution   = 0.2;
+const double max_distance = 2.0;
+const int    insert_rounds = 20;
+const int    remove_rounds = 20;
+
+const octomap::point3d box_min(-5, -5, 0);
+const octomap::point3d box_max( 5,  5, 4);
+
+double randomIn(double lo, double hi)
+{
+  return lo + (hi-lo)*rand()/RAND_MAX;
+}
+
+octomap::point3d randomPoint()
+{
+  return octomap::point3d(
+        randomIn(box_min.x(), box_max.x()),
+        randomIn(box_min.y(), box_max.y()),
+        randomIn(box_min.z(), box_max.z()));
+}
+
+// Distance from the voxel of the key to the nearest occupied voxel center, capped at max_distance
+double getDistanceBruteForce(const std::vector<octomap::OcTreeKey>& occupied, const octomap::OcTreeKey& key)
+{
+  double best_sq = max_distance*max_distance;
+  for (size_t i=0; i<occupied.size(); i++)
+  {
+    double d_sq = 0;
+    for (int k=0; k<3; k++)
+    {
+      double d = ((int)occupied[i][k] - (int)key[k])*resolution;
+      d_sq += d*d;
+    }
+
+    if (d_sq < best_sq)
+      best_sq = d_sq;
+  }
+
+  return sqrt(best_sq);
+}
+
+int main(int argc, char** argv)
+{
+  int changes_per_round = 300;
+  int queries = 2000;
+  if (argc > 1)
+    changes_per_round = atoi(argv[1]);
+  if (argc > 2)
+    queries = atoi(argv[2]);
+
+  srand(0);
+  octomap::OcTree tree(resolution);
+
+  EsdfMap esdf;
+  esdf.reset(box_min, box_max, resolution, max_distance);
+
+  VoxelHashSet occupied_set;
+  std::vector<octomap::OcTreeKey> occupied;
+
+  double max_under = 0, max_over = 0;
+  long checked = 0;
+  long bad_gradients = 0;
+
+  for (int r=0; r<insert_rounds+remove_rounds; r++)
+  {
+    bool is_inserting = r < insert_rounds;
+
+    // ==========
+    // Changes of one integration
+    // ==========
+    std::vector<VoxelChange> changes;
+    for (int i=0; i<changes_per_round; i++)
+    {
+      VoxelChange c;
+      c.log_odds_old = std::numeric_limits<float>::quiet_NaN();
+
+      if (is_inserting)
+      {
+        c.key = tree.coordToKey(randomPoint());
+        if (!occupied_set.insert(c.key))
+          continue;
+
+        occupied.push_back(c.key);
+        c.log_odds_new = tree.getClampingThresMaxLog();
+      }
+      else
+      {
+        if (occupied.empty())
+          break;
+
+        int idx = rand()%occupied.size();
+        c.key = occupied[idx];
+        occupied_set.erase(c.key);
+        occupied[idx] = occupied.back();
+        occupied.pop_back();
+
+        c.log_odds_old = tree.getClampingThresMaxLog();
+        c.log_odds_new = tree.getClampingThresMinLog();
+      }
+
+      changes.push_back(c);
+    }
+
+    timer.start("[EsdfMap]update");
+    esdf.update(changes, tree.getOccupancyThresLog());
+    timer.stop("[EsdfMap]update");
+
+    // ==========
+    // Compare at random points and where the map changed
+    // ==========
+    for (int q=0; q<queries + (int)changes.size(); q++)
+    {
+      octomap::OcTreeKey key;
+      if (q < queries)
+        key = tree.coordToKey(randomPoint());
+      else
+        key = changes[q-queries].key;
+
+      double expected = getDistanceBruteForce(occupied, key);
+      double d = esdf.getDistance(tree.keyToCoord(key));
+
+      max_under = std::max(max_under, expected - d);
+      max_over  = std::max(max_over, d - expected);
+      checked++;
+
+      // Stepping back along the gradient by the distance must land on an obstacle
+      double d_grad;
+      Eigen::Vector3d gradient;
+      octomap::point3d center = tree.keyToCoord(key);
+      esdf.getDistanceAndGradient(center, d_grad, gradient);
+
+      if (d_grad <= 0 || d_grad >= max_distance)
+      {
+        if (gradient.norm() != 0)
+          bad_gradients++;
+        continue;
+      }
+
+      octomap::point3d obstacle = center - octomap::point3d(gradient[0], gradient[1], gradient[2])*d_grad;
+      if (fabs(gradient.norm() - 1) > 1e-6 || !occupied_set.count(tree.coordToKey(obstacle)))
+        bad_gradients++;
+    }
+  }
+
+  std::cout << "Queries: " << checked << ", occupied left: " << occupied.size() << "\n";
+  std::cout << "Largest underestimate: " << max_under << "\n";
+  std::cout << "Largest overestimate:  " << max_over << " (voxel diagonal " << resolution*sqrt(3) << ")\n";
+  std::cout << "Gradients not pointing away from an obstacle: " << bad_gradients << "\n\n";
+  timer.dump();
+
+  if (max_under > 1e-4 || max_over >= resolution*sqrt(3))
+  {
+    std::cout << "FAILED: distances differ from brute force\n";
+    return 1;
+  }
+
+  if (bad_gradients > 0)
+  {
+    std::cout << "FAILED: gradients do not point away from the nearest obstacle\n";
+    return 1;
+  }
+
+  std::cout << "PASSED: distances match brute force, gradients point away from obstacles\n";
+  return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * Heap allocations made while evaluating candidate views in steady state
+ *
+ * Replays the per candidate path of ViewSelecterBase (cached ray bundle, ray
+ * marching, voxel states, unique key sets and the z-buffer) with buffers kept
+ * in one context per candidate, as ViewContext does. After a warm up round,
+ * evaluating the same candidates again must not allocate.
+ *
+ * Usage: rosrun nbv_exploration test_evaluation_allocations [rounds]
+ */
+
+#include <iostream>
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+#include "utilities/dense_voxel_grid.h"
+#include "utilities/depth_rasterizer.h"
+#include "utilities/ray_marcher.h"
+#include "utilities/ray_sampler.h"
+#include "utilities/ray_template_cache.h"
+#include "utilities/time_profiler.h"
+#include "utilities/voxel_hash.h"
+#include "utilities/voxel_state_cache.h"
+
+TimeProfiler timer;
+
+// ==========
+// Allocation counter
+// ==========
+namespace
+{
+long allocations = 0;
+}
+
+void* operator new(size_t size)
+{
+  allocations++;
+  void* p = malloc(size > 0 ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  free(p);
+}
+
+
+const double resolution = 0.1;
+const double fov_h      = 60;
+const double fov_v      = 45;
+const double range_max  = 5.0;
+const double bound      = 2.5;
+const int    view_count = 16;
+
+// Buffers of one candidate, as in ViewSelecterBase::ViewContext
+struct Context{
+  Eigen::Matrix3d rotation;
+  Eigen::Vector3d position;
+  const RayTemplateCache::Bundle* rays;
+  RayMarcher ray_marcher;
+  DepthRasterizer rasterizer;
+  VoxelHashSet keys;
+  VoxelHashMap<octomap::OcTreeNode*> key_nodes;
+  double utility;
+};
+
+// Entropy of the unique voxels crossed, as ViewSelecterProposed collects them
+double evaluate(Context& ctx, octomap::OcTree& tree, const DenseVoxelGrid& grid, VoxelStateCache& cache,
+                const std::vector<float>& occupied_x, const std::vector<float>& occupied_y, const std::vector<float>& occupied_z)
+{
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
+  octomap::point3d origin (ctx.position[0], ctx.position[1], ctx.position[2]);
+
+  ctx.ray_marcher.setTree(&tree, &grid);
+  ctx.ray_marcher.castRays(origin, rays.dir_x.data(), rays.dir_y.data(), rays.dir_z.data(), rays.length.data(), rays.size(),
+                           rays.start.data(), rays.parent.data());
+
+  // Only drawn for the allocations, the grid layout does not match banded rays
+  ctx.rasterizer.render(ctx.rotation, ctx.position, occupied_x.data(), occupied_y.data(), occupied_z.data(), occupied_x.size(),
+                        resolution/2, range_max);
+
+  ctx.keys.clear();
+  ctx.key_nodes.clear();
+
+  const RayMarcher& marcher = ctx.ray_marcher;
+  for (int i=0; i<rays.size(); i++)
+  {
+    const RayMarcher::Ray& marched = marcher.getRays()[i];
+    for (int k=marched.first; k<marched.first+marched.count; k++)
+      ctx.key_nodes.insert(marcher.getKeys()[k], marcher.getNodes()[k]);
+
+    if (marched.found_endpoint && marched.has_end_key)
+      ctx.keys.insert(marched.end_key);
+  }
+
+  double entropy = 0;
+  for (VoxelHashMap<octomap::OcTreeNode*>::iterator it = ctx.key_nodes.begin(); it != ctx.key_nodes.end(); ++it)
+  {
+    VoxelStateCache::VoxelState state;
+    if (!cache.find(it.key(), state))
+    {
+      double p = it.value() ? it.value()->getOccupancy() : 0.5;
+      state.occupancy = p;
+      state.entropy = (p > 0 && p < 1) ? -p*log(p) - (1-p)*log(1-p) : 0;
+      state.density = -1;
+      state.known = (it.value() != NULL);
+      cache.insert(it.key(), state);
+    }
+    entropy += state.entropy;
+  }
+
+  return entropy * ctx.keys.size();
+}
+
+int main(int argc, char** argv)
+{
+  int rounds = 5;
+  if (argc > 1)
+    rounds = atoi(argv[1]);
+
+  // ==========
+  // Synthetic map: a sphere shell on a floor, free space above the floor
+  // ==========
+  octomap::OcTree tree(resolution);
+
+  for (double x=-bound; x<bound; x+=resolution)
+  {
+    for (double y=-bound; y<bound; y+=resolution)
+    {
+      for (double z=-bound; z<bound; z+=resolution)
+      {
+        octomap::point3d p(x + resolution/2, y + resolution/2, z + resolution/2);
+        octomap::OcTreeKey key = tree.coordToKey(p);
+        double r = p.norm();
+
+        if ((r > 1.4 && r < 1.6) || p.z() < -1.5)
+          tree.updateNode(key, 3.5f);
+        else if (r > 1.8 && p.z() > 0)
+          tree.updateNode(key, -2.0f);
+      }
+    }
+  }
+  tree.updateInnerOccupancy();
+
+  DenseVoxelGrid grid;
+  grid.build(&tree, octomap::point3d(-bound, -bound, -bound), octomap::point3d(bound, bound, bound));
+
+  std::vector<octomap::OcTreeKey> occupied_keys;
+  grid.getKeysAbove(tree.getOccupancyThresLog(), occupied_keys);
+
+  std::vector<float> occupied_x, occupied_y, occupied_z;
+  for (int i=0; i<occupied_keys.size(); i++)
+  {
+    octomap::point3d p = tree.keyToCoord(occupied_keys[i]);
+    occupied_x.push_back(p.x());
+    occupied_y.push_back(p.y());
+    occupied_z.push_back(p.z());
+  }
+
+  // ==========
+  // Rays, one camera looking forward
+  // ==========
+  std::vector<RaySampler::Ray> sampled;
+  RaySampler sampler;
+  sampler.setCamera(fov_h, fov_v, range_max);
+  sampler.sample(resolution, 0, RaySampler::JITTER_NONE, sampled);
+
+  std::vector<Eigen::Vector3d> rays_far_plane;
+  std::vector<float> rays_start;
+  std::vector<float> rays_range;
+  std::vector<int> rays_parent;
+  for (int i=0; i<sampled.size(); i++)
+  {
+    rays_far_plane.push_back(sampled[i].far);
+    rays_start.push_back(sampled[i].start);
+    rays_range.push_back(sampled[i].range);
+    rays_parent.push_back(sampled[i].parent);
+  }
+
+  RayTemplateCache ray_cache;
+  ray_cache.setRays(rays_far_plane, rays_start, rays_range, rays_parent, std::vector<Eigen::Matrix3d>(1, Eigen::Matrix3d::Identity()));
+
+  // ==========
+  // Candidates on a ring around the object, looking at its center
+  // ==========
+  std::vector<Context> contexts(view_count);
+  for (int v=0; v<view_count; v++)
+  {
+    double yaw = 2*M_PI*v/view_count;
+    Eigen::Vector3d position (4.5*cos(yaw), 4.5*sin(yaw), 0.5);
+
+    Eigen::Vector3d forward = -position.normalized();
+    Eigen::Vector3d left    = Eigen::Vector3d::UnitZ().cross(forward).normalized();
+    Eigen::Matrix3d rotation;
+    rotation.col(0) = forward;
+    rotation.col(1) = left;
+    rotation.col(2) = forward.cross(left);
+
+    contexts[v].rotation = rotation;
+    contexts[v].position = position;
+    contexts[v].rasterizer.setCamera(2*ceil(tan(fov_h/2*M_PI/180)*range_max/resolution),
+                                     2*ceil(tan(fov_v/2*M_PI/180)*range_max/resolution),
+                                     -tan(fov_h/2*M_PI/180), -tan(fov_v/2*M_PI/180), resolution/range_max);
+  }
+
+  VoxelStateCache cache(1<<20);
+
+  // ==========
+  // Rounds of evaluation, the first one sizes all buffers
+  // ==========
+  long steady_allocations = 0;
+  for (int r=0; r<rounds; r++)
+  {
+    // Bundles are looked up before evaluation, as in ViewSelecterBase::evaluate()
+    for (int v=0; v<view_count; v++)
+      contexts[v].rays = &ray_cache.get(contexts[v].rotation);
+
+    cache.clear();
+
+    // The profiler allocates its entries, keep it outside of the count
+    timer.start("[EvaluationAllocations]evaluate");
+    long before = allocations;
+
+    for (int v=0; v<view_count; v++)
+      contexts[v].utility = evaluate(contexts[v], tree, grid, cache, occupied_x, occupied_y, occupied_z);
+
+    long made = allocations - before;
+    timer.stop("[EvaluationAllocations]evaluate");
+
+    std::cout << "Round " << r << ": " << made << " allocations\n";
+
+    if (r > 0)
+      steady_allocations += made;
+  }
+
+  std::cout << "\nRays per view: " << rays_far_plane.size() << ", utility of view 0: " << contexts[0].utility << "\n";
+  timer.dump();
+
+  if (steady_allocations > 0)
+  {
+    std::cout << "FAILED: " << steady_allocations << " allocations after the first round\n";
+    return 1;
+  }
+
+  std::cout << "PASSED: no allocations after the first round\n";
+  return 0;
+}
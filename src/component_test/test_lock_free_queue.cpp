@@ -0,0 +1,113 @@
+/*
+ * Depth pipeline hand-offs: workers polling their queue with a short sleep
+ * (as the MappingModule depth workers used to) against blocking on it with
+ * LockFreeQueue::pop()
+ *
+ * Frames go through three stages, each on its own thread and doing a fixed
+ * amount of work, like conversion, integration and density in the mapping
+ * module. A frame is requested, pushed, and waited for at the end of the
+ * last stage, as commandGetCameraData() waits for the done flags. The time
+ * from the request to the done flag is what the wait costs on top of the
+ * work itself.
+ *
+ * Usage: rosrun nbv_exploration test_lock_free_queue [frames] [stage_work_us]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "utilities/lock_free_queue.h"
+#include "utilities/time_profiler.h"
+
+TimeProfiler timer;
+
+const int stage_count = 3;
+
+void work(int us)
+{
+  // Busy, like a stage crunching a frame
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+  while (std::chrono::steady_clock::now() < end);
+}
+
+void runPipeline(bool is_blocking, int frames, int stage_work_us, const std::string& name)
+{
+  std::vector<LockFreeQueue<int>*> queues;
+  for (int s=0; s<stage_count; s++)
+    queues.push_back(new LockFreeQueue<int>(4));
+
+  std::atomic<int> done(-1);
+  std::atomic<bool> is_running(true);
+
+  std::vector<std::thread> workers;
+  for (int s=0; s<stage_count; s++)
+  {
+    workers.push_back(std::thread([&, s]()
+    {
+      int frame;
+      while (true)
+      {
+        if (is_blocking)
+        {
+          if (!queues[s]->pop(frame))
+            return;
+        }
+        else if (!queues[s]->tryPop(frame))
+        {
+          if (!is_running)
+            return;
+
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+          continue;
+        }
+
+        work(stage_work_us);
+
+        if (s+1 < stage_count)
+          queues[s+1]->push(frame);
+        else
+          done = frame;
+      }
+    }));
+  }
+
+  for (int f=0; f<frames; f++)
+  {
+    timer.start(name);
+    queues[0]->push(f);
+    while (done != f)
+      std::this_thread::yield();
+    timer.stop(name);
+  }
+
+  is_running = false;
+  for (int s=0; s<stage_count; s++)
+    queues[s]->close();
+  for (int s=0; s<stage_count; s++)
+    workers[s].join();
+  for (int s=0; s<stage_count; s++)
+    delete queues[s];
+}
+
+int main(int argc, char** argv)
+{
+  int frames = 500;
+  int stage_work_us = 2000;
+  if (argc > 1)
+    frames = atoi(argv[1]);
+  if (argc > 2)
+    stage_work_us = atoi(argv[2]);
+
+  std::cout << "Frames: " << frames << ", work per stage: " << stage_work_us << " us, "
+            << "work per frame: " << stage_count*stage_work_us/1000.0 << " ms\n\n";
+
+  runPipeline(false, frames, stage_work_us, "[DepthPipeline]polling");
+  runPipeline(true,  frames, stage_work_us, "[DepthPipeline]blocking");
+
+  timer.dump();
+  return 0;
+}
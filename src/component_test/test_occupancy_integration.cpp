@@ -0,0 +1,200 @@
+/*
+ * Benchmark of a camera frame integration: the KeySet merge used previously by
+ * MappingModule::computeTreeUpdatePlanar against OccupancyKeyBatch
+ *
+ * Clouds are recorded point clouds in the world frame, all taken from the same
+ * sensor origin. Each cloud is integrated into both trees as one frame, and the
+ * resulting trees are compared voxel by voxel.
+ *
+ * Usage: rosrun nbv_exploration test_occupancy_integration <resolution> <origin_x> <origin_y> <origin_z> <cloud.pcd> [cloud.pcd ...]
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+
+#include "utilities/occupancy_key_batch.h"
+#include "utilities/time_profiler.h"
+
+TimeProfiler timer;
+
+int getNumThreads()
+{
+  #ifdef _OPENMP
+  return omp_get_max_threads();
+  #else
+  return 1;
+  #endif
+}
+
+int getThreadIdx()
+{
+  #ifdef _OPENMP
+  return omp_get_thread_num();
+  #else
+  return 0;
+  #endif
+}
+
+void integrateLegacy(octomap::OcTree& tree, const octomap::Pointcloud& scan, const octomap::point3d& origin)
+{
+  int num_threads = getNumThreads();
+  std::vector<octomap::KeyRay> keyrays(num_threads);
+  std::vector<octomap::KeySet> free_cells_threaded(num_threads);
+  std::vector<octomap::KeySet> occupied_cells_threaded(num_threads);
+  octomap::KeySet free_cells, occupied_cells;
+
+  timer.start("[OccupancyIntegration]legacy-computeUpdate");
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(guided)
+  #endif
+  for (int i = 0; i < (int)scan.size(); ++i)
+  {
+    int t = getThreadIdx();
+    if (tree.computeRayKeys(origin, scan[i], keyrays[t]))
+      free_cells_threaded[t].insert(keyrays[t].begin(), keyrays[t].end());
+
+    octomap::OcTreeKey key;
+    if (tree.coordToKeyChecked(scan[i], key))
+      occupied_cells_threaded[t].insert(key);
+  }
+
+  for (int i=0; i<num_threads; i++)
+  {
+    free_cells.insert(free_cells_threaded[i].begin(), free_cells_threaded[i].end());
+    occupied_cells.insert(occupied_cells_threaded[i].begin(), occupied_cells_threaded[i].end());
+  }
+
+  for(octomap::KeySet::iterator it = free_cells.begin(), end=free_cells.end(); it!= end; )
+  {
+    if (occupied_cells.find(*it) != occupied_cells.end())
+      it = free_cells.erase(it);
+    else
+      ++it;
+  }
+  timer.stop("[OccupancyIntegration]legacy-computeUpdate");
+
+  timer.start("[OccupancyIntegration]legacy-updateTree");
+  for (octomap::KeySet::iterator it = free_cells.begin(); it != free_cells.end(); ++it)
+    tree.updateNode(*it, false);
+
+  for (octomap::KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+    tree.updateNode(*it, true);
+  timer.stop("[OccupancyIntegration]legacy-updateTree");
+}
+
+void integrateBatched(octomap::OcTree& tree, const octomap::Pointcloud& scan, const octomap::point3d& origin, OccupancyKeyBatch& key_batch)
+{
+  int num_threads = getNumThreads();
+  std::vector<octomap::KeyRay> keyrays(num_threads);
+
+  timer.start("[OccupancyIntegration]batched-computeUpdate");
+  key_batch.reset(num_threads);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(guided)
+  #endif
+  for (int i = 0; i < (int)scan.size(); ++i)
+  {
+    int t = getThreadIdx();
+    if (tree.computeRayKeys(origin, scan[i], keyrays[t]))
+      key_batch.addFree(t, keyrays[t]);
+
+    octomap::OcTreeKey key;
+    if (tree.coordToKeyChecked(scan[i], key))
+      key_batch.addOccupied(t, key);
+  }
+
+  key_batch.finalize();
+  timer.stop("[OccupancyIntegration]batched-computeUpdate");
+
+  timer.start("[OccupancyIntegration]batched-updateTree");
+  key_batch.updateTree(&tree, tree.getProbMissLog(), tree.getProbHitLog());
+  timer.stop("[OccupancyIntegration]batched-updateTree");
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 6)
+  {
+    std::cout << "Usage: " << argv[0] << " <resolution> <origin_x> <origin_y> <origin_z> <cloud.pcd> [cloud.pcd ...]\n";
+    return 1;
+  }
+
+  double resolution = atof(argv[1]);
+  octomap::point3d origin(atof(argv[2]), atof(argv[3]), atof(argv[4]));
+
+  octomap::OcTree tree_legacy(resolution);
+  octomap::OcTree tree_batched(resolution);
+  OccupancyKeyBatch key_batch;
+
+  int frames = 0;
+  long total_points = 0;
+  long mismatches = 0;
+  long compared = 0;
+
+  for (int i=5; i<argc; i++)
+  {
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    if (pcl::io::loadPCDFile<pcl::PointXYZ>(argv[i], cloud) == -1)
+    {
+      std::cout << "Could not read " << argv[i] << ", skipping\n";
+      continue;
+    }
+
+    octomap::Pointcloud scan;
+    for (size_t j=0; j<cloud.points.size(); j++)
+    {
+      const pcl::PointXYZ& p = cloud.points[j];
+      if (isfinite(p.x) && isfinite(p.y) && isfinite(p.z))
+        scan.push_back(p.x, p.y, p.z);
+    }
+
+    timer.start("[OccupancyIntegration]legacy-frame");
+    integrateLegacy(tree_legacy, scan, origin);
+    timer.stop("[OccupancyIntegration]legacy-frame");
+
+    timer.start("[OccupancyIntegration]batched-frame");
+    integrateBatched(tree_batched, scan, origin, key_batch);
+    timer.stop("[OccupancyIntegration]batched-frame");
+
+    frames++;
+    total_points += scan.size();
+
+    // == Every voxel touched in this frame must agree between both trees
+    const std::vector<uint64_t>* code_lists[2] = {&key_batch.getFreeCodes(), &key_batch.getOccupiedCodes()};
+    for (int l=0; l<2; l++)
+    {
+      for (size_t j=0; j<code_lists[l]->size(); j++)
+      {
+        octomap::OcTreeKey key = OccupancyKeyBatch::mortonToKey((*code_lists[l])[j]);
+        octomap::OcTreeNode* n1 = tree_legacy.search(key);
+        octomap::OcTreeNode* n2 = tree_batched.search(key);
+
+        compared++;
+        if (!n1 || !n2 || fabs(n1->getLogOdds() - n2->getLogOdds()) > 1e-4)
+          mismatches++;
+      }
+    }
+  }
+
+  std::cout << "Frames:            " << frames << "\n";
+  std::cout << "Points:            " << total_points << "\n";
+  std::cout << "Threads:           " << getNumThreads() << "\n";
+  std::cout << "Voxels compared:   " << compared << "\n";
+  std::cout << "Voxel mismatches:  " << mismatches << "\n\n";
+
+  timer.dump();
+
+  return mismatches == 0 ? 0 : 1;
+}
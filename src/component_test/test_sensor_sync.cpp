@@ -207,6 +207,9 @@ int main(int argc, char **argv)
     yaw += yaw_inc;
   }
 
+  // [MappingModule]commandGetCameraData-waiting is the time each request waited for its frame
+  timer.dump();
+
   ros::spin();
   return 0;
 }
@@ -0,0 +1,204 @@
+/*
+ * Frontier clustering: the breadth first search that scans every cell for
+ * neighbors (as ViewGeneratorFrontier::findFrontierAdjacencies() used to do)
+ * against VoxelClusterer
+ *
+ * Cells are a few random walks through the voxels around the center of the
+ * tree, like the low density patches left on a partially scanned surface.
+ * Both methods must find the same clusters.
+ *
+ * The cells then change a little at a time, as after each scan: some cells
+ * leave and a new walk is added. VoxelClusterer::update() must match
+ * clustering the cells from scratch.
+ *
+ * Usage: rosrun nbv_exploration test_voxel_clusterer [cell_count]
+ */
+
+#include <iostream>
+#include <queue>
+#include <stdlib.h>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/time_profiler.h"
+#include "utilities/voxel_clusterer.h"
+#include "utilities/voxel_hash.h"
+
+TimeProfiler timer;
+
+const int radius   = 2;
+const int min_size = 10;
+
+bool isNear(const octomap::OcTreeKey& k1, const octomap::OcTreeKey& k2)
+{
+  return abs(k1[0]-k2[0]) <= radius &&
+         abs(k1[1]-k2[1]) <= radius &&
+         abs(k1[2]-k2[2]) <= radius;
+}
+
+void clusterQuadratic(const std::vector<octomap::OcTreeKey>& cells, std::vector<std::vector<octomap::OcTreeKey> >& list)
+{
+  int cell_count = cells.size();
+  std::vector<bool> was_cell_checked(cell_count, false);
+
+  for (int i_cell=0; i_cell<cell_count; i_cell++)
+  {
+    if (was_cell_checked[i_cell])
+      continue;
+
+    std::vector<octomap::OcTreeKey> key_list;
+    std::queue<int> queue;
+    queue.push(i_cell);
+
+    while (!queue.empty())
+    {
+      int i = queue.front();
+      queue.pop();
+
+      if (was_cell_checked[i])
+        continue;
+      was_cell_checked[i] = true;
+      key_list.push_back(cells[i]);
+
+      for (int i_check=0; i_check<cell_count; i_check++)
+      {
+        if (!was_cell_checked[i_check] && isNear(cells[i], cells[i_check]))
+          queue.push(i_check);
+      }
+    }
+
+    if (key_list.size() >= min_size)
+      list.push_back(key_list);
+  }
+}
+
+// Clusters match if they hold the same keys, clusters and keys in any order
+bool isSameClustering(const std::vector<std::vector<octomap::OcTreeKey> >& a, const std::vector<std::vector<octomap::OcTreeKey> >& b)
+{
+  if (a.size() != b.size())
+    return false;
+
+  VoxelHashMap<int> cluster_of;
+  for (size_t c=0; c<a.size(); c++)
+  {
+    for (size_t i=0; i<a[c].size(); i++)
+      cluster_of.insert(a[c][i], c);
+  }
+
+  std::vector<bool> is_matched(a.size(), false);
+  for (size_t c=0; c<b.size(); c++)
+  {
+    const int* match = cluster_of.find(b[c][0]);
+    if (!match || is_matched[*match] || a[*match].size() != b[c].size())
+      return false;
+    is_matched[*match] = true;
+
+    for (size_t i=0; i<b[c].size(); i++)
+    {
+      const int* other = cluster_of.find(b[c][i]);
+      if (!other || *other != *match)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void addWalk(std::vector<octomap::OcTreeKey>& cells, VoxelHashSet& unique, int length, int max_count)
+{
+  int p[3] = {32768 + rand()%400 - 200, 32768 + rand()%400 - 200, 32768 + rand()%50};
+  for (int s=0; s<length && cells.size() < max_count; s++)
+  {
+    for (int k=0; k<3; k++)
+      p[k] += rand()%5 - 2;
+
+    octomap::OcTreeKey key(p[0], p[1], p[2]);
+    if (unique.insert(key))
+      cells.push_back(key);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  int cell_count = 20000;
+  if (argc > 1)
+    cell_count = atoi(argv[1]);
+
+  // ==========
+  // Random walks, each step moving up to 2 voxels along each axis
+  // ==========
+  srand(0);
+  VoxelHashSet unique;
+  std::vector<octomap::OcTreeKey> cells;
+  int walk_length = 500;
+
+  while (cells.size() < cell_count)
+    addWalk(cells, unique, walk_length, cell_count);
+
+  std::cout << "Cells: " << cells.size() << "\n";
+
+  // ==========
+  // Benchmark
+  // ==========
+  std::vector<std::vector<octomap::OcTreeKey> > clusters_quadratic, clusters;
+
+  timer.start("[VoxelClusterer]quadratic");
+  clusterQuadratic(cells, clusters_quadratic);
+  timer.stop("[VoxelClusterer]quadratic");
+
+  VoxelClusterer clusterer;
+  clusterer.setRadius(radius);
+
+  for (int r=0; r<5; r++)
+  {
+    timer.start("[VoxelClusterer]cluster");
+    clusterer.cluster(cells, clusters, min_size);
+    timer.stop("[VoxelClusterer]cluster");
+  }
+
+  bool is_same = isSameClustering(clusters_quadratic, clusters);
+  std::cout << "Clusters: " << clusters.size() << " (quadratic: " << clusters_quadratic.size() << ")\n";
+
+  // ==========
+  // Incremental updates, around one place at a time as a scan would:
+  //  the cells in a box leave, a new walk comes in
+  // ==========
+  std::vector<std::vector<octomap::OcTreeKey> > clusters_updated;
+  clusterer.update(cells, clusters_updated, min_size);
+  is_same &= isSameClustering(clusters, clusters_updated);
+
+  for (int r=0; r<20; r++)
+  {
+    octomap::OcTreeKey center = cells[rand()%cells.size()];
+    for (int i=cells.size()-1; i>=0; i--)
+    {
+      if (abs(cells[i][0]-center[0]) > 10 || abs(cells[i][1]-center[1]) > 10 || abs(cells[i][2]-center[2]) > 10)
+        continue;
+
+      unique.erase(cells[i]);
+      cells[i] = cells.back();
+      cells.pop_back();
+    }
+    addWalk(cells, unique, walk_length, cells.size() + walk_length);
+
+    timer.start("[VoxelClusterer]update");
+    clusterer.update(cells, clusters_updated, min_size);
+    timer.stop("[VoxelClusterer]update");
+
+    clusterer.cluster(cells, clusters, min_size);
+    is_same &= isSameClustering(clusters, clusters_updated);
+  }
+
+  std::cout << "Clusters after updates: " << clusters_updated.size() << "\n\n";
+  timer.dump();
+
+  if (!is_same)
+  {
+    std::cout << "FAILED: clusters differ\n";
+    return 1;
+  }
+
+  std::cout << "PASSED: same clusters\n";
+  return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Microbenchmark comparing VoxelHashMap against the std::map + linear hash
+ * comparator that used to back MappingModule::voxel_densities_
+ *
+ * VoxelHashMap must also match a std::map through random inserts, erases and
+ * lookups on a small key range, so that erase() shifts long probe chains
+ * back (CollisionIndex and the frontier sets rely on it).
+ *
+ * Usage: rosrun nbv_exploration test_voxel_hash [voxel_count]
+ */
+
+#include <iostream>
+#include <map>
+#include <stdlib.h>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+
+#include "utilities/time_profiler.h"
+#include "utilities/voxel_hash.h"
+
+TimeProfiler timer;
+
+// Comparator formerly used by MappingModule. Keys whose hashes collide are merged.
+struct LegacyKeyCompare {
+  bool operator() (const octomap::OcTreeKey& lhs, const octomap::OcTreeKey& rhs) const
+  {
+    size_t h1 = size_t(lhs.k[0]) + 1447*size_t(lhs.k[1]) + 345637*size_t(lhs.k[2]);
+    size_t h2 = size_t(rhs.k[0]) + 1447*size_t(rhs.k[1]) + 345637*size_t(rhs.k[2]);
+    return h1< h2;
+  }
+};
+
+struct VoxelDensity{
+  int count;
+  double total;
+  double density;
+};
+
+// Random inserts and erases against std::map, returns the number of mismatches
+long checkInsertErase(int operations)
+{
+  VoxelHashMap<int> map_hash;
+  VoxelHashSet set_hash;
+  std::map<uint64_t, int> map_ref;
+  long bad = 0;
+
+  srand(1);
+  for (int op=0; op<operations; op++)
+  {
+    // A few thousand keys, so slots are reused and probe chains grow and shrink
+    octomap::OcTreeKey key(32768 + rand()%16, 32768 + rand()%16, 32768 + rand()%16);
+    uint64_t packed = voxel_hash::packKey(key);
+    int value = rand();
+
+    switch (rand()%3)
+    {
+    case 0:
+    {
+      bool is_new = map_ref.find(packed) == map_ref.end();
+      std::pair<int*, bool> result = map_hash.insert(key, value);
+      if (result.second != is_new || set_hash.insert(key) != is_new)
+        bad++;
+      if (is_new)
+        map_ref[packed] = value;
+      else if (*result.first != map_ref[packed])
+        bad++;
+      break;
+    }
+    case 1:
+    {
+      bool is_present = map_ref.erase(packed) > 0;
+      if (map_hash.erase(key) != is_present || set_hash.erase(key) != is_present)
+        bad++;
+      break;
+    }
+    default:
+    {
+      std::map<uint64_t, int>::iterator it = map_ref.find(packed);
+      const int* v = map_hash.find(key);
+      if ((it == map_ref.end()) != (v == NULL) || (v && *v != it->second) ||
+          set_hash.count(key) != (it != map_ref.end() ? 1 : 0))
+        bad++;
+    }
+    }
+
+    // Full comparison now and then, every remaining key must still be reachable
+    if (op % 10000 == 0 || op == operations-1)
+    {
+      if (map_hash.size() != map_ref.size() || set_hash.size() != map_ref.size())
+        bad++;
+
+      for (std::map<uint64_t, int>::iterator it = map_ref.begin(); it != map_ref.end(); ++it)
+      {
+        const int* v = map_hash.find(voxel_hash::unpackKey(it->first));
+        if (!v || *v != it->second || !set_hash.count(voxel_hash::unpackKey(it->first)))
+          bad++;
+      }
+
+      size_t iterated = 0;
+      for (VoxelHashMap<int>::iterator it = map_hash.begin(); it != map_hash.end(); ++it, iterated++)
+      {
+        if (map_ref.find(it.packedKey()) == map_ref.end())
+          bad++;
+      }
+      if (iterated != map_ref.size())
+        bad++;
+    }
+  }
+
+  return bad;
+}
+
+int main(int argc, char** argv)
+{
+  int voxel_count = 1000000;
+  if (argc > 1)
+    voxel_count = atoi(argv[1]);
+
+  // ==========
+  // Generate unique keys around the center of the tree, as a 0.2m octree would
+  //  see them for a 40x40m footprint, inserted in random order
+  // ==========
+  std::vector<octomap::OcTreeKey> keys;
+  keys.reserve(voxel_count);
+  for (int i=0; i<voxel_count; i++)
+  {
+    octomap::OcTreeKey k(
+          32768 - 100 + i%200,
+          32768 - 100 + (i/200)%200,
+          32768 + i/40000);
+    keys.push_back(k);
+  }
+
+  srand(0);
+  for (size_t i=keys.size()-1; i>0; i--)
+    std::swap(keys[i], keys[rand()%(i+1)]);
+
+  std::vector<octomap::OcTreeKey> queries(keys);
+  for (size_t i=queries.size()-1; i>0; i--)
+    std::swap(queries[i], queries[rand()%(i+1)]);
+
+  // ==========
+  // std::map
+  // ==========
+  std::map<octomap::OcTreeKey, VoxelDensity, LegacyKeyCompare> map_legacy;
+  long found_legacy = 0;
+
+  timer.start("[VoxelHash]std::map-insert");
+  for (size_t i=0; i<keys.size(); i++)
+  {
+    VoxelDensity& v = map_legacy[keys[i]];
+    v.count++;
+  }
+  timer.stop("[VoxelHash]std::map-insert");
+
+  timer.start("[VoxelHash]std::map-find");
+  for (size_t i=0; i<queries.size(); i++)
+  {
+    std::map<octomap::OcTreeKey, VoxelDensity, LegacyKeyCompare>::iterator it = map_legacy.find(queries[i]);
+    if (it != map_legacy.end())
+      found_legacy += it->second.count;
+  }
+  timer.stop("[VoxelHash]std::map-find");
+
+  // ==========
+  // VoxelHashMap
+  // ==========
+  VoxelHashMap<VoxelDensity> map_hash;
+  long found_hash = 0;
+
+  timer.start("[VoxelHash]VoxelHashMap-insert");
+  for (size_t i=0; i<keys.size(); i++)
+  {
+    VoxelDensity& v = map_hash[keys[i]];
+    v.count++;
+  }
+  timer.stop("[VoxelHash]VoxelHashMap-insert");
+
+  timer.start("[VoxelHash]VoxelHashMap-find");
+  for (size_t i=0; i<queries.size(); i++)
+  {
+    VoxelDensity* v = map_hash.find(queries[i]);
+    if (v)
+      found_hash += v->count;
+  }
+  timer.stop("[VoxelHash]VoxelHashMap-find");
+
+  timer.start("[VoxelHash]VoxelHashMap-iterate");
+  long iterated = 0;
+  for (VoxelHashMap<VoxelDensity>::iterator it = map_hash.begin(); it != map_hash.end(); ++it)
+    iterated += it.value().count;
+  timer.stop("[VoxelHash]VoxelHashMap-iterate");
+
+  // ==========
+  // Report
+  // ==========
+  std::cout << "Unique keys inserted:        " << keys.size() << "\n";
+  std::cout << "Unique voxels (std::map):    " << map_legacy.size() << " (hash collisions merged)\n";
+  std::cout << "Unique voxels (VoxelHashMap):" << map_hash.size() << "\n";
+  std::cout << "Lookup checksum std::map:    " << found_legacy << "\n";
+  std::cout << "Lookup checksum VoxelHashMap:" << found_hash << " (iterated " << iterated << ")\n\n";
+
+  timer.dump();
+
+  // ==========
+  // Inserts and erases against std::map
+  // ==========
+  long bad = checkInsertErase(1000000);
+
+  bool is_lookup_same = (found_hash == keys.size() && iterated == keys.size() && map_hash.size() == keys.size());
+
+  if (bad > 0 || !is_lookup_same)
+  {
+    std::cout << "\nFAILED: " << bad << " mismatches against std::map after inserts and erases"
+              << (is_lookup_same ? "" : ", lookups of the unique keys differ") << "\n";
+    return 1;
+  }
+
+  std::cout << "\nPASSED: VoxelHashMap and VoxelHashSet match std::map\n";
+  return 0;
+}
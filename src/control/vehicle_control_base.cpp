@@ -1,10 +1,12 @@
 #include <ros/ros.h>
+#include <limits>
 
 #include "control/vehicle_control_base.h"
 #include "nbv_exploration/common.h"
 
 VehicleControlBase::VehicleControlBase():
-  is_ready_(false)
+  is_ready_(false),
+  esdf_(NULL)
 {
   ros::param::param("~distance_threshold", distance_threshold_, 0.4);
   ros::param::param("~angular_threshold", angular_threshold_, DEG2RAD(10.0));
@@ -39,6 +41,34 @@ double VehicleControlBase::getYaw()
   return pose_conversion::getYawFromQuaternion( getOrientation() );
 }
 
+double VehicleControlBase::getObstacleDistance()
+{
+  // Distance from the current position to the nearest occupied voxel, capped by the field
+  if (!esdf_)
+    return std::numeric_limits<double>::infinity();
+
+  geometry_msgs::Point p = getPosition();
+  return esdf_->getDistance(octomap::point3d(p.x, p.y, p.z));
+}
+
+double VehicleControlBase::getObstacleDistance(Eigen::Vector3d& gradient)
+{
+  // Same, with the direction away from that voxel, zero when unknown
+  gradient.setZero();
+  if (!esdf_)
+    return std::numeric_limits<double>::infinity();
+
+  double distance;
+  geometry_msgs::Point p = getPosition();
+  esdf_->getDistanceAndGradient(octomap::point3d(p.x, p.y, p.z), distance, gradient);
+  return distance;
+}
+
+void VehicleControlBase::setDistanceField(const EsdfMap* esdf)
+{
+  esdf_ = esdf;
+}
+
 
 double VehicleControlBase::getDistance(geometry_msgs::Pose p1, geometry_msgs::Pose p2)
 {
@@ -5,10 +5,16 @@
 // catkin_make -DCATKIN_WHITELIST_PACKAGES="aircraft_inspection" && rosrun aircraft_inspection wall_follower
 
 #include "nbv_exploration/mapping_module.h"
+#include <algorithm>
 #include <mutex>
 
+#include <boost/make_shared.hpp>
+
 std::mutex mutex_profile;
+std::mutex mutex_rgbd;
 std::mutex mutex_octo;
+std::mutex mutex_changes;
+std::mutex mutex_frontiers;
 std::mutex mutex_depth_callback;
 
 MappingModule::MappingModule(const ros::NodeHandle& nh_, const ros::NodeHandle& nh_private_)
@@ -21,7 +27,13 @@ MappingModule::MappingModule(const ros::NodeHandle& nh_, const ros::NodeHandle&
     nh_private(nh_private_),
     depth1_sub(NULL),
     depth2_sub(NULL),
-    sync(NULL)
+    sync(NULL),
+    depth_frames_dropped_(0),
+    is_depth_pipeline_running_(false),
+    depth_job_queue_(NULL),
+    depth_frame_queue_(NULL),
+    density_frame_queue_(NULL),
+    depth_frame_pool_(NULL)
 {
   // >>>>>>>>>>>>>>>>>
   // Initialization
@@ -39,6 +51,15 @@ MappingModule::MappingModule(const ros::NodeHandle& nh_, const ros::NodeHandle&
 
   ros::param::param("~camera_range_upper_adjustment", camera_range_upper_adjustment, 0.1);
   createMaxRangeCloud();
+  depth_kernel_.setMaxRangeTable(cloud_max_range_, camera_width_px*camera_height_px);
+
+  camera_done_flags_   = 0;
+  camera_queued_flags_ = 0;
+  map_version_         = 0;
+  map_changes_count_   = 0;
+  map_changes_start_   = 0;
+  if (is_depth_pipeline_enabled_)
+    startDepthPipeline();
 
   // >>>>>>>>>>>>>>>>>
   // Main function
@@ -53,6 +74,8 @@ MappingModule::MappingModule(const ros::NodeHandle& nh_, const ros::NodeHandle&
 
 MappingModule::~MappingModule()
 {
+  stopDepthPipeline();
+
   if(depth1_sub)
     delete depth1_sub;
   if(depth2_sub)
@@ -88,12 +111,10 @@ void MappingModule::run()
       }
 
       // Publish RGB-D Cloud
-      if (cloud_ptr_rgbd_ && pub_rgbd_cloud_.getNumSubscribers() > 0)
+      if (pub_rgbd_cloud_.getNumSubscribers() > 0)
       {
         sensor_msgs::PointCloud2 cloud_msg;
-        mutex_profile.lock();
-        pcl::toROSMsg(*cloud_ptr_rgbd_, cloud_msg);
-        mutex_profile.unlock();
+        pcl::toROSMsg(*getPointCloud(), cloud_msg);
         cloud_msg.header.frame_id = "world";
         cloud_msg.header.stamp = ros::Time::now();
         pub_rgbd_cloud_.publish(cloud_msg);
@@ -172,14 +193,10 @@ void MappingModule::addPredictedPointCloudToTree(octomap::OcTree* octree_in, Poi
   }
 }
 
-void MappingModule::addPointCloudToTree(octomap::OcTree* octree_in, PointCloudXYZ cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
+void MappingModule::addPointCloudToTree(octomap::OcTree* octree_in, const PointCloudXYZ& cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
 {
-  // Lock the octree
-  mutex_octo.lock();
-
-  // Note that "range" is the perpendicular distance to the end of the camera plane
-
   octomap::Pointcloud ocCloud;
+  ocCloud.reserve(cloud_in.points.size());
   for (int j=0; j<cloud_in.points.size(); j++)
   {
     ocCloud.push_back(cloud_in.points[j].x,
@@ -187,36 +204,131 @@ void MappingModule::addPointCloudToTree(octomap::OcTree* octree_in, PointCloudXY
                       cloud_in.points[j].z);
   }
 
-  // == Insert point cloud based on planar (camera) or spherical (laser) scan data
-  octomap::KeySet free_cells, occupied_cells;
+  addPointCloudToTree(octree_in, ocCloud, sensor_origin, sensor_dir, range, isPlanar);
+}
 
-  if (isPlanar)
-    computeTreeUpdatePlanar(octree_in, ocCloud, sensor_origin, sensor_dir, free_cells, occupied_cells, range);
-  else
-    octree_in->computeUpdate(ocCloud, sensor_origin, free_cells, occupied_cells, range);
+void MappingModule::addPointCloudToTree(octomap::OcTree* octree_in, const octomap::Pointcloud& ocCloud, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
+{
+  // Lock the octree
+  mutex_octo.lock();
+  std::vector<VoxelChange>* changes = getChangeBuffer(octree_in);
 
-  // insert data into tree using continuous probabilities -----------------------
-  for (octomap::KeySet::iterator it = free_cells.begin(); it != free_cells.end(); ++it)
+  // Note that "range" is the perpendicular distance to the end of the camera plane
+
+  // == Insert point cloud based on planar (camera) or spherical (laser) scan data
+  if (isPlanar)
   {
-    octree_in->updateNode(*it, false);
+    timer.start("[MappingModule]addPointCloudToTree-computeUpdate");
+    key_batch_.reset(omp_get_max_threads());
+    computeTreeUpdatePlanar(octree_in, ocCloud, sensor_origin, sensor_dir, key_batch_, range);
+    key_batch_.finalize();
+    timer.stop("[MappingModule]addPointCloudToTree-computeUpdate");
+
+    // insert data into tree using continuous probabilities, in octree order
+    timer.start("[MappingModule]addPointCloudToTree-updateTree");
+    key_batch_.updateTree(octree_in, octree_in->getProbMissLog(), octree_in->getProbHitLog(), sensor_data_min_height_, changes);
+    timer.stop("[MappingModule]addPointCloudToTree-updateTree");
   }
-
-  for (octomap::KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+  else
   {
-    octomap::point3d p = octree_->keyToCoord(*it);
-    if (p.z() <= sensor_data_min_height_)
+    octomap::KeySet free_cells, occupied_cells;
+    octree_in->computeUpdate(ocCloud, sensor_origin, free_cells, occupied_cells, range);
+
+    // insert data into tree using continuous probabilities -----------------------
+    for (octomap::KeySet::iterator it = free_cells.begin(); it != free_cells.end(); ++it)
     {
-      continue;
+      OccupancyKeyBatch::updateNode(octree_in, *it, octree_in->getProbMissLog(), changes);
     }
-    else
+
+    for (octomap::KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
     {
-      octree_in->updateNode(*it, true);
+      octomap::point3d p = octree_->keyToCoord(*it);
+      if (p.z() <= sensor_data_min_height_)
+      {
+        continue;
+      }
+      else
+      {
+        OccupancyKeyBatch::updateNode(octree_in, *it, octree_in->getProbHitLog(), changes);
+      }
     }
   }
 
+  commitMapChanges(changes);
+  mutex_octo.unlock();
+}
+
+void MappingModule::addPointCloudsToTree(octomap::OcTree* octree_in, const std::vector<DepthView>& views, double range)
+{
+  // Lock the octree
+  mutex_octo.lock();
+  std::vector<VoxelChange>* changes = getChangeBuffer(octree_in);
+
+  // == Collect the keys of all cameras, then merge them once
+  // Occupied cells seen by any camera are preferred over cells another camera sees as free
+  timer.start("[MappingModule]addPointCloudToTree-computeUpdate");
+  // The rays of all views are cast in one parallel loop into per-thread buffers
+  std::vector<PlanarScan> scans(views.size());
+  for (int i=0; i<views.size(); i++)
+  {
+    scans[i].scan = views[i].scan.get();
+    scans[i].origin = views[i].origin;
+    scans[i].sensor_dir = views[i].sensor_dir;
+  }
+
+  key_batch_.reset(omp_get_max_threads());
+  computeTreeUpdatePlanar(octree_in, scans, key_batch_, range);
+  key_batch_.finalize();
+  timer.stop("[MappingModule]addPointCloudToTree-computeUpdate");
+
+  if (is_debugging_)
+    std::cout << "[Mapping] " << cc.blue << "Fused " << views.size() << " views: " << key_batch_.getFreeCodes().size() << " free cells, " << key_batch_.getOccupiedCodes().size() << " occupied cells\n" << cc.reset;
+
+  // == Single octree update for all cameras
+  timer.start("[MappingModule]addPointCloudToTree-updateTree");
+  key_batch_.updateTree(octree_in, octree_in->getProbMissLog(), octree_in->getProbHitLog(), sensor_data_min_height_, changes);
+  timer.stop("[MappingModule]addPointCloudToTree-updateTree");
+
+  commitMapChanges(changes);
   mutex_octo.unlock();
 }
 
+void MappingModule::commitMapChanges(std::vector<VoxelChange>* changes)
+{
+  if (changes && is_esdf_enabled_)
+  {
+    timer.start("[MappingModule]commitMapChanges-esdf");
+    esdf_.update(*changes, octree_->getOccupancyThresLog());
+    timer.stop("[MappingModule]commitMapChanges-esdf");
+  }
+
+  if (changes && is_tracking_frontiers_)
+  {
+    timer.start("[MappingModule]commitMapChanges-frontiers");
+    updateFrontierCells(*changes);
+    timer.stop("[MappingModule]commitMapChanges-frontiers");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_changes);
+  unsigned long version = ++map_version_;
+
+  if (!changes || changes->empty() || map_change_log_size_ <= 0)
+    return;
+
+  map_changes_.push_back(MapChangeBlock());
+  map_changes_.back().version = version;
+  map_changes_.back().changes.swap(*changes);
+  map_changes_count_ += map_changes_.back().changes.size();
+
+  // Drop the oldest integrations, consumers that have not seen them must start over
+  while (map_changes_count_ > map_change_log_size_ && !map_changes_.empty())
+  {
+    map_changes_start_ = map_changes_.front().version;
+    map_changes_count_ -= map_changes_.front().changes.size();
+    map_changes_.pop_front();
+  }
+}
+
 void MappingModule::addPointCloudToPointCloud(const PointCloudXYZ::Ptr& cloud_in, PointCloudXYZ::Ptr& cloud_out) {
   if (is_debugging_)
   {
@@ -262,6 +374,21 @@ void MappingModule::addPointCloudToPointCloud(const PointCloudXYZ::Ptr& cloud_in
   mutex_profile.unlock();
 }
 
+void MappingModule::addPointCloudToAccumulator(const PointCloudXYZ::Ptr& cloud_in)
+{
+  // Each point is folded into its voxel grid leaf, so only the new points are processed.
+  // The filtered cloud is exported lazily by getPointCloud()
+  mutex_rgbd.lock();
+  rgbd_accumulator_.addPointCloud(*cloud_in, sensor_data_min_height_);
+  is_rgbd_cloud_outdated_ = true;
+  mutex_rgbd.unlock();
+
+  if (is_debugging_)
+  {
+    std::cout << "[Mapping] " << cc.blue << "Number of points in filtered map: " << rgbd_accumulator_.size() << "\n" << cc.reset;
+  }
+}
+
 
 void MappingModule::callbackScan(const sensor_msgs::LaserScan& laser_msg){
   if (is_debugging_)
@@ -386,9 +513,13 @@ void MappingModule::createMaxRangeCloud()
   }
 }
 
-PointCloudXYZ::Ptr MappingModule::correctDepth(const sensor_msgs::PointCloud2& input_msg)
+bool MappingModule::ingestDepth(const sensor_msgs::PointCloud2& input_msg, const Eigen::Matrix4d& tf_eigen, DepthView& view, PointCloudXYZ& cloud_distance)
 {
   /*
+   * Points are read from the message buffer, then corrected, transformed to the
+   * world frame and range filtered by the depth kernel before being written to
+   * the view buffers. Points within range are appended to cloud_distance.
+   *
    * Points near the max and min range are pushed outside the range
    * This way, they can be ignored
    *
@@ -396,68 +527,96 @@ PointCloudXYZ::Ptr MappingModule::correctDepth(const sensor_msgs::PointCloud2& i
    * Violating this condition will result in occupied areas considered as "free"
    */
 
-  // == Convert to pcl pointcloud
-  PointCloudXYZ cloud;
-  PointCloudXYZ::Ptr cloud_ptr;
-
-  pcl::fromROSMsg (input_msg, cloud);
-  cloud_ptr = cloud.makeShared();
-
   // == Check the number of points is correct
-  if (cloud.points.size() != camera_width_px*camera_height_px)
+  int point_count = input_msg.width*input_msg.height;
+  if (point_count != camera_width_px*camera_height_px)
   {
-    ROS_ERROR("Number of points in cloud (%d) do not match supplied inputs (%dx%d px)", (int) cloud.points.size(), camera_width_px, camera_height_px);
-    return NULL;
+    ROS_ERROR("Number of points in cloud (%d) do not match supplied inputs (%dx%d px)", point_count, camera_width_px, camera_height_px);
+    return false;
   }
 
-  // == Create points slighly out of range if needed
-  for (int i=0; i<cloud_ptr->points.size(); i++)
+  // == Locate xyz fields in the message
+  int offset[3] = {-1, -1, -1};
+  bool is_float = true;
+  for (int i=0; i<input_msg.fields.size(); i++)
   {
-    if (std::isfinite(cloud_ptr->points[i].x) &&
-        std::isfinite(cloud_ptr->points[i].y) &&
-        std::isfinite(cloud_ptr->points[i].z) )
-    {
-      // Point is valid, continue
+    const sensor_msgs::PointField& f = input_msg.fields[i];
+    int axis = (f.name == "x") ? 0 : (f.name == "y") ? 1 : (f.name == "z") ? 2 : -1;
+    if (axis < 0)
       continue;
+
+    offset[axis] = f.offset;
+    is_float &= (f.datatype == sensor_msgs::PointField::FLOAT32);
+  }
+
+  // Other layouts go through PCL's conversion first, then share the same pass
+  PointCloudXYZ cloud_converted;
+  const uint8_t* data = &input_msg.data[0];
+  size_t point_step = input_msg.point_step;
+  size_t row_step   = input_msg.row_step;
+
+  if (offset[0] < 0 || offset[1] < 0 || offset[2] < 0 || !is_float || input_msg.is_bigendian)
+  {
+    pcl::fromROSMsg (input_msg, cloud_converted);
+    if (cloud_converted.points.size() != point_count)
+    {
+      ROS_ERROR("Could not read xyz fields from depth cloud");
+      return false;
     }
 
-    int x_px = i%camera_width_px;
-    int y_px = i/camera_width_px;
+    const PointXYZ& p0 = cloud_converted.points[0];
+    data       = reinterpret_cast<const uint8_t*>(&p0);
+    point_step = sizeof(PointXYZ);
+    row_step   = point_step*input_msg.width;
+    offset[0]  = reinterpret_cast<const uint8_t*>(&p0.x) - data;
+    offset[1]  = reinterpret_cast<const uint8_t*>(&p0.y) - data;
+    offset[2]  = reinterpret_cast<const uint8_t*>(&p0.z) - data;
+  }
+
+  // == Prepare view buffers, keeping their capacity from previous frames
+  if (!view.scan)
+    view.scan.reset(new octomap::Pointcloud);
+
+  octomap::Pointcloud& scan = *view.scan;
+
+  scan.clear();
+  scan.reserve(point_count);
+  cloud_distance.points.reserve(cloud_distance.points.size() + point_count);
 
-    cloud_ptr->points[i] = cloud_max_range_[y_px*camera_width_px + x_px];
+  // == Correct invalid points, transform to global frame and split by depth (vectorized)
+  depth_kernel_.load(data, input_msg.width, input_msg.height, point_step, row_step, offset[0], offset[1], offset[2]);
+  depth_kernel_.run(tf_eigen, max_rgbd_range_);
+
+  const float* x = depth_kernel_.getX();
+  const float* y = depth_kernel_.getY();
+  const float* z = depth_kernel_.getZ();
+  const uint8_t* is_near = depth_kernel_.getNearMask();
+
+  for (int i=0; i<point_count; i++)
+  {
+    scan.push_back(x[i], y[i], z[i]);
+
+    // Keep points that are not too far (depth measured in the camera frame)
+    if (is_near[i])
+      cloud_distance.points.push_back( PointXYZ(x[i], y[i], z[i]) );
   }
 
-  return cloud_ptr;
+  return true;
 }
 
 
-void MappingModule::processDepth(const sensor_msgs::PointCloud2& cloud_msg)
+bool MappingModule::convertDepth(const sensor_msgs::PointCloud2& cloud_msg, DepthView& view, PointCloudXYZ& cloud_distance)
 {
   std::cout << "[Mapping] " << cc.green << "Processing Depth\n" << cc.reset;
   timer.start("[MappingModule]callbackDepth-conversion");
   if(cloud_msg.data.size() == 0)
   {
     std::cout << "[Mapping] " << cc.red << "Cloud Empty, Skipping\n" << cc.reset;
-    return;
+    return false;
   }
   else
     std::cout << "[Mapping] " << cc.green << "Point Size:"<<cloud_msg.data.size()<<"\n" << cc.reset;
 
-  PointCloudXYZ::Ptr cloud_raw_ptr;
-  cloud_raw_ptr = correctDepth(cloud_msg);
-
-  if (cloud_raw_ptr == NULL)
-    return;
-
-  // == Create cloud without points that are too far
-  PointCloudXYZ::Ptr cloud_distance_ptr(new PointCloudXYZ);
-
-  for (int i=0; i<cloud_raw_ptr->points.size(); i++)
-  {
-    if (cloud_raw_ptr->points[i].z <= max_rgbd_range_)
-      cloud_distance_ptr->push_back(cloud_raw_ptr->points[i]);
-  }
-
   // == Transform
   tf::StampedTransform transform;
   while (true)
@@ -476,7 +635,7 @@ void MappingModule::processDepth(const sensor_msgs::PointCloud2& cloud_msg)
     catch (tf::TransformException ex){
       ROS_ERROR("%s",ex.what());
       ros::Duration(0.1).sleep();
-      return;
+      return false;
     }
   }
 
@@ -488,23 +647,52 @@ void MappingModule::processDepth(const sensor_msgs::PointCloud2& cloud_msg)
   // == Convert tf:Transform to Eigen::Matrix4d
   Eigen::Matrix4d tf_eigen = pose_conversion::convertStampedTransform2Matrix4d(transform);
 
-  // == Transform point cloud to global frame
-  pcl::transformPointCloud(*cloud_raw_ptr, *cloud_raw_ptr, tf_eigen);
-  pcl::transformPointCloud(*cloud_distance_ptr, *cloud_distance_ptr, tf_eigen);
+  // == Correct, transform and filter the cloud in a single pass
+  if (!ingestDepth(cloud_msg, tf_eigen, view, cloud_distance))
+    return false;
+
+  view.origin = octomap::point3d(transform.getOrigin().x(),
+                                 transform.getOrigin().y(),
+                                 transform.getOrigin().z());
+  view.sensor_dir = pose_conversion::getOctomapDirectionVectorFromTransform(transform);
 
   timer.stop("[MappingModule]callbackDepth-conversion");
+  return true;
+}
+
+bool MappingModule::convertDepthFrame(const std::vector<const sensor_msgs::PointCloud2*>& cloud_msgs, DepthFrame& frame)
+{
+  if (!frame.cloud_distance)
+    frame.cloud_distance.reset(new PointCloudXYZ);
+
+  PointCloudXYZ& cloud_distance = *frame.cloud_distance;
+  cloud_distance.points.clear();
+
+  // Cameras that fail to convert are left out, the others are still integrated
+  frame.views.resize(cloud_msgs.size());
+  int view_count = 0;
+  for (int i=0; i<cloud_msgs.size(); i++)
+  {
+    if (convertDepth(*cloud_msgs[i], frame.views[view_count], cloud_distance))
+      view_count++;
+  }
+  frame.views.resize(view_count);
 
+  cloud_distance.width    = cloud_distance.points.size();
+  cloud_distance.height   = 1;
+  cloud_distance.is_dense = true;
+
+  return view_count > 0;
+}
+
+void MappingModule::integrateDepth(DepthFrame& frame)
+{
   // == Add filtered to final cloud
-  addPointCloudToPointCloud(cloud_distance_ptr, cloud_ptr_rgbd_, depth_grid_res_);
+  addPointCloudToAccumulator(frame.cloud_distance);
 
   // == Update octomap
   timer.start("[MappingModule]callbackDepth-updateOcto");
-  octomap::point3d origin (transform.getOrigin().x(),
-                           transform.getOrigin().y(),
-                           transform.getOrigin().z());
-  octomap::point3d sensor_dir = pose_conversion::getOctomapDirectionVectorFromTransform(transform);
-
-  addPointCloudToTree(octree_, *cloud_raw_ptr, origin, sensor_dir, max_rgbd_range_, true);
+  addPointCloudsToTree(octree_, frame.views, max_rgbd_range_);
   timer.stop("[MappingModule]callbackDepth-updateOcto");
 
   // == Update prediction, if necessary
@@ -513,14 +701,147 @@ void MappingModule::processDepth(const sensor_msgs::PointCloud2& cloud_msg)
   {
     timer.start("[MappingModule]callbackDepth-updatePrediction");
     std::cout << cc.yellow << "[Mapping] " <<" HERE --->>>\n";fflush(stdout);
-    updatePrediction(octree_prediction_, *cloud_raw_ptr, origin, sensor_dir, max_rgbd_range_, true);
+    for (int i=0; i<frame.views.size(); i++)
+      updatePrediction(octree_prediction_, *frame.views[i].scan, frame.views[i].origin, frame.views[i].sensor_dir, max_rgbd_range_, true);
     std::cout << cc.yellow << "[Mapping] " << " HERE <<<---\n";fflush(stdout);
     timer.stop("[MappingModule]callbackDepth-updatePrediction");
   }
+}
+
+void MappingModule::processDepth(const std::vector<const sensor_msgs::PointCloud2*>& cloud_msgs)
+{
+  // Synchronous path, used when the depth pipeline is disabled
+  DepthFrame& frame = depth_frame_sync_;
+  if (!convertDepthFrame(cloud_msgs, frame))
+    return;
+
+  integrateDepth(frame);
 
   // == Update density map
-  updateVoxelDensities(cloud_distance_ptr);
-  std::cout << "[Mapping] " << cc.green << "Done Processing Depth\n" << cc.reset;
+  updateVoxelDensities(frame.cloud_distance);
+
+  if (is_debugging_)
+    std::cout << "[Mapping] " << cc.green << "Done Processing Depth\n" << cc.reset;
+}
+
+void MappingModule::enqueueDepth(const std::vector<sensor_msgs::PointCloud2ConstPtr>& cloud_msgs, uint camera_flags)
+{
+  // Only one frame per camera is taken for each data request
+  if (camera_queued_flags_.fetch_or(camera_flags) & camera_flags)
+    return;
+
+  DepthJob job;
+  job.msgs = cloud_msgs;
+  job.camera_flags = camera_flags;
+
+  // Backpressure blocks until the conversion stage catches up
+  bool is_queued = is_depth_dropping_when_full_ ? depth_job_queue_->tryPush(job) : depth_job_queue_->push(job);
+  if (!is_queued)
+  {
+    // Let the next message from this camera take its place
+    depth_frames_dropped_++;
+    camera_queued_flags_ &= ~camera_flags;
+    std::cout << "[Mapping] " << cc.yellow << "Depth pipeline full, dropped frame (" << depth_frames_dropped_ << " total)\n" << cc.reset;
+  }
+}
+
+void MappingModule::startDepthPipeline()
+{
+  depth_job_queue_     = new LockFreeQueue<DepthJob>(depth_queue_size_);
+  depth_frame_queue_   = new LockFreeQueue<DepthFrame>(depth_queue_size_);
+  density_frame_queue_ = new LockFreeQueue<DepthFrame>(depth_queue_size_);
+  depth_frame_pool_    = new LockFreeQueue<DepthFrame>(3*depth_queue_size_);
+
+  is_depth_pipeline_running_ = true;
+  depth_workers_.push_back( std::thread(&MappingModule::workerDepthConversion, this) );
+  depth_workers_.push_back( std::thread(&MappingModule::workerDepthIntegration, this) );
+  depth_workers_.push_back( std::thread(&MappingModule::workerDepthDensity, this) );
+}
+
+void MappingModule::stopDepthPipeline()
+{
+  if (!is_depth_pipeline_running_)
+    return;
+
+  // Wake the workers blocked on a queue
+  is_depth_pipeline_running_ = false;
+  depth_job_queue_->close();
+  depth_frame_queue_->close();
+  density_frame_queue_->close();
+
+  for (int i=0; i<depth_workers_.size(); i++)
+    depth_workers_[i].join();
+  depth_workers_.clear();
+
+  delete depth_job_queue_;
+  delete depth_frame_queue_;
+  delete density_frame_queue_;
+  delete depth_frame_pool_;
+  depth_job_queue_ = NULL;
+  depth_frame_queue_ = NULL;
+  density_frame_queue_ = NULL;
+  depth_frame_pool_ = NULL;
+}
+
+void MappingModule::workerDepthConversion()
+{
+  DepthJob job;
+  std::vector<const sensor_msgs::PointCloud2*> cloud_msgs;
+  while (depth_job_queue_->pop(job))
+  {
+    // Reuse the buffers of a retired frame when one is available
+    DepthFrame frame;
+    depth_frame_pool_->tryPop(frame);
+
+    cloud_msgs.clear();
+    for (int i=0; i<job.msgs.size(); i++)
+      cloud_msgs.push_back(job.msgs[i].get());
+
+    if (!convertDepthFrame(cloud_msgs, frame))
+    {
+      // Nothing to integrate, but the cameras have answered the request
+      camera_done_flags_ |= job.camera_flags;
+      depth_frame_pool_->tryPush(frame);
+      continue;
+    }
+    frame.camera_flags = job.camera_flags;
+    job.msgs.clear();
+
+    if (!depth_frame_queue_->push(frame))
+      break;
+  }
+}
+
+void MappingModule::workerDepthIntegration()
+{
+  DepthFrame frame;
+  while (depth_frame_queue_->pop(frame))
+  {
+    integrateDepth(frame);
+
+    if (!density_frame_queue_->push(frame))
+      break;
+  }
+}
+
+void MappingModule::workerDepthDensity()
+{
+  DepthFrame frame;
+  while (density_frame_queue_->pop(frame))
+  {
+    // == Update density map
+    updateVoxelDensities(frame.cloud_distance);
+
+    if (is_debugging_)
+      std::cout << "[Mapping] " << cc.green << "Done Processing Depth\n" << cc.reset;
+
+    // The frame is fully integrated only at this point
+    camera_done_flags_ |= frame.camera_flags;
+
+    // Retire the frame, its buffers are picked up by the conversion stage
+    depth_frame_pool_->tryPush(frame);
+    frame = DepthFrame();
+  }
 }
 
 void MappingModule::callbackDepthSync(const sensor_msgs::PointCloud2ConstPtr& cloud_msg1, const sensor_msgs::PointCloud2ConstPtr& cloud_msg2)
@@ -540,13 +861,42 @@ void MappingModule::callbackDepthSync(const sensor_msgs::PointCloud2ConstPtr& cl
       return;
     }
 
-    mutex_depth_callback.lock();
-    processDepth(*cloud_msg1);
-    processDepth(*cloud_msg2);
+    if (is_depth_pipeline_enabled_)
+    {
+      // Conversion and integration happen on the pipeline threads, which set the done flags
+      if (is_depth_fusing_cameras_)
+      {
+        std::vector<sensor_msgs::PointCloud2ConstPtr> cloud_msgs;
+        cloud_msgs.push_back(cloud_msg1);
+        cloud_msgs.push_back(cloud_msg2);
+        enqueueDepth(cloud_msgs, 0x03);
+      }
+      else
+      {
+        enqueueDepth(std::vector<sensor_msgs::PointCloud2ConstPtr>(1, cloud_msg1), 0x01);
+        enqueueDepth(std::vector<sensor_msgs::PointCloud2ConstPtr>(1, cloud_msg2), 0x02);
+      }
+    }
+    else
+    {
+      mutex_depth_callback.lock();
+      if (is_depth_fusing_cameras_)
+      {
+        std::vector<const sensor_msgs::PointCloud2*> cloud_msgs;
+        cloud_msgs.push_back(cloud_msg1.get());
+        cloud_msgs.push_back(cloud_msg2.get());
+        processDepth(cloud_msgs);
+      }
+      else
+      {
+        processDepth(std::vector<const sensor_msgs::PointCloud2*>(1, cloud_msg1.get()));
+        processDepth(std::vector<const sensor_msgs::PointCloud2*>(1, cloud_msg2.get()));
+      }
 
-    // == Done updating
-    camera_done_flags_ |= 0x03;
-    mutex_depth_callback.unlock();
+      // == Done updating
+      camera_done_flags_ |= 0x03;
+      mutex_depth_callback.unlock();
+    }
 
     timer.stop("[MappingModule]callbackDepthSync");
 }
@@ -568,12 +918,19 @@ void MappingModule::callbackDepth(const sensor_msgs::PointCloud2& cloud_msg)
       return;
     }
 
-    mutex_depth_callback.lock();
-    processDepth(cloud_msg);
+    if (is_depth_pipeline_enabled_)
+    {
+      enqueueDepth(std::vector<sensor_msgs::PointCloud2ConstPtr>(1, boost::make_shared<sensor_msgs::PointCloud2>(cloud_msg)), 0x01);
+    }
+    else
+    {
+      mutex_depth_callback.lock();
+      processDepth(std::vector<const sensor_msgs::PointCloud2*>(1, &cloud_msg));
 
-    // == Done updating
-    camera_done_flags_ |= 0x01;
-    mutex_depth_callback.unlock();
+      // == Done updating
+      camera_done_flags_ |= 0x01;
+      mutex_depth_callback.unlock();
+    }
 
     timer.stop("[MappingModule]callbackDepth");
 }
@@ -595,20 +952,28 @@ void MappingModule::callbackDepth2(const sensor_msgs::PointCloud2& cloud_msg)
       return;
     }
 
-    mutex_depth_callback.lock();
-    processDepth(cloud_msg);
+    if (is_depth_pipeline_enabled_)
+    {
+      enqueueDepth(std::vector<sensor_msgs::PointCloud2ConstPtr>(1, boost::make_shared<sensor_msgs::PointCloud2>(cloud_msg)), 0x02);
+    }
+    else
+    {
+      mutex_depth_callback.lock();
+      processDepth(std::vector<const sensor_msgs::PointCloud2*>(1, &cloud_msg));
 
-    // == Done updating
-    camera_done_flags_ |= 0x02;
-    mutex_depth_callback.unlock();
+      // == Done updating
+      camera_done_flags_ |= 0x02;
+      mutex_depth_callback.unlock();
+    }
 
     timer.stop("[MappingModule]callbackDepth2");
 }
 
 bool MappingModule::commandGetCameraData()
 {
-  getCameraData      = true;
-  camera_done_flags_ = 0;
+  camera_done_flags_   = 0;
+  camera_queued_flags_ = 0;
+  getCameraData        = true;
 
   timer.start("[MappingModule]commandGetCameraData-waiting");
   while(camera_done_flags_ != all_done_flags_ )
@@ -645,6 +1010,7 @@ bool MappingModule::commandFinalMapLoad()
     return false;
   }
 
+  resetAccumulatorFromPointCloud();
   return true;
 }
 
@@ -655,15 +1021,16 @@ bool MappingModule::commandFinalMapSave()
   std::cout << "[Mapping] " << cc.green << "Saving final maps\n" << cc.reset;
 
   // Point cloud
-  if (!cloud_ptr_rgbd_)
+  PointCloudXYZ::Ptr cloud_rgbd = getPointCloud();
+  if (!cloud_rgbd)
   {
     std::cout << "[Mapping] " << cc.red << "ERROR: No point cloud data available. Exiting node.\n" << cc.reset;
     return false;
   }
-  pcl::io::savePCDFileASCII (filename_pcl_final_, *cloud_ptr_rgbd_);
+  pcl::io::savePCDFileASCII (filename_pcl_final_, *cloud_rgbd);
 
   if (is_debug_save_state_)
-    pcl::io::savePCDFileASCII (filename_pcl_save_state_, *cloud_ptr_rgbd_);
+    pcl::io::savePCDFileASCII (filename_pcl_save_state_, *cloud_rgbd);
 
   // Octree
   if (is_filling_octomap_)
@@ -699,7 +1066,10 @@ bool MappingModule::commandProfileLoad()
   if (is_debug_load_state_)
     commandFinalMapLoad();
   else
+  {
     copyPointCloud(*cloud_ptr_profile_, *cloud_ptr_rgbd_);
+    resetAccumulatorFromPointCloud();
+  }
 
   // Octree
   if (is_debug_load_state_)
@@ -711,6 +1081,7 @@ bool MappingModule::commandProfileLoad()
     { // read error returns NULL
       octree_ = dynamic_cast<octomap::OcTree*>(temp_tree);
       octree_->setOccupancyThres( octree_thresh_ );
+      invalidateMapChanges();
 
       if (!octree_)
       {
@@ -733,6 +1104,7 @@ bool MappingModule::commandProfileLoad()
     { // read error returns NULL
       octree_ = dynamic_cast<octomap::OcTree*>(temp_tree);
       octree_->setOccupancyThres( octree_thresh_ );
+      invalidateMapChanges();
 
       if (!octree_)
       {
@@ -764,7 +1136,10 @@ bool MappingModule::commandProfileLoad()
     octree_prediction_->setBBXMax( bound_max_ );
 
     if (is_integrating_prediction_)
+    {
       addPredictedPointCloudToTree(octree_, *cloud_ptr_profile_symmetry_);
+      invalidateMapChanges();
+    }
     else
       addPredictedPointCloudToTree(octree_prediction_, *cloud_ptr_profile_symmetry_);
   }
@@ -828,6 +1203,7 @@ bool MappingModule::commandProfilingStart()
     octree_->setBBXMin( bound_min_ );
     octree_->setBBXMax( bound_max_ );
     octree_->setOccupancyThres( octree_thresh_ );
+    invalidateMapChanges();
   }
 
   if (!octree_prediction_)
@@ -849,6 +1225,7 @@ bool MappingModule::commandProfilingStop()
 
   // Initialize cloud_ptr_rgbd_ with profile data
   copyPointCloud(*cloud_ptr_profile_, *cloud_ptr_rgbd_);
+  resetAccumulatorFromPointCloud();
 
   if (skip_load_map_)
     return true;
@@ -889,7 +1266,21 @@ bool MappingModule::commandScanningStop()
 }
 
 void MappingModule::computeTreeUpdatePlanar(octomap::OcTree* octree_in, const octomap::Pointcloud& scan, const octomap::point3d& origin, octomap::point3d& sensor_dir,
-                      octomap::KeySet& free_cells, octomap::KeySet& occupied_cells,
+                      OccupancyKeyBatch& key_batch,
+                      double maxrange)
+{
+  sensor_dir.normalize();
+
+  std::vector<PlanarScan> scans(1);
+  scans[0].scan = &scan;
+  scans[0].origin = origin;
+  scans[0].sensor_dir = sensor_dir;
+
+  computeTreeUpdatePlanar(octree_in, scans, key_batch, maxrange);
+}
+
+void MappingModule::computeTreeUpdatePlanar(octomap::OcTree* octree_in, const std::vector<PlanarScan>& scans,
+                      OccupancyKeyBatch& key_batch,
                       double maxrange)
 {
   /*
@@ -900,15 +1291,54 @@ void MappingModule::computeTreeUpdatePlanar(octomap::OcTree* octree_in, const oc
    * @todo: bbx limit
    */
 
-  sensor_dir.normalize();
+  // == Per scan setup, the pixels of all scans are then numbered one after the other
+  int scan_count = scans.size();
+  std::vector<octomap::point3d> sensor_dirs(scan_count);
+  std::vector<int> scan_offsets(scan_count+1, 0);
+  std::vector<char> is_organized(scan_count);
+  bool any_organized = false;
+
+  for (int s=0; s<scan_count; s++)
+  {
+    sensor_dirs[s] = scans[s].sensor_dir;
+    sensor_dirs[s].normalize();
+    scan_offsets[s+1] = scan_offsets[s] + scans[s].scan->size();
+
+    is_organized[s] = (camera_width_px_*camera_height_px_ == scans[s].scan->size());
+    any_organized |= is_organized[s];
+  }
+  int point_count = scan_offsets[scan_count];
+
   bool lazy_eval = false;
   bool use_ray_skipping = false;
-  if (camera_width_px_*camera_height_px_ == scan.size() &&
+  if (any_organized &&
       (ray_skipping_vertical_ != 1 || ray_skipping_horizontal_ != 1))
   {
     use_ray_skipping = true;
     std::cout << "[Mapping] " << "Ray skipping\n";
   }
+
+  // Visit pixels in square bundles, rays of a bundle cross the same voxels near the sensor
+  bool use_ray_bundles = false;
+  if (any_organized && ray_bundle_size_ > 1)
+  {
+    use_ray_bundles = true;
+    updateRayBundleOrder();
+  }
+  key_batch.setEmissionCacheSize(use_ray_bundles ? ray_bundle_cache_size_ : 0);
+
+  // Within a bundle, only cast one ray per endpoint voxel
+  bool use_adaptive_skipping = use_ray_bundles && is_ray_skipping_adaptive_;
+  int bundles_horizontal = 0;
+  int bundles_per_frame = 0;
+  long rays_cast = 0, rays_skipped = 0;
+  if (is_debugging_ && is_ray_skipping_adaptive_ && !use_ray_bundles)
+    std::cout << "[Mapping] " << cc.yellow << "Adaptive ray skipping requires ray bundles on an organized cloud, casting all rays\n" << cc.reset;
+  if (use_adaptive_skipping)
+  {
+    bundles_horizontal = (camera_width_px_ + ray_bundle_size_ - 1)/ray_bundle_size_;
+    bundles_per_frame = bundles_horizontal*((camera_height_px_ + ray_bundle_size_ - 1)/ray_bundle_size_);
+  }
   std::cout <<cc.red << "[Mapping] computeTreeUpdatePlanar 1\n";fflush(stdout);
   // create as many KeyRays as there are OMP_THREADS defined,
   // one buffer for each thread
@@ -937,18 +1367,35 @@ void MappingModule::computeTreeUpdatePlanar(octomap::OcTree* octree_in, const oc
   std::cout <<cc.red << "[Mapping] computeTreeUpdatePlanar 2c\n";fflush(stdout);
 
   //std::cout << "[Mapping] computeTreeUpdatePlanar Pre 4, scan size:"<<cc.red<< scan.size() <<" camera width px:"<<camera_width_px_<<" octree size:"<<octree_in->size()<<" keyRays:"<<keyrays.size()<<"\n";fflush(stdout);
+  // The caller resets key_batch for omp_get_max_threads() threads, so scans of
+  // several cameras can be collected before a single finalize()
   int num_threads = keyrays.size();
-  std::vector<octomap::KeySet> free_cells_threaded(num_threads);
-  std::vector<octomap::KeySet> occupied_cells_threaded(num_threads);
+
+  // Endpoint voxels claimed in the bundle each thread is working on
+  std::vector<int> bundle_current(num_threads, -1);
+  std::vector< std::vector<uint64_t> > bundle_endpoints(num_threads);
   std::cout <<cc.red << "[Mapping] computeTreeUpdatePlanar 3 Max Number of threads:"<<omp_get_max_threads()<<"\n";fflush(stdout);
 
+  // Threads split the pixels of all scans, so cameras are traced concurrently
   #ifdef _OPENMP
   omp_set_num_threads(num_threads);
-  #pragma omp parallel for schedule(guided)
+  #pragma omp parallel for schedule(guided) reduction(+:rays_cast,rays_skipped)
   #endif
-  for (int i = 0; i < (int)scan.size(); ++i)
+  for (int n_all = 0; n_all < point_count; ++n_all)
   {
-    if (use_ray_skipping)
+    int s = 0;
+    while (n_all >= scan_offsets[s+1])
+      s++;
+
+    const octomap::Pointcloud& scan = *scans[s].scan;
+    const octomap::point3d& origin = scans[s].origin;
+    const octomap::point3d& sensor_dir = sensor_dirs[s];
+
+    int i = n_all - scan_offsets[s];
+    if (use_ray_bundles && is_organized[s])
+      i = ray_bundle_order_[i];
+
+    if (use_ray_skipping && is_organized[s])
     {
       int ix = i%camera_width_px_;
       int iy = i/camera_width_px_;
@@ -967,50 +1414,90 @@ void MappingModule::computeTreeUpdatePlanar(octomap::OcTree* octree_in, const oc
 
     // Gets the perpendicular distance from the UAV's direction vector
     double perp_dist = sensor_dir.dot(p - origin);
+    bool is_max_range = !(maxrange < 0.0 || perp_dist <= maxrange);
 
-    if (maxrange < 0.0 || perp_dist <= maxrange)
-    { // is not maxrange meas.
-      // free cells
-      if (octree_in->computeRayKeys(origin, p, *keyray))
+    octomap::point3d end = p;
+    if (is_max_range)
+    { // user set a maxrange and length is above
+      octomap::point3d direction = (p - origin).normalized ();
+      double max_rgbd_range__to_point = maxrange/sensor_dir.dot(direction);
+
+      end = origin + direction * (float) max_rgbd_range__to_point;
+    }
+
+    if (use_adaptive_skipping && is_organized[s])
+    {
+      int bundle = s*bundles_per_frame + (i/camera_width_px_/ray_bundle_size_)*bundles_horizontal + (i%camera_width_px_)/ray_bundle_size_;
+      if (bundle != bundle_current[threadIdx])
       {
-        free_cells_threaded[threadIdx].insert(keyray->begin(), keyray->end());
+        bundle_current[threadIdx] = bundle;
+        bundle_endpoints[threadIdx].clear();
       }
+
+      // Far pixels land many-to-one on voxels, skip the ray if its endpoint voxel is taken
+      // Max range endpoints are tagged separately so they never hide an occupied endpoint
+      octomap::OcTreeKey end_key;
+      if (octree_in->coordToKeyChecked(end, end_key))
+      {
+        uint64_t end_code = OccupancyKeyBatch::keyToMorton(end_key) | (uint64_t(is_max_range) << 63);
+        std::vector<uint64_t>& claimed = bundle_endpoints[threadIdx];
+
+        if (std::find(claimed.begin(), claimed.end(), end_code) != claimed.end())
+        {
+          rays_skipped++;
+          continue;
+        }
+        claimed.push_back(end_code);
+      }
+    }
+    rays_cast++;
+
+    // free cells, each ray is traced on its own: only the emission of the cells
+    // it shares with the rest of its bundle is deduplicated, by the key batch
+    if (octree_in->computeRayKeys(origin, end, *keyray))
+    {
+      key_batch.addFree(threadIdx, *keyray);
+    }
+
+    if (!is_max_range)
+    { // is not maxrange meas.
       // occupied endpoint
       octomap::OcTreeKey key;
       if (octree_in->coordToKeyChecked(p, key)){
-        occupied_cells_threaded[threadIdx].insert(key);
+        key_batch.addOccupied(threadIdx, key);
       }
     }
-    else
-    { // user set a maxrange and length is above
-      octomap::point3d direction = (p - origin).normalized ();
-      double max_rgbd_range__to_point = maxrange/sensor_dir.dot(direction);
-
-      octomap::point3d new_end = origin + direction * (float) max_rgbd_range__to_point;
-      if (octree_in->computeRayKeys(origin, new_end, *keyray)){
-        free_cells_threaded[threadIdx].insert(keyray->begin(), keyray->end());
-      }
-    } // end if maxrange
   } // end for all points, end of parallel OMP loop
 
-  // Merge threaded vectors
-  for (int i=0; i<num_threads; i++)
-  {
-    free_cells.insert(free_cells_threaded[i].begin(), free_cells_threaded[i].end());
-    occupied_cells.insert(occupied_cells_threaded[i].begin(), occupied_cells_threaded[i].end());
-  }
+  if (is_debugging_ && use_ray_bundles)
+    std::cout << "[Mapping] " << cc.blue << "Ray bundles: " << key_batch.getSuppressedCount() << " repeated cells skipped\n" << cc.reset;
 
-  // prefer occupied cells over free ones (and make sets disjunct)
-  for(octomap::KeySet::iterator it = free_cells.begin(), end=free_cells.end(); it!= end; )
+  if (use_adaptive_skipping)
   {
-    if (occupied_cells.find(*it) != occupied_cells.end())
-      it = free_cells.erase(it);
+    timer.record("[MappingModule]adaptiveSkipping-raysCast", rays_cast);
+    timer.record("[MappingModule]adaptiveSkipping-raysSkipped", rays_skipped);
 
-    else
-      ++it;
+    if (is_debugging_)
+      std::cout << "[Mapping] " << cc.blue << "Adaptive ray skipping: " << rays_cast << " rays cast, " << rays_skipped << " rays skipped\n" << cc.reset;
   }
 }
 
+void MappingModule::updateRayBundleOrder()
+{
+  if (ray_bundle_order_.size() == camera_width_px_*camera_height_px_)
+    return;
+
+  // Pixel indices of the frame, grouped by bundles of ray_bundle_size_ x ray_bundle_size_ pixels
+  ray_bundle_order_.clear();
+  ray_bundle_order_.reserve(camera_width_px_*camera_height_px_);
+
+  for (int by=0; by<camera_height_px_; by+=ray_bundle_size_)
+    for (int bx=0; bx<camera_width_px_; bx+=ray_bundle_size_)
+      for (int iy=by; iy<std::min(by+ray_bundle_size_, camera_height_px_); iy++)
+        for (int ix=bx; ix<std::min(bx+ray_bundle_size_, camera_width_px_); ix++)
+          ray_bundle_order_.push_back(iy*camera_width_px_ + ix);
+}
+
 double MappingModule::getAveragePointDensity()
 {
   // Get total number of occupied voxels
@@ -1022,7 +1509,7 @@ double MappingModule::getAveragePointDensity()
       num_occ++;
   }
 
-  return double(cloud_ptr_rgbd_->points.size())/num_occ;
+  return double(getPointCloud()->points.size())/num_occ;
 }
 
 bool MappingModule::isNodeFree(octomap::OcTreeNode node)
@@ -1046,6 +1533,119 @@ bool MappingModule::isNodeUnknown(octomap::OcTreeNode node)
   return !isNodeFree(node) && !isNodeOccupied(node);
 }
 
+bool MappingModule::isTrackingFrontiers()
+{
+  return is_tracking_frontiers_;
+}
+
+MappingModule::VoxelClass MappingModule::getVoxelClass(float log_odds)
+{
+  // NaN, the voxel is not in the tree
+  if (log_odds != log_odds)
+    return VOXEL_MISSING;
+
+  octomap::OcTreeNode node;
+  node.setLogOdds(log_odds);
+
+  if (isNodeFree(node))
+    return VOXEL_FREE;
+  if (isNodeOccupied(node))
+    return VOXEL_OCCUPIED;
+  return VOXEL_UNKNOWN;
+}
+
+bool MappingModule::isFrontierCell(const octomap::OcTreeKey& key)
+{
+  // Unknown voxel with at least one free and one occupied voxel around it
+  octomap::OcTreeNode* node = octree_->search(key);
+  if (!node || !isNodeUnknown(*node))
+    return false;
+
+  bool found_free = false;
+  bool found_occ = false;
+
+  octomap::OcTreeKey n_key;
+  for (int dx=-1; dx<=1; dx++)
+  {
+    for (int dy=-1; dy<=1; dy++)
+    {
+      for (int dz=-1; dz<=1; dz++)
+      {
+        if (dx == 0 && dy == 0 && dz == 0)
+          continue;
+
+        int c[3] = {key[0]+dx, key[1]+dy, key[2]+dz};
+        if (c[0] < 0 || c[0] > 65535 || c[1] < 0 || c[1] > 65535 || c[2] < 0 || c[2] > 65535)
+          continue;
+
+        n_key[0] = c[0]; n_key[1] = c[1]; n_key[2] = c[2];
+
+        octomap::OcTreeNode* n = octree_->search(n_key);
+        if (!n)
+          continue;
+        else if (isNodeFree(*n))
+          found_free = true;
+        else if (isNodeOccupied(*n))
+          found_occ = true;
+
+        if (found_free && found_occ)
+          return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void MappingModule::evaluateFrontierCandidates(bool is_rebuild)
+{
+  // Only reads the tree, the candidates are independent
+  int count = frontier_candidate_keys_.size();
+  frontier_candidate_status_.resize(count);
+
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (int i=0; i<count; i++)
+    frontier_candidate_status_[i] = isFrontierCell(frontier_candidate_keys_[i]);
+
+  std::lock_guard<std::mutex> lock(mutex_frontiers);
+  if (is_rebuild)
+    frontier_cells_.clear();
+
+  for (int i=0; i<count; i++)
+  {
+    if (frontier_candidate_status_[i])
+      frontier_cells_.insert(frontier_candidate_keys_[i]);
+    else
+      frontier_cells_.erase(frontier_candidate_keys_[i]);
+  }
+}
+
+EsdfMap* MappingModule::getEsdf()
+{
+  if (!is_esdf_enabled_)
+    return NULL;
+
+  return &esdf_;
+}
+
+void MappingModule::getFrontierCells(std::vector<octomap::OcTreeKey>& keys)
+{
+  std::lock_guard<std::mutex> lock(mutex_frontiers);
+  keys.clear();
+  keys.reserve(frontier_cells_.size());
+  for (VoxelHashSet::iterator it = frontier_cells_.begin(); it != frontier_cells_.end(); ++it)
+    keys.push_back(*it);
+}
+
+void MappingModule::getLowDensityCells(std::vector<octomap::OcTreeKey>& keys)
+{
+  std::lock_guard<std::mutex> lock(mutex_frontiers);
+  keys.clear();
+  keys.reserve(low_density_cells_.size());
+  for (VoxelHashSet::iterator it = low_density_cells_.begin(); it != low_density_cells_.end(); ++it)
+    keys.push_back(*it);
+}
+
 octomap::OcTree* MappingModule::getOctomap()
 {
   return octree_;
@@ -1063,7 +1663,21 @@ PointCloudXYZ::Ptr MappingModule::getProfilePointCloud()
 
 PointCloudXYZ::Ptr MappingModule::getPointCloud()
 {
-  return cloud_ptr_rgbd_;
+  // Export the accumulated voxel grid only when it changed since the last request
+  mutex_rgbd.lock();
+  if (is_rgbd_cloud_outdated_)
+  {
+    PointCloudXYZ::Ptr cloud (new PointCloudXYZ);
+    rgbd_accumulator_.getPointCloud(*cloud);
+
+    // Previous snapshots remain valid for anyone still holding them
+    cloud_ptr_rgbd_ = cloud;
+    is_rgbd_cloud_outdated_ = false;
+  }
+  PointCloudXYZ::Ptr cloud_out = cloud_ptr_rgbd_;
+  mutex_rgbd.unlock();
+
+  return cloud_out;
 }
 
 void MappingModule::initializeParameters()
@@ -1101,6 +1715,8 @@ void MappingModule::initializeParameters()
   ros::param::param("~mapping_sensor_data_min_height_", sensor_data_min_height_, 0.5);
   ros::param::param("~mapping_voxel_grid_res_profile", profile_grid_res_, 0.1);
   ros::param::param("~mapping_voxel_grid_res_rgbd", depth_grid_res_, 0.1);
+  rgbd_accumulator_.setLeafSize(depth_grid_res_);
+  is_rgbd_cloud_outdated_ = false;
   ros::param::param("~mapping_integrate_prediction", is_integrating_prediction_, false);
   ros::param::param("~mapping_integrate_occupancy", predicted_occupancy_value_, 0.7);
 
@@ -1124,6 +1740,45 @@ void MappingModule::initializeParameters()
   ros::param::param("~height_px", camera_height_px_, 480);
   ros::param::param("~ray_skipping_vertical", ray_skipping_vertical_, 1);
   ros::param::param("~ray_skipping_horizontal", ray_skipping_horizontal_, 1);
+  ros::param::param("~ray_bundle_size", ray_bundle_size_, 8);
+  ros::param::param("~ray_bundle_cache_size", ray_bundle_cache_size_, 4096);
+  ros::param::param("~ray_skipping_adaptive", is_ray_skipping_adaptive_, false);
+  if (is_ray_skipping_adaptive_ && ray_bundle_size_ <= 1)
+    std::cout << "[Mapping] " << cc.yellow << "Adaptive ray skipping requires ray bundles (ray_bundle_size > 1), casting all rays\n" << cc.reset;
+
+  ros::param::param("~depth_pipeline", is_depth_pipeline_enabled_, true);
+  ros::param::param("~depth_pipeline_queue_size", depth_queue_size_, 4);
+  ros::param::param("~depth_pipeline_drop_when_full", is_depth_dropping_when_full_, false);
+  ros::param::param("~depth_fuse_cameras", is_depth_fusing_cameras_, true);
+  ros::param::param("~mapping_change_log_size", map_change_log_size_, 1<<21);
+
+  // Distance field over the navigation bounds, padded so that distances at the border see obstacles beyond it
+  ros::param::param("~mapping_esdf", is_esdf_enabled_, true);
+  ros::param::param("~mapping_esdf_max_distance", esdf_max_distance_, 2.0);
+
+  double nav_x_min, nav_x_max, nav_y_min, nav_y_max, nav_z_min, nav_z_max;
+  ros::param::param("~nav_bounds_x_min", nav_x_min,-5.0);
+  ros::param::param("~nav_bounds_x_max", nav_x_max, 5.0);
+  ros::param::param("~nav_bounds_y_min", nav_y_min,-5.0);
+  ros::param::param("~nav_bounds_y_max", nav_y_max, 5.0);
+  ros::param::param("~nav_bounds_z_min", nav_z_min, 1.0);
+  ros::param::param("~nav_bounds_z_max", nav_z_max, 5.0);
+
+  // Frontier and low density voxels, the threshold is shared with the frontier view generator.
+  // Only the frontier view generators read them (directly or after local minima), so they are
+  // tracked by default only when one of those is selected
+  int view_generator_type;
+  ros::param::param("~view_generator_type", view_generator_type, 0);
+  ros::param::param("~mapping_frontier_tracking", is_tracking_frontiers_, view_generator_type == 2 || view_generator_type == 3);
+  ros::param::param("~view_generator_frontier_density_threshold", low_density_threshold_, 10.0);
+
+  if (is_esdf_enabled_)
+  {
+    octomap::point3d padding(esdf_max_distance_, esdf_max_distance_, esdf_max_distance_);
+    esdf_.reset(octomap::point3d(nav_x_min, nav_y_min, nav_z_min) - padding,
+                octomap::point3d(nav_x_max, nav_y_max, nav_z_max) + padding,
+                octree_res_, esdf_max_distance_);
+  }
 
 
   int camera_count;
@@ -1189,15 +1844,13 @@ void MappingModule::processScans()
   std::cout << "   Total time: " << t_end-t_start << " sec\tTotal scan: " << count << "\t(" << (t_end-t_start)/count << " sec/scan)\n";
 }
 
-void MappingModule::updatePrediction(octomap::OcTree* octree_in, PointCloudXYZ cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
+void MappingModule::updatePrediction(octomap::OcTree* octree_in, const PointCloudXYZ& cloud_in, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
 {
-  // Clear predictions along rays
-  // Modified version of from MappingModule::addPointCloudToTree()
-
   if (!is_checking_symmetry_)
     return;
 
   octomap::Pointcloud ocCloud;
+  ocCloud.reserve(cloud_in.points.size());
   for (int j=0; j<cloud_in.points.size(); j++)
   {
     ocCloud.push_back(cloud_in.points[j].x,
@@ -1205,46 +1858,118 @@ void MappingModule::updatePrediction(octomap::OcTree* octree_in, PointCloudXYZ c
                       cloud_in.points[j].z);
   }
 
+  updatePrediction(octree_in, ocCloud, sensor_origin, sensor_dir, range, isPlanar);
+}
+
+void MappingModule::updatePrediction(octomap::OcTree* octree_in, const octomap::Pointcloud& ocCloud, octomap::point3d sensor_origin, octomap::point3d sensor_dir, double range, bool isPlanar)
+{
+  // Clear predictions along rays
+  // Modified version of from MappingModule::addPointCloudToTree()
+
+  if (!is_checking_symmetry_)
+    return;
+
   // == Insert point cloud based on planar (camera) or spherical (laser) scan data
-  octomap::KeySet free_cells, occupied_cells;
   std::cout << "[Mapping] " << cc.yellow<<" --- D ---\n";fflush(stdout);
   if (isPlanar)
   {
+    OccupancyKeyBatch key_batch;
    try
     {
-      computeTreeUpdatePlanar(octree_in, ocCloud, sensor_origin, sensor_dir, free_cells, occupied_cells, range);
+      key_batch.reset(omp_get_max_threads());
+      computeTreeUpdatePlanar(octree_in, ocCloud, sensor_origin, sensor_dir, key_batch, range);
+      key_batch.finalize();
     }
     catch(...)
     {
       std::cout << boost::current_exception_diagnostic_information() << std::endl;
     }
+    std::cout << "[Mapping] " << cc.yellow<<" --- E ---\n";fflush(stdout);
+
+    // Clear all predicted values
+    key_batch.updateTree(octree_in, -5.0f, -5.0f);
   }
   else
   {
+    octomap::KeySet free_cells, occupied_cells;
     octree_in->computeUpdate(ocCloud, sensor_origin, free_cells, occupied_cells, range);
-  }
-  std::cout << "[Mapping] " << cc.yellow<<" --- E ---\n";fflush(stdout);
-  // Clear all predicted values
-  for (octomap::KeySet::iterator it = free_cells.begin(); it != free_cells.end(); ++it)
-    octree_in->updateNode(*it, -5.0f);
+    std::cout << "[Mapping] " << cc.yellow<<" --- E ---\n";fflush(stdout);
+
+    // Clear all predicted values
+    for (octomap::KeySet::iterator it = free_cells.begin(); it != free_cells.end(); ++it)
+      octree_in->updateNode(*it, -5.0f);
 
-  for (octomap::KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
-    octree_in->updateNode(*it, -5.0f);
+    for (octomap::KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+      octree_in->updateNode(*it, -5.0f);
+  }
 }
 
 int MappingModule::getDensityAtOcTreeKey(octomap::OcTreeKey key)
 {
-  std::map<octomap::OcTreeKey, VoxelDensity>::iterator it;
-  it = voxel_densities_.find(key);
+  VoxelDensity* v = voxel_densities_.find(key);
 
-  if (it == voxel_densities_.end())
+  if (!v)
   {
     // Key not found, display error
     //printf("[ViewSelecterBase]: Invalid key, no point count retrieved\n");
     return -1;
   }
 
-  return it->second.density;
+  return v->density;
+}
+
+std::vector<VoxelChange>* MappingModule::getChangeBuffer(octomap::OcTree* octree_in)
+{
+  // Only the main octree is logged, other trees just bump the version
+  if (octree_in != octree_ || (map_change_log_size_ <= 0 && !is_esdf_enabled_ && !is_tracking_frontiers_))
+    return NULL;
+
+  change_buffer_.clear();
+  return &change_buffer_;
+}
+
+bool MappingModule::getMapChanges(unsigned long since_version, std::vector<VoxelChange>& changes)
+{
+  std::lock_guard<std::mutex> lock(mutex_changes);
+
+  if (map_change_log_size_ <= 0 || since_version < map_changes_start_)
+    return false;
+
+  for (std::deque<MapChangeBlock>::iterator it = map_changes_.begin(); it != map_changes_.end(); ++it)
+  {
+    if (it->version > since_version)
+      changes.insert(changes.end(), it->changes.begin(), it->changes.end());
+  }
+
+  return true;
+}
+
+unsigned long MappingModule::getMapVersion()
+{
+  return map_version_;
+}
+
+void MappingModule::invalidateMapChanges()
+{
+  // Used when octree_ is replaced or changed outside of an integration
+  if (is_esdf_enabled_ && octree_)
+  {
+    timer.start("[MappingModule]invalidateMapChanges-esdf");
+    esdf_.build(octree_, octree_->getOccupancyThresLog());
+    timer.stop("[MappingModule]invalidateMapChanges-esdf");
+  }
+
+  if (is_tracking_frontiers_ && octree_)
+  {
+    timer.start("[MappingModule]invalidateMapChanges-frontiers");
+    rebuildFrontierCells();
+    timer.stop("[MappingModule]invalidateMapChanges-frontiers");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_changes);
+  map_changes_.clear();
+  map_changes_count_ = 0;
+  map_changes_start_ = ++map_version_;
 }
 
 void MappingModule::updateVoxelDensities()
@@ -1253,59 +1978,92 @@ void MappingModule::updateVoxelDensities()
   // Fill a map with point count at each octreekey
   //=======
   voxel_densities_.clear(); // Clear old densities
+  map_version_++;
+
+  mutex_frontiers.lock();
+  low_density_cells_.clear();
+  mutex_frontiers.unlock();
 
   // ============
-  // Create KD tree to find nearest neighbors
+  // Index the whole cloud to find nearest neighbors
   // ============
-  if(cloud_ptr_rgbd_->points.size()<=0)
+  PointCloudXYZ::Ptr cloud_rgbd = getPointCloud();
+  if(cloud_rgbd->points.size()<=0)
     return;
-  pcl::KdTreeFLANN<PointXYZ> kdtree;
-  kdtree.setInputCloud (cloud_ptr_rgbd_);
+  rebuildDensityIndex();
   double search_radius = octree_->getResolution()/sqrt(2); //Encapsulates a voxel
 
-  std::map<octomap::OcTreeKey, VoxelDensity>::iterator it;
-
-  for (int i=0; i<cloud_ptr_rgbd_->points.size(); i++)
+  for (int i=0; i<cloud_rgbd->points.size(); i++)
   {
-    PointXYZ p = cloud_ptr_rgbd_->points[i];
+    PointXYZ p = cloud_rgbd->points[i];
 
     octomap::OcTreeKey key;
     if( !octree_->coordToKeyChecked(p.x, p.y, p.z, key) )
       continue;
 
-    std::vector<int> pointIndicesOut;
-    std::vector<float> pointRadiusSquaredDistance;
-    kdtree.radiusSearch(p, search_radius, pointIndicesOut, pointRadiusSquaredDistance);
+    int neighbor_count = density_index_.radiusCount(p, search_radius);
 
-    // Get iterator for desired key
-    it = voxel_densities_.find(key);
-    if (it != voxel_densities_.end())
+    // Get entry for desired key
+    VoxelDensity* v = voxel_densities_.find(key);
+    if (v)
     {
       // Key found, increment it it
-      it->second.count++;
-      it->second.total += pointIndicesOut.size();
-      it->second.density = double(it->second.total)/it->second.count;
+      v->count++;
+      v->total += neighbor_count;
+      v->density = double(v->total)/v->count;
     }
     else
     {
       // Key not found, initialize it
-      VoxelDensity v;
-      v.count = 1;
-      v.total = pointIndicesOut.size();
-      v.density = double(v.total)/v.count;
+      VoxelDensity v_new;
+      v_new.count = 1;
+      v_new.total = neighbor_count;
+      v_new.density = double(v_new.total)/v_new.count;
 
-      voxel_densities_.insert(std::make_pair(key, v));
+      voxel_densities_.insert(key, v_new);
     }
   }
+
+  // ============
+  // Collect the low density voxels
+  // ============
+  std::lock_guard<std::mutex> lock(mutex_frontiers);
+  for (VoxelHashMap<VoxelDensity>::iterator it = voxel_densities_.begin(); it != voxel_densities_.end(); ++it)
+  {
+    if (it.value().density > 0 && it.value().density < low_density_threshold_)
+      low_density_cells_.insert(it.key());
+  }
 }
 
 
 void MappingModule::updateVoxelDensities(const PointCloudXYZ::Ptr& cloud)
 {
-  std::map<octomap::OcTreeKey, VoxelDensity>::iterator it;
   octomap::OcTreeKey key;
-  if(cloud_ptr_rgbd_->empty())
+  if(cloud->points.empty())
     return;
+
+  timer.start("[MappingModule]updateVoxelDensities");
+
+  // ============
+  // Add new points to the neighbor index
+  //  Only the buckets the new points fall in are touched, so the cost does not
+  //  grow with the size of the map
+  // ============
+  if (density_index_.empty())
+  {
+    rebuildDensityIndex();
+  }
+  else
+  {
+    for (int i=0; i<cloud->points.size(); i++)
+    {
+      if (cloud->points[i].z >= sensor_data_min_height_)
+        density_index_.insert(cloud->points[i]);
+    }
+  }
+
+  double search_radius = octree_->getResolution()/sqrt(2); //Encapsulates a voxel
+
   //=======
   // Clear old values around newly collected points
   //=======
@@ -1315,23 +2073,16 @@ void MappingModule::updateVoxelDensities(const PointCloudXYZ::Ptr& cloud)
     if( !octree_->coordToKeyChecked(p.x, p.y, p.z, key) )
       continue;
 
-    it = voxel_densities_.find(key);
-    if (it != voxel_densities_.end())
+    VoxelDensity* v = voxel_densities_.find(key);
+    if (v)
     {
       // Key found, clear it
-      it->second.count = 0;
-      it->second.total = 0;
-      it->second.density = -1;
+      v->count = 0;
+      v->total = 0;
+      v->density = -1;
     }
   }
 
-  // ============
-  // Create KD tree to find nearest neighbors
-  // ============
-  pcl::KdTreeFLANN<PointXYZ> kdtree;
-  kdtree.setInputCloud (cloud_ptr_rgbd_);
-  double search_radius = octree_->getResolution()/sqrt(2); //Encapsulates a voxel
-
   // ============
   // Update voxel densities obtained from camera reading
   // ============
@@ -1342,30 +2093,153 @@ void MappingModule::updateVoxelDensities(const PointCloudXYZ::Ptr& cloud)
     if( !octree_->coordToKeyChecked(p.x, p.y, p.z, key) )
       continue;
 
-    std::vector<int> pointIndicesOut;
-    std::vector<float> pointRadiusSquaredDistance;
-    kdtree.radiusSearch(p, search_radius, pointIndicesOut, pointRadiusSquaredDistance);
+    int neighbor_count = density_index_.radiusCount(p, search_radius);
 
-    // Get iterator for desired key
-    it = voxel_densities_.find(key);
-    if (it != voxel_densities_.end())
+    // Get entry for desired key
+    VoxelDensity* v = voxel_densities_.find(key);
+    if (v)
     {
       // Key found, increment it it
-      it->second.count++;
-      it->second.total += pointIndicesOut.size();
-      it->second.density = double(it->second.total)/it->second.count;
+      v->count++;
+      v->total += neighbor_count;
+      v->density = double(v->total)/v->count;
     }
     else
     {
       // Key not found, initialize it
-      VoxelDensity v;
-      v.count = 1;
-      v.total = pointIndicesOut.size();
-      v.density = double(v.total)/v.count;
+      VoxelDensity v_new;
+      v_new.count = 1;
+      v_new.total = neighbor_count;
+      v_new.density = double(v_new.total)/v_new.count;
 
-      voxel_densities_.insert(std::make_pair(key, v));
+      voxel_densities_.insert(key, v_new);
     }
   }
+
+  // ============
+  // Only the voxels of the new points can enter or leave the low density set
+  // ============
+  mutex_frontiers.lock();
+  for (int i=0; i<cloud->points.size(); i++)
+  {
+    PointXYZ p = cloud->points[i];
+    if( !octree_->coordToKeyChecked(p.x, p.y, p.z, key) )
+      continue;
+
+    VoxelDensity* v = voxel_densities_.find(key);
+    if (v && v->density > 0 && v->density < low_density_threshold_)
+      low_density_cells_.insert(key);
+    else
+      low_density_cells_.erase(key);
+  }
+  mutex_frontiers.unlock();
+
+  map_version_++;
+  timer.stop("[MappingModule]updateVoxelDensities");
+}
+
+void MappingModule::rebuildFrontierCells()
+{
+  // Every unknown voxel is a candidate. Inside a pruned leaf all neighbors are unknown,
+  // so only the voxels on the faces of its block are candidates
+  frontier_candidate_keys_.clear();
+
+  int max_depth = octree_->getTreeDepth();
+  for (octomap::OcTree::leaf_iterator it = octree_->begin_leafs(), end = octree_->end_leafs(); it != end; ++it)
+  {
+    if (!isNodeUnknown(*it))
+      continue;
+
+    octomap::OcTreeKey key_min = it.getIndexKey();
+    int side = 1 << (max_depth - it.getDepth());
+
+    octomap::OcTreeKey key;
+    for (int x=0; x<side; x++)
+    {
+      key[0] = key_min[0] + x;
+      for (int y=0; y<side; y++)
+      {
+        key[1] = key_min[1] + y;
+
+        // Away from the x and y faces, only the two z faces are on the boundary
+        bool is_on_face = (x == 0 || x == side-1 || y == 0 || y == side-1);
+        int z_step = is_on_face ? 1 : std::max(1, side-1);
+
+        for (int z=0; z<side; z+=z_step)
+        {
+          key[2] = key_min[2] + z;
+          frontier_candidate_keys_.push_back(key);
+        }
+      }
+    }
+  }
+
+  evaluateFrontierCandidates(true);
+}
+
+void MappingModule::updateFrontierCells(const std::vector<VoxelChange>& changes)
+{
+  // Frontiers only look at the class of each voxel, so only voxels that changed class
+  // can change the status of themselves and their neighbors
+  frontier_candidates_.clear();
+  for (size_t i=0; i<changes.size(); i++)
+  {
+    if (getVoxelClass(changes[i].log_odds_old) == getVoxelClass(changes[i].log_odds_new))
+      continue;
+
+    const octomap::OcTreeKey& key = changes[i].key;
+    octomap::OcTreeKey n_key;
+    for (int dx=-1; dx<=1; dx++)
+    {
+      for (int dy=-1; dy<=1; dy++)
+      {
+        for (int dz=-1; dz<=1; dz++)
+        {
+          int c[3] = {key[0]+dx, key[1]+dy, key[2]+dz};
+          if (c[0] < 0 || c[0] > 65535 || c[1] < 0 || c[1] > 65535 || c[2] < 0 || c[2] > 65535)
+            continue;
+
+          n_key[0] = c[0]; n_key[1] = c[1]; n_key[2] = c[2];
+          frontier_candidates_.insert(n_key);
+        }
+      }
+    }
+  }
+
+  if (frontier_candidates_.empty())
+    return;
+
+  frontier_candidate_keys_.clear();
+  for (VoxelHashSet::iterator it = frontier_candidates_.begin(); it != frontier_candidates_.end(); ++it)
+    frontier_candidate_keys_.push_back(*it);
+
+  evaluateFrontierCandidates(false);
+}
+
+void MappingModule::resetAccumulatorFromPointCloud()
+{
+  // cloud_ptr_rgbd_ was replaced wholesale (profile or saved map), seed the accumulator with it
+  mutex_rgbd.lock();
+  rgbd_accumulator_.clear();
+  rgbd_accumulator_.addPointCloud(*cloud_ptr_rgbd_);
+  is_rgbd_cloud_outdated_ = true;
+  mutex_rgbd.unlock();
+
+  density_index_.clear();
+}
+
+void MappingModule::rebuildDensityIndex()
+{
+  // Bucket size matches the density search radius, so each query visits at most 27 buckets
+  density_index_.setResolution(octree_->getResolution()/sqrt(2), depth_grid_res_);
+
+  // Same filter as the points added incrementally in updateVoxelDensities()
+  PointCloudXYZ::Ptr cloud_rgbd = getPointCloud();
+  for (int i=0; i<cloud_rgbd->points.size(); i++)
+  {
+    if (cloud_rgbd->points[i].z >= sensor_data_min_height_)
+      density_index_.insert(cloud_rgbd->points[i]);
+  }
 }
 
 void MappingModule::updateVoxelNormals()
@@ -1375,7 +2249,8 @@ void MappingModule::updateVoxelNormals()
   //=======
   voxel_normals_.clear(); // Clear old densities
 
-  if(cloud_ptr_rgbd_->points.size()<=0)
+  PointCloudXYZ::Ptr cloud_rgbd = getPointCloud();
+  if(cloud_rgbd->points.size()<=0)
     return;
 
   // ============
@@ -1386,7 +2261,7 @@ void MappingModule::updateVoxelNormals()
   pcl::NormalEstimation<PointXYZ, PointN> norm_est;
 
   norm_est.setSearchMethod (tree);
-  norm_est.setInputCloud (cloud_ptr_rgbd_);
+  norm_est.setInputCloud (cloud_rgbd);
   norm_est.setKSearch (20);
   norm_est.compute (*cloud_normals);
 
@@ -1396,7 +2271,7 @@ void MappingModule::updateVoxelNormals()
   for (int i=0; i<cloud_normals->points.size(); i++)
   {
     PointN p = cloud_normals->points[i];
-    PointXYZ p2 = cloud_ptr_rgbd_->points[i];
+    PointXYZ p2 = cloud_rgbd->points[i];
 
     octomap::OcTreeKey key;
     if( !octree_->coordToKeyChecked(p2.x, p2.y, p2.z, key) )
@@ -1431,28 +2306,26 @@ void MappingModule::updateVoxelNormals()
     else
       h.histogram[1] = 1;
 
-    // Get iterator for desired key
-    std::map<octomap::OcTreeKey, NormalHistogram>::iterator it;
-    it = voxel_normals_.find(key);
-    if (it != voxel_normals_.end())
+    // Get entry for desired key
+    NormalHistogram* histo = voxel_normals_.find(key);
+    if (histo)
     {
       // Key found, increment it
-      it->second += h;
+      *histo += h;
     }
     else
     {
       // Key not found, insert it
-      voxel_normals_.insert(std::make_pair(key, h));
+      voxel_normals_.insert(key, h);
     }
   }
 }
 
 NormalHistogram MappingModule::getNormalHistogramAtOcTreeKey(octomap::OcTreeKey key)
 {
-  std::map<octomap::OcTreeKey, NormalHistogram>::iterator it;
-  it = voxel_normals_.find(key);
+  NormalHistogram* histo = voxel_normals_.find(key);
 
-  if (it == voxel_normals_.end())
+  if (!histo)
   {
     // Key not found, display error
     //printf("[ViewSelecterBase]: Invalid key, no point count retrieved\n");
@@ -1461,5 +2334,5 @@ NormalHistogram MappingModule::getNormalHistogramAtOcTreeKey(octomap::OcTreeKey
     return invalid_histo;
   }
 
-  return it->second;
+  return *histo;
 }
@@ -297,6 +297,8 @@ void NBVLoop::initVehicle()
     break;
   }
 
+  vehicle_->setDistanceField(mapping_module_->getEsdf());
+
   // Set starting position
   ros::Duration(2.0).sleep();
 
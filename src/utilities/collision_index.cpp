@@ -0,0 +1,155 @@
+#include "utilities/collision_index.h"
+
+
+CollisionIndex::CollisionIndex():
+  cell_size_(1.0),
+  resolution_(0.1),
+  size_(0)
+{
+}
+
+void CollisionIndex::clear()
+{
+  cells_.clear();
+  size_ = 0;
+}
+
+bool CollisionIndex::erase(const octomap::OcTreeKey& key)
+{
+  octomap::OcTreeKey cell_key;
+  if (!getCellKey(key, cell_key))
+    return false;
+
+  std::vector<octomap::OcTreeKey>* cell = cells_.find(cell_key);
+  if (!cell)
+    return false;
+
+  for (size_t i=0; i<cell->size(); i++)
+  {
+    if ((*cell)[i] != key)
+      continue;
+
+    (*cell)[i] = cell->back();
+    cell->pop_back();
+    size_--;
+
+    // Release the cell, so memory follows the occupied voxels
+    if (cell->empty())
+      cells_.erase(cell_key);
+
+    return true;
+  }
+
+  return false;
+}
+
+bool CollisionIndex::insert(const octomap::OcTreeKey& key)
+{
+  octomap::OcTreeKey cell_key;
+  if (!getCellKey(key, cell_key))
+    return false;
+
+  std::vector<octomap::OcTreeKey>& cell = cells_[cell_key];
+  for (size_t i=0; i<cell.size(); i++)
+  {
+    if (cell[i] == key)
+      return false;
+  }
+
+  cell.push_back(key);
+  size_++;
+  return true;
+}
+
+bool CollisionIndex::isSphereColliding(const octomap::point3d& center, double radius) const
+{
+  // Voxels are bucketed by center, so the search is grown by half a voxel
+  double reach = radius + resolution_/2;
+
+  octomap::OcTreeKey key_min, key_max;
+  if (!voxel_hash::coordToKey(center.x()-reach, center.y()-reach, center.z()-reach, cell_size_, key_min) ||
+      !voxel_hash::coordToKey(center.x()+reach, center.y()+reach, center.z()+reach, cell_size_, key_max))
+    return false;
+
+  double r_sq = radius*radius;
+  double half = resolution_/2;
+
+  octomap::OcTreeKey key;
+  for (int x=key_min[0]; x<=key_max[0]; x++)
+  {
+    key[0] = x;
+    for (int y=key_min[1]; y<=key_max[1]; y++)
+    {
+      key[1] = y;
+      for (int z=key_min[2]; z<=key_max[2]; z++)
+      {
+        key[2] = z;
+
+        const std::vector<octomap::OcTreeKey>* cell = cells_.find(key);
+        if (!cell)
+          continue;
+
+        for (size_t i=0; i<cell->size(); i++)
+        {
+          octomap::point3d voxel = keyToCoord((*cell)[i]);
+
+          // Squared distance from the center to the closest point of the voxel
+          double d_sq = 0;
+          for (int k=0; k<3; k++)
+          {
+            double d = fabs(center(k) - voxel(k)) - half;
+            if (d > 0)
+              d_sq += d*d;
+          }
+
+          if (d_sq <= r_sq)
+            return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+void CollisionIndex::setCellSize(double cell_size)
+{
+  if (cell_size <= 0 || cell_size == cell_size_)
+    return;
+
+  cell_size_ = cell_size;
+
+  // Voxels are kept, only their buckets change
+  std::vector<octomap::OcTreeKey> keys;
+  keys.reserve(size_);
+  for (VoxelHashMap<std::vector<octomap::OcTreeKey> >::iterator it = cells_.begin(); it != cells_.end(); ++it)
+    keys.insert(keys.end(), it.value().begin(), it.value().end());
+
+  clear();
+  for (size_t i=0; i<keys.size(); i++)
+    insert(keys[i]);
+}
+
+void CollisionIndex::setResolution(double resolution)
+{
+  if (resolution <= 0 || resolution == resolution_)
+    return;
+
+  resolution_ = resolution;
+  clear();
+}
+
+bool CollisionIndex::getCellKey(const octomap::OcTreeKey& key, octomap::OcTreeKey& cell_key) const
+{
+  octomap::point3d p = keyToCoord(key);
+  return voxel_hash::coordToKey(p.x(), p.y(), p.z(), cell_size_, cell_key);
+}
+
+octomap::point3d CollisionIndex::keyToCoord(const octomap::OcTreeKey& key) const
+{
+  // Same layout as octomap keys at the finest depth
+  return octomap::point3d(
+        ((int)key[0] - 32768 + 0.5)*resolution_,
+        ((int)key[1] - 32768 + 0.5)*resolution_,
+        ((int)key[2] - 32768 + 0.5)*resolution_);
+}
@@ -0,0 +1,283 @@
+#include "utilities/dense_voxel_grid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+const int8_t DenseVoxelGrid::UNKNOWN;
+
+DenseVoxelGrid::DenseVoxelGrid():
+  tree_(NULL),
+  scale_(1),
+  clamp_min_(0),
+  clamp_max_(0),
+  clamp_min_code_(-127),
+  clamp_max_code_(127)
+{
+  size_[0] = size_[1] = size_[2] = 0;
+}
+
+void DenseVoxelGrid::build(octomap::OcTree* tree, const octomap::point3d& min, const octomap::point3d& max)
+{
+  tree_ = tree;
+
+  if (!tree_->coordToKeyChecked(min, min_key_) || !tree_->coordToKeyChecked(max, max_key_))
+  {
+    clear();
+    return;
+  }
+
+  for (int i=0; i<3; i++)
+  {
+    if (max_key_[i] < min_key_[i])
+    {
+      clear();
+      return;
+    }
+    size_[i] = max_key_[i] - min_key_[i] + 1;
+  }
+
+  computeTables();
+  codes_.assign(size_[0]*size_[1]*size_[2], UNKNOWN);
+
+  if (!tree_->getRoot())
+    return;
+
+  // == Split the top of the tree until there are enough subtrees to share between threads
+  int num_threads = 1;
+  #ifdef _OPENMP
+  num_threads = omp_get_max_threads();
+  #endif
+
+  std::vector<Block> blocks, children;
+  Block root;
+  root.node = tree_->getRoot();
+  root.base[0] = root.base[1] = root.base[2] = 0;
+  root.level = tree_->getTreeDepth();
+  blocks.push_back(root);
+
+  while (!blocks.empty() && (int)blocks.size() < 8*num_threads && blocks[0].level > 0)
+  {
+    children.clear();
+    for (int i=0; i<(int)blocks.size(); i++)
+      expandBlock(blocks[i], children);
+    blocks.swap(children);
+  }
+
+  // == Subtrees cover disjoint voxels, fill them concurrently
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for (int i=0; i<(int)blocks.size(); i++)
+  {
+    std::vector<Block> stack(1, blocks[i]);
+    std::vector<Block> next;
+
+    while (!stack.empty())
+    {
+      Block b = stack.back();
+      stack.pop_back();
+
+      next.clear();
+      expandBlock(b, next);
+      stack.insert(stack.end(), next.begin(), next.end());
+    }
+  }
+}
+
+void DenseVoxelGrid::clear()
+{
+  codes_.clear();
+  size_[0] = size_[1] = size_[2] = 0;
+}
+
+bool DenseVoxelGrid::isSnapshotOf(const octomap::OcTree* tree, const octomap::point3d& min, const octomap::point3d& max) const
+{
+  if (codes_.empty() || tree != tree_)
+    return false;
+
+  octomap::OcTreeKey min_key, max_key;
+  if (!tree->coordToKeyChecked(min, min_key) || !tree->coordToKeyChecked(max, max_key))
+    return false;
+
+  return min_key == min_key_ && max_key == max_key_;
+}
+
+double DenseVoxelGrid::applyChange(const octomap::OcTreeKey& key, float log_odds, bool ignore_clamping)
+{
+  if (!contains(key))
+    return 0;
+
+  int8_t& code = codes_[getIndex(key)];
+  int8_t code_new = toCode(log_odds);
+
+  double delta = getEntropy(code_new, ignore_clamping) - getEntropy(code, ignore_clamping);
+  code = code_new;
+
+  return delta;
+}
+
+double DenseVoxelGrid::getEntropySum(bool ignore_clamping) const
+{
+  // Histogram of codes, then one table lookup per code
+  std::vector<long> histogram(256, 0);
+
+  #ifdef _OPENMP
+  #pragma omp parallel
+  #endif
+  {
+    std::vector<long> histogram_thread(256, 0);
+
+    #ifdef _OPENMP
+    #pragma omp for schedule(static)
+    #endif
+    for (long i=0; i<(long)codes_.size(); i++)
+      histogram_thread[codes_[i]+128]++;
+
+    #ifdef _OPENMP
+    #pragma omp critical
+    #endif
+    for (int c=0; c<256; c++)
+      histogram[c] += histogram_thread[c];
+  }
+
+  double sum = 0;
+  for (int c=0; c<256; c++)
+  {
+    if (histogram[c] > 0)
+      sum += histogram[c]*getEntropy(c-128, ignore_clamping);
+  }
+
+  return sum;
+}
+
+void DenseVoxelGrid::getKeysAbove(float log_odds, std::vector<octomap::OcTreeKey>& keys) const
+{
+  keys.clear();
+
+  bool is_above[256];
+  for (int c=0; c<256; c++)
+    is_above[c] = (c-128 != UNKNOWN && getLogOdds(c-128) >= log_odds);
+
+  size_t i = 0;
+  octomap::OcTreeKey key;
+  for (size_t x=0; x<size_[0]; x++)
+  {
+    key[0] = min_key_[0] + x;
+    for (size_t y=0; y<size_[1]; y++)
+    {
+      key[1] = min_key_[1] + y;
+      for (size_t z=0; z<size_[2]; z++, i++)
+      {
+        if (is_above[codes_[i]+128])
+        {
+          key[2] = min_key_[2] + z;
+          keys.push_back(key);
+        }
+      }
+    }
+  }
+}
+
+int8_t DenseVoxelGrid::toCode(float log_odds) const
+{
+  float c = round(log_odds/scale_);
+  if (c > 127)  c = 127;
+  if (c < -127) c = -127;
+
+  // Only clamped values get the clamping codes, so rounding never changes a clamping check
+  if (log_odds <= clamp_min_)
+    return std::min<int8_t>(c, clamp_min_code_);
+  if (log_odds >= clamp_max_)
+    return std::max<int8_t>(c, clamp_max_code_);
+
+  return std::max<int8_t>(std::min<int8_t>(c, clamp_max_code_-1), clamp_min_code_+1);
+}
+
+void DenseVoxelGrid::computeTables()
+{
+  clamp_min_ = tree_->getClampingThresMinLog();
+  clamp_max_ = tree_->getClampingThresMaxLog();
+
+  scale_ = std::max(fabs(clamp_min_), fabs(clamp_max_))/127;
+  if (scale_ <= 0)
+    scale_ = 1;
+
+  clamp_min_code_ = std::max(-127.0f, std::min(127.0f, roundf(clamp_min_/scale_)));
+  clamp_max_code_ = std::max(-127.0f, std::min(127.0f, roundf(clamp_max_/scale_)));
+
+  for (int c=-128; c<128; c++)
+  {
+    // Unknown voxels count as p = 0.5
+    double p = 0.5;
+    if (c != UNKNOWN)
+      p = 1.0 - 1.0/(1.0 + exp(c*scale_));
+
+    occupancy_[c+128] = p;
+    entropy_[c+128] = - p*log(p) - (1-p)*log(1-p);
+
+    if (c != UNKNOWN && (c <= clamp_min_code_ || c >= clamp_max_code_))
+      entropy_unclamped_[c+128] = 0;
+    else
+      entropy_unclamped_[c+128] = entropy_[c+128];
+  }
+}
+
+void DenseVoxelGrid::expandBlock(const Block& b, std::vector<Block>& children)
+{
+  // Skip blocks outside the box
+  unsigned int extent = 1u << b.level;
+  for (int i=0; i<3; i++)
+  {
+    if (b.base[i] > max_key_[i] || b.base[i] + extent - 1 < min_key_[i])
+      return;
+  }
+
+  // Leaf (possibly pruned) covering the whole block
+  if (b.level == 0 || !tree_->nodeHasChildren(b.node))
+  {
+    fillBlock(b, toCode(b.node->getLogOdds()));
+    return;
+  }
+
+  // Same child order as octomap::computeChildIdx(): bit 0 is x, bit 1 is y, bit 2 is z
+  unsigned int half = extent >> 1;
+  for (unsigned int idx=0; idx<8; idx++)
+  {
+    if (!tree_->nodeChildExists(b.node, idx))
+      continue;
+
+    Block child;
+    child.node = tree_->getNodeChild(b.node, idx);
+    child.level = b.level - 1;
+    for (int i=0; i<3; i++)
+      child.base[i] = b.base[i] + ((idx & (1u << i)) ? half : 0);
+
+    children.push_back(child);
+  }
+}
+
+void DenseVoxelGrid::fillBlock(const Block& b, int8_t code)
+{
+  unsigned int extent = 1u << b.level;
+  unsigned int lo[3], hi[3];
+  for (int i=0; i<3; i++)
+  {
+    lo[i] = std::max<unsigned int>(b.base[i], min_key_[i]) - min_key_[i];
+    hi[i] = std::min<unsigned int>(b.base[i] + extent - 1, max_key_[i]) - min_key_[i];
+  }
+
+  for (unsigned int x=lo[0]; x<=hi[0]; x++)
+  {
+    for (unsigned int y=lo[1]; y<=hi[1]; y++)
+    {
+      size_t row = ((size_t)x*size_[1] + y)*size_[2];
+      memset(&codes_[row + lo[2]], code, hi[2] - lo[2] + 1);
+    }
+  }
+}
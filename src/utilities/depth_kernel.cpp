@@ -0,0 +1,237 @@
+#include "utilities/depth_kernel.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEPTH_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+
+DepthKernel::DepthKernel():
+  backend_(AUTO),
+  count_(0)
+{
+}
+
+void DepthKernel::load(const uint8_t* data, int width, int height, size_t point_step, size_t row_step,
+                       int offset_x, int offset_y, int offset_z)
+{
+  count_ = width*height;
+
+  in_x_.resize(count_);
+  in_y_.resize(count_);
+  in_z_.resize(count_);
+  out_x_.resize(count_);
+  out_y_.resize(count_);
+  out_z_.resize(count_);
+  is_near_.resize(count_);
+
+  for (int row=0; row<height; row++)
+  {
+    const uint8_t* point_data = data + row*row_step;
+    int i = row*width;
+
+    for (int col=0; col<width; col++, i++, point_data += point_step)
+    {
+      memcpy(&in_x_[i], point_data + offset_x, sizeof(float));
+      memcpy(&in_y_[i], point_data + offset_y, sizeof(float));
+      memcpy(&in_z_[i], point_data + offset_z, sizeof(float));
+    }
+  }
+}
+
+void DepthKernel::run(const Eigen::Matrix4d& transform, float max_depth)
+{
+  if (count_ == 0)
+    return;
+
+  // Row major 3x4
+  float m[12];
+  for (int r=0; r<3; r++)
+    for (int c=0; c<4; c++)
+      m[r*4 + c] = transform(r,c);
+
+  // Points without a table entry are left uncorrected
+  if ((int)max_x_.size() < count_)
+  {
+    max_x_.resize(count_, NAN);
+    max_y_.resize(count_, NAN);
+    max_z_.resize(count_, NAN);
+  }
+
+  switch (getBackend())
+  {
+  case AVX2:
+    runAVX2(m, max_depth, 0, count_);
+    break;
+  case SSE2:
+    runSSE2(m, max_depth, 0, count_);
+    break;
+  default:
+    runScalar(m, max_depth, 0, count_);
+    break;
+  }
+}
+
+void DepthKernel::runScalar(const float* m, float max_depth, int start, int end)
+{
+  for (int i=start; i<end; i++)
+  {
+    float x = in_x_[i];
+    float y = in_y_[i];
+    float z = in_z_[i];
+
+    if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+    {
+      x = max_x_[i];
+      y = max_y_[i];
+      z = max_z_[i];
+    }
+
+    // Same association as the vector paths, so all backends agree bit for bit
+    out_x_[i] = (m[0]*x + m[1]*y) + (m[2] *z + m[3]);
+    out_y_[i] = (m[4]*x + m[5]*y) + (m[6] *z + m[7]);
+    out_z_[i] = (m[8]*x + m[9]*y) + (m[10]*z + m[11]);
+    is_near_[i] = (z <= max_depth);
+  }
+}
+
+#ifdef DEPTH_KERNEL_X86
+void DepthKernel::runSSE2(const float* m, float max_depth, int start, int end)
+{
+  __m128 zero = _mm_setzero_ps();
+  __m128 depth = _mm_set1_ps(max_depth);
+  __m128 mm[12];
+  for (int k=0; k<12; k++)
+    mm[k] = _mm_set1_ps(m[k]);
+
+  int i = start;
+  for (; i+4<=end; i+=4)
+  {
+    __m128 x = _mm_loadu_ps(&in_x_[i]);
+    __m128 y = _mm_loadu_ps(&in_y_[i]);
+    __m128 z = _mm_loadu_ps(&in_z_[i]);
+
+    // v*0 is NaN for NaN and infinity, 0 otherwise
+    __m128 valid = _mm_and_ps(_mm_cmpeq_ps(_mm_mul_ps(x, zero), zero),
+                   _mm_and_ps(_mm_cmpeq_ps(_mm_mul_ps(y, zero), zero),
+                              _mm_cmpeq_ps(_mm_mul_ps(z, zero), zero)));
+
+    x = _mm_or_ps(_mm_and_ps(valid, x), _mm_andnot_ps(valid, _mm_loadu_ps(&max_x_[i])));
+    y = _mm_or_ps(_mm_and_ps(valid, y), _mm_andnot_ps(valid, _mm_loadu_ps(&max_y_[i])));
+    z = _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, _mm_loadu_ps(&max_z_[i])));
+
+    __m128 wx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mm[0], x), _mm_mul_ps(mm[1], y)), _mm_add_ps(_mm_mul_ps(mm[2], z),  mm[3]));
+    __m128 wy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mm[4], x), _mm_mul_ps(mm[5], y)), _mm_add_ps(_mm_mul_ps(mm[6], z),  mm[7]));
+    __m128 wz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mm[8], x), _mm_mul_ps(mm[9], y)), _mm_add_ps(_mm_mul_ps(mm[10], z), mm[11]));
+
+    _mm_storeu_ps(&out_x_[i], wx);
+    _mm_storeu_ps(&out_y_[i], wy);
+    _mm_storeu_ps(&out_z_[i], wz);
+
+    int near = _mm_movemask_ps(_mm_cmple_ps(z, depth));
+    for (int k=0; k<4; k++)
+      is_near_[i+k] = (near >> k) & 1;
+  }
+
+  runScalar(m, max_depth, i, end);
+}
+
+__attribute__((target("avx2")))
+void DepthKernel::runAVX2(const float* m, float max_depth, int start, int end)
+{
+  __m256 zero = _mm256_setzero_ps();
+  __m256 depth = _mm256_set1_ps(max_depth);
+  __m256 mm[12];
+  for (int k=0; k<12; k++)
+    mm[k] = _mm256_set1_ps(m[k]);
+
+  int i = start;
+  for (; i+8<=end; i+=8)
+  {
+    __m256 x = _mm256_loadu_ps(&in_x_[i]);
+    __m256 y = _mm256_loadu_ps(&in_y_[i]);
+    __m256 z = _mm256_loadu_ps(&in_z_[i]);
+
+    // v*0 is NaN for NaN and infinity, 0 otherwise
+    __m256 valid = _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(x, zero), zero, _CMP_EQ_OQ),
+                   _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(y, zero), zero, _CMP_EQ_OQ),
+                                 _mm256_cmp_ps(_mm256_mul_ps(z, zero), zero, _CMP_EQ_OQ)));
+
+    x = _mm256_blendv_ps(_mm256_loadu_ps(&max_x_[i]), x, valid);
+    y = _mm256_blendv_ps(_mm256_loadu_ps(&max_y_[i]), y, valid);
+    z = _mm256_blendv_ps(_mm256_loadu_ps(&max_z_[i]), z, valid);
+
+    __m256 wx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mm[0], x), _mm256_mul_ps(mm[1], y)), _mm256_add_ps(_mm256_mul_ps(mm[2], z),  mm[3]));
+    __m256 wy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mm[4], x), _mm256_mul_ps(mm[5], y)), _mm256_add_ps(_mm256_mul_ps(mm[6], z),  mm[7]));
+    __m256 wz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mm[8], x), _mm256_mul_ps(mm[9], y)), _mm256_add_ps(_mm256_mul_ps(mm[10], z), mm[11]));
+
+    _mm256_storeu_ps(&out_x_[i], wx);
+    _mm256_storeu_ps(&out_y_[i], wy);
+    _mm256_storeu_ps(&out_z_[i], wz);
+
+    int near = _mm256_movemask_ps(_mm256_cmp_ps(z, depth, _CMP_LE_OQ));
+    for (int k=0; k<8; k++)
+      is_near_[i+k] = (near >> k) & 1;
+  }
+
+  runScalar(m, max_depth, i, end);
+}
+
+bool DepthKernel::isAVX2Supported()
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+#else
+void DepthKernel::runSSE2(const float* m, float max_depth, int start, int end)
+{
+  runScalar(m, max_depth, start, end);
+}
+
+void DepthKernel::runAVX2(const float* m, float max_depth, int start, int end)
+{
+  runScalar(m, max_depth, start, end);
+}
+
+bool DepthKernel::isAVX2Supported()
+{
+  return false;
+}
+#endif
+
+void DepthKernel::setBackend(Backend b)
+{
+  backend_ = b;
+}
+
+DepthKernel::Backend DepthKernel::getBackend()
+{
+  if (backend_ == AVX2 && !isAVX2Supported())
+    return SSE2;
+
+  if (backend_ != AUTO)
+    return backend_;
+
+  #ifdef DEPTH_KERNEL_X86
+  return isAVX2Supported() ? AVX2 : SSE2;
+  #else
+  return SCALAR;
+  #endif
+}
+
+void DepthKernel::setMaxRangeTable(const pcl::PointXYZ* table, int count)
+{
+  max_x_.resize(count);
+  max_y_.resize(count);
+  max_z_.resize(count);
+
+  for (int i=0; i<count; i++)
+  {
+    max_x_[i] = table[i].x;
+    max_y_[i] = table[i].y;
+    max_z_[i] = table[i].z;
+  }
+}
@@ -0,0 +1,156 @@
+#include "utilities/depth_rasterizer.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+
+DepthRasterizer::DepthRasterizer():
+  width_(0),
+  height_(0),
+  min_h_(0),
+  min_v_(0),
+  step_(1)
+{
+}
+
+void DepthRasterizer::setCamera(int width, int height, float min_h, float min_v, float step)
+{
+  width_  = width;
+  height_ = height;
+  min_h_  = min_h;
+  min_v_  = min_v;
+  step_   = step;
+}
+
+void DepthRasterizer::render(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& origin,
+                             const float* x, const float* y, const float* z, int count,
+                             float half_size, float max_depth)
+{
+  int pixels = width_*height_;
+  depth_.assign(pixels, std::numeric_limits<float>::infinity());
+  voxel_.assign(pixels, -1);
+
+  if (count <= 0 || pixels <= 0)
+    return;
+
+  // == Pixel rays in the world frame
+  inv_x_.resize(pixels);
+  inv_y_.resize(pixels);
+  inv_z_.resize(pixels);
+  range_sq_.resize(pixels);
+
+  for (int i=0; i<width_; i++)
+  {
+    for (int j=0; j<height_; j++)
+    {
+      Eigen::Vector3d ray (1, min_h_ + i*step_, min_v_ + j*step_);
+      double length = ray.norm();
+      Eigen::Vector3d dir = rotation*ray/length;
+
+      // Axis parallel rays get a huge inverse instead of infinity, so the slab test never sees 0*inf
+      int p = i*height_ + j;
+      inv_x_[p] = (dir[0] != 0) ? 1/dir[0] : 1e30;
+      inv_y_[p] = (dir[1] != 0) ? 1/dir[1] : 1e30;
+      inv_z_[p] = (dir[2] != 0) ? 1/dir[2] : 1e30;
+      range_sq_[p] = max_depth*max_depth*length*length;
+    }
+  }
+
+  // == Transform to the camera frame, q = R^T (p - origin)
+  cam_f_.resize(count);
+  cam_h_.resize(count);
+  cam_v_.resize(count);
+
+  float r[9];
+  for (int row=0; row<3; row++)
+    for (int col=0; col<3; col++)
+      r[row*3 + col] = rotation(col, row);
+
+  float ox = origin[0], oy = origin[1], oz = origin[2];
+  float* f = &cam_f_[0];
+  float* h = &cam_h_[0];
+  float* v = &cam_v_[0];
+
+  for (int i=0; i<count; i++)
+  {
+    float dx = x[i] - ox;
+    float dy = y[i] - oy;
+    float dz = z[i] - oz;
+
+    f[i] = r[0]*dx + r[1]*dy + r[2]*dz;
+    h[i] = r[3]*dx + r[4]*dy + r[5]*dz;
+    v[i] = r[6]*dx + r[7]*dy + r[8]*dz;
+  }
+
+  // == Draw, nearest box entry wins
+  // A cube spans at most its half diagonal around its center along any camera axis
+  float radius = half_size*sqrtf(3.0f);
+  float inv_step = 1.0f/step_;
+  float max_range_sq = range_sq_[0];
+  for (int p=1; p<pixels; p++)
+    max_range_sq = std::max(max_range_sq, range_sq_[p]);
+
+  for (int i=0; i<count; i++)
+  {
+    float fi = f[i], hi = h[i], vi = v[i];
+    float dist_sq = fi*fi + hi*hi + vi*vi;
+
+    if (fi + radius <= 0 || dist_sq > max_range_sq)
+      continue;
+
+    // Pixels whose slopes can reach the voxel, all of them when it surrounds the camera plane
+    int i0 = 0, i1 = width_-1;
+    int j0 = 0, j1 = height_-1;
+
+    if (fi - radius > 0)
+    {
+      float near = 1.0f/(fi - radius);
+      float far  = 1.0f/(fi + radius);
+
+      float h_min = std::min((hi - radius)*near, (hi - radius)*far);
+      float h_max = std::max((hi + radius)*near, (hi + radius)*far);
+      float v_min = std::min((vi - radius)*near, (vi - radius)*far);
+      float v_max = std::max((vi + radius)*near, (vi + radius)*far);
+
+      i0 = std::max(i0, (int)ceilf((h_min - min_h_)*inv_step));
+      i1 = std::min(i1, (int)floorf((h_max - min_h_)*inv_step));
+      j0 = std::max(j0, (int)ceilf((v_min - min_v_)*inv_step));
+      j1 = std::min(j1, (int)floorf((v_max - min_v_)*inv_step));
+    }
+
+    // Box relative to the origin
+    float lo_x = x[i] - ox - half_size, hi_x = x[i] - ox + half_size;
+    float lo_y = y[i] - oy - half_size, hi_y = y[i] - oy + half_size;
+    float lo_z = z[i] - oz - half_size, hi_z = z[i] - oz + half_size;
+
+    for (int pi=i0; pi<=i1; pi++)
+    {
+      for (int pj=j0; pj<=j1; pj++)
+      {
+        int p = pi*height_ + pj;
+        if (dist_sq > range_sq_[p])
+          continue;
+
+        // Slab test
+        float tx0 = lo_x*inv_x_[p], tx1 = hi_x*inv_x_[p];
+        float ty0 = lo_y*inv_y_[p], ty1 = hi_y*inv_y_[p];
+        float tz0 = lo_z*inv_z_[p], tz1 = hi_z*inv_z_[p];
+
+        float t_enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+        float t_exit  = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+
+        if (t_enter > t_exit || t_exit < 0)
+          continue;
+
+        // The origin may lie within the voxel
+        t_enter = std::max(t_enter, 0.0f);
+        if (t_enter < depth_[p])
+        {
+          depth_[p] = t_enter;
+          voxel_[p] = i;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,309 @@
+#include "utilities/esdf_map.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "utilities/dense_voxel_grid.h"
+#include "utilities/voxel_hash.h"
+
+
+EsdfMap::EsdfMap():
+  resolution_(0),
+  max_distance_(0),
+  updated_cells_(0)
+{
+  for (int i=0; i<3; i++)
+  {
+    origin_key_[i] = 0;
+    size_[i] = 0;
+  }
+}
+
+void EsdfMap::reset(const octomap::point3d& min, const octomap::point3d& max, double resolution, double max_distance)
+{
+  resolution_ = resolution;
+  max_distance_ = max_distance;
+  box_min_ = min;
+  box_max_ = max;
+
+  octomap::OcTreeKey key_min, key_max;
+  if (resolution <= 0 ||
+      !voxel_hash::coordToKey(min.x(), min.y(), min.z(), resolution, key_min) ||
+      !voxel_hash::coordToKey(max.x(), max.y(), max.z(), resolution, key_max))
+  {
+    size_[0] = size_[1] = size_[2] = 0;
+  }
+  else
+  {
+    for (int i=0; i<3; i++)
+    {
+      origin_key_[i] = key_min[i];
+      size_[i] = std::max(0, (int)key_max[i] - (int)key_min[i] + 1);
+    }
+  }
+
+  size_t count = (size_t)size_[0]*size_[1]*size_[2];
+  distance_.assign(count, max_distance_);
+  obstacle_.assign(count, -1);
+  occupied_.assign(count, 0);
+
+  // Every cell starts in its own (empty) list
+  next_.resize(count);
+  prev_.resize(count);
+  for (size_t i=0; i<count; i++)
+    next_[i] = prev_[i] = i;
+
+  queue_lower_.clear();
+  queue_raise_.clear();
+}
+
+void EsdfMap::build(octomap::OcTree* tree, float occupied_log_odds)
+{
+  reset(box_min_, box_max_, resolution_, max_distance_);
+  if (!tree || distance_.empty())
+    return;
+
+  DenseVoxelGrid grid;
+  grid.build(tree, box_min_, box_max_);
+
+  std::vector<octomap::OcTreeKey> keys;
+  grid.getKeysAbove(occupied_log_odds, keys);
+
+  for (size_t i=0; i<keys.size(); i++)
+  {
+    int idx = getIndex(keys[i]);
+    if (idx >= 0)
+      setObstacle(idx, true);
+  }
+
+  propagate();
+}
+
+void EsdfMap::update(const std::vector<VoxelChange>& changes, float occupied_log_odds)
+{
+  if (distance_.empty())
+    return;
+
+  for (size_t i=0; i<changes.size(); i++)
+  {
+    int idx = getIndex(changes[i].key);
+    if (idx < 0)
+      continue;
+
+    // NaN (unknown) compares false, i.e. free
+    setObstacle(idx, changes[i].log_odds_new >= occupied_log_odds);
+  }
+
+  propagate();
+}
+
+bool EsdfMap::contains(const octomap::point3d& p) const
+{
+  return getIndex(p) >= 0;
+}
+
+double EsdfMap::getDistance(const octomap::point3d& p) const
+{
+  int idx = getIndex(p);
+  if (idx < 0)
+    return max_distance_;
+
+  return distance_[idx];
+}
+
+bool EsdfMap::getDistanceAndGradient(const octomap::point3d& p, double& distance, Eigen::Vector3d& gradient) const
+{
+  gradient.setZero();
+
+  int idx = getIndex(p);
+  if (idx < 0)
+  {
+    distance = max_distance_;
+    return false;
+  }
+
+  distance = distance_[idx];
+
+  int obstacle = obstacle_[idx];
+  if (obstacle < 0 || obstacle == idx)
+    return true;
+
+  int cell[3], obs[3];
+  getCell(idx, cell);
+  getCell(obstacle, obs);
+
+  for (int i=0; i<3; i++)
+    gradient[i] = cell[i] - obs[i];
+  gradient.normalize();
+
+  return true;
+}
+
+int EsdfMap::getIndex(const octomap::OcTreeKey& key) const
+{
+  int cell[3];
+  for (int i=0; i<3; i++)
+  {
+    cell[i] = (int)key[i] - origin_key_[i];
+    if (cell[i] < 0 || cell[i] >= size_[i])
+      return -1;
+  }
+
+  return (cell[0]*size_[1] + cell[1])*size_[2] + cell[2];
+}
+
+int EsdfMap::getIndex(const octomap::point3d& p) const
+{
+  octomap::OcTreeKey key;
+  if (distance_.empty() || !voxel_hash::coordToKey(p.x(), p.y(), p.z(), resolution_, key))
+    return -1;
+
+  return getIndex(key);
+}
+
+void EsdfMap::getCell(int idx, int* cell) const
+{
+  cell[2] = idx % size_[2];
+  idx /= size_[2];
+  cell[1] = idx % size_[1];
+  cell[0] = idx / size_[1];
+}
+
+void EsdfMap::link(int idx, int obstacle)
+{
+  next_[idx] = next_[obstacle];
+  prev_[idx] = obstacle;
+  prev_[next_[obstacle]] = idx;
+  next_[obstacle] = idx;
+}
+
+void EsdfMap::unlink(int idx)
+{
+  next_[prev_[idx]] = next_[idx];
+  prev_[next_[idx]] = prev_[idx];
+  next_[idx] = prev_[idx] = idx;
+}
+
+void EsdfMap::setObstacle(int idx, bool is_occupied)
+{
+  if (occupied_[idx] == is_occupied)
+    return;
+
+  occupied_[idx] = is_occupied;
+
+  if (is_occupied)
+  {
+    // The cell leaves the list of its previous nearest obstacle and heads its own
+    if (obstacle_[idx] >= 0)
+      unlink(idx);
+
+    distance_[idx] = 0;
+    obstacle_[idx] = idx;
+    queue_lower_.push_back(idx);
+    return;
+  }
+
+  // Every cell that had this obstacle as nearest is cleared, the list starts at the obstacle itself
+  int c = next_[idx];
+  while (c != idx)
+  {
+    int c_next = next_[c];
+
+    distance_[c] = max_distance_;
+    obstacle_[c] = -1;
+    next_[c] = prev_[c] = c;
+    queue_raise_.push_back(c);
+
+    c = c_next;
+  }
+
+  distance_[idx] = max_distance_;
+  obstacle_[idx] = -1;
+  next_[idx] = prev_[idx] = idx;
+  queue_raise_.push_back(idx);
+}
+
+void EsdfMap::propagate()
+{
+  int stride[3] = {size_[1]*size_[2], size_[2], 1};
+
+  // == Raise: cells bordering a cleared region propagate into it again
+  for (size_t q=0; q<queue_raise_.size(); q++)
+  {
+    int idx = queue_raise_[q];
+    int cell[3];
+    getCell(idx, cell);
+
+    for (int dx=-1; dx<=1; dx++)
+    {
+      if (cell[0]+dx < 0 || cell[0]+dx >= size_[0]) continue;
+      for (int dy=-1; dy<=1; dy++)
+      {
+        if (cell[1]+dy < 0 || cell[1]+dy >= size_[1]) continue;
+        for (int dz=-1; dz<=1; dz++)
+        {
+          if (cell[2]+dz < 0 || cell[2]+dz >= size_[2]) continue;
+
+          int n = idx + dx*stride[0] + dy*stride[1] + dz*stride[2];
+          if (obstacle_[n] >= 0)
+            queue_lower_.push_back(n);
+        }
+      }
+    }
+  }
+  queue_raise_.clear();
+
+  // == Lower: breadth first from each cell, offering its obstacle to the neighbors
+  double max_sq = (max_distance_/resolution_)*(max_distance_/resolution_);
+
+  for (size_t q=0; q<queue_lower_.size(); q++)
+  {
+    int idx = queue_lower_[q];
+    int obstacle = obstacle_[idx];
+    if (obstacle < 0 || !occupied_[obstacle])
+      continue;
+
+    int cell[3], obs[3];
+    getCell(idx, cell);
+    getCell(obstacle, obs);
+
+    for (int dx=-1; dx<=1; dx++)
+    {
+      if (cell[0]+dx < 0 || cell[0]+dx >= size_[0]) continue;
+      for (int dy=-1; dy<=1; dy++)
+      {
+        if (cell[1]+dy < 0 || cell[1]+dy >= size_[1]) continue;
+        for (int dz=-1; dz<=1; dz++)
+        {
+          if (cell[2]+dz < 0 || cell[2]+dz >= size_[2]) continue;
+
+          int n = idx + dx*stride[0] + dy*stride[1] + dz*stride[2];
+          if (occupied_[n])
+            continue;
+
+          int ex = cell[0]+dx - obs[0];
+          int ey = cell[1]+dy - obs[1];
+          int ez = cell[2]+dz - obs[2];
+          double d_sq = ex*ex + ey*ey + ez*ez;
+          if (d_sq >= max_sq)
+            continue;
+
+          // Compared as stored, so a cell is never lowered twice to the same value
+          float d = sqrt(d_sq)*resolution_;
+          if (d >= distance_[n])
+            continue;
+
+          if (obstacle_[n] >= 0)
+            unlink(n);
+          link(n, obstacle);
+
+          distance_[n] = d;
+          obstacle_[n] = obstacle;
+          queue_lower_.push_back(n);
+          updated_cells_++;
+        }
+      }
+    }
+  }
+  queue_lower_.clear();
+}
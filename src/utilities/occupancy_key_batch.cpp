@@ -0,0 +1,430 @@
+#include "utilities/occupancy_key_batch.h"
+
+#include <algorithm>
+#include <iterator>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+namespace
+{
+// Spread the 16 bits of v so that there are 2 zero bits between each of them
+inline uint64_t spreadBits(uint64_t v)
+{
+  v &= 0xFFFF;
+  v = (v | (v << 16)) & 0x0000FF0000FFULL;
+  v = (v | (v <<  8)) & 0x00F00F00F00FULL;
+  v = (v | (v <<  4)) & 0x0C30C30C30C3ULL;
+  v = (v | (v <<  2)) & 0x249249249249ULL;
+  return v;
+}
+
+inline uint64_t compactBits(uint64_t v)
+{
+  v &= 0x249249249249ULL;
+  v = (v | (v >>  2)) & 0x0C30C30C30C3ULL;
+  v = (v | (v >>  4)) & 0x00F00F00F00FULL;
+  v = (v | (v >>  8)) & 0x0000FF0000FFULL;
+  v = (v | (v >> 16)) & 0xFFFF;
+  return v;
+}
+
+void sortUnique(std::vector<uint64_t>& v)
+{
+  std::sort(v.begin(), v.end());
+  v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// Sorted codes of one kind (free or occupied) below a node
+struct CodeSpan{
+  const uint64_t* begin;
+  const uint64_t* end;
+
+  bool empty() const { return begin == end; }
+};
+
+struct TreeUpdate{
+  octomap::OcTree* tree;
+  unsigned int tree_depth;
+  float log_odds[2]; // Free, occupied
+  std::vector<VoxelChange>* changes;
+};
+
+// Follows octomap's updateNodeRecurs(), but for all the codes below the node
+// at once: the node is expanded (if pruned) and visited a single time, then
+// pruned or refreshed from its children on the way back up
+void updateRecurs(const TreeUpdate& u, octomap::OcTreeNode* node, bool is_new, unsigned int depth, CodeSpan spans[2])
+{
+  octomap::OcTree* tree = u.tree;
+
+  // == Leaf, exactly one code is left
+  if (depth == u.tree_depth)
+  {
+    int kind = spans[1].empty() ? 0 : 1;
+    float log_odds_old = is_new ? std::numeric_limits<float>::quiet_NaN() : node->getLogOdds();
+
+    tree->updateNodeLogOdds(node, u.log_odds[kind]);
+
+    // Clamped voxels are left untouched
+    if (u.changes && !(node->getLogOdds() == log_odds_old))
+    {
+      VoxelChange c;
+      c.key = OccupancyKeyBatch::mortonToKey(*spans[kind].begin);
+      c.log_odds_old = log_odds_old;
+      c.log_odds_new = node->getLogOdds();
+      u.changes->push_back(c);
+    }
+    return;
+  }
+
+  // == Pruned leaf, which holds the value of every voxel it covers
+  if (!is_new && !tree->nodeHasChildren(node))
+  {
+    // Nothing to do if all updates push it further past its clamping bound
+    float log_odds = node->getLogOdds();
+    if ((spans[1].empty() && u.log_odds[0] <= 0 && log_odds <= tree->getClampingThresMinLog()) ||
+        (spans[0].empty() && u.log_odds[1] >= 0 && log_odds >= tree->getClampingThresMaxLog()))
+      return;
+
+    tree->expandNode(node);
+  }
+
+  // == Children holding a code, in increasing child index
+  unsigned int shift = 3*(u.tree_depth - 1 - depth);
+  while (!spans[0].empty() || !spans[1].empty())
+  {
+    unsigned int pos = 8;
+    for (int k=0; k<2; k++)
+    {
+      if (!spans[k].empty())
+        pos = std::min(pos, (unsigned int)(*spans[k].begin >> shift) & 7);
+    }
+
+    CodeSpan child_spans[2];
+    for (int k=0; k<2; k++)
+    {
+      const uint64_t* it = spans[k].begin;
+      while (it != spans[k].end && ((*it >> shift) & 7) == pos)
+        ++it;
+
+      child_spans[k].begin = spans[k].begin;
+      child_spans[k].end = it;
+      spans[k].begin = it;
+    }
+
+    bool is_child_new = false;
+    if (!tree->nodeChildExists(node, pos))
+    {
+      tree->createNodeChild(node, pos);
+      is_child_new = true;
+    }
+
+    updateRecurs(u, tree->getNodeChild(node, pos), is_child_new, depth+1, child_spans);
+  }
+
+  if (!tree->pruneNode(node))
+    node->updateOccupancyChildren();
+}
+}
+
+
+OccupancyKeyBatch::OccupancyKeyBatch():
+  cache_shift_(0)
+{
+  reset(1);
+}
+
+void OccupancyKeyBatch::addFree(int thread_idx, const octomap::KeyRay& ray)
+{
+  std::vector<uint64_t>& codes = free_threaded_[thread_idx];
+
+  if (cache_shift_ == 0)
+  {
+    for (octomap::KeyRay::const_iterator it = ray.begin(); it != ray.end(); ++it)
+      codes.push_back( keyToMorton(*it) );
+    return;
+  }
+
+  uint64_t* cache = &cache_threaded_[thread_idx][0];
+  long suppressed = 0;
+
+  for (octomap::KeyRay::const_iterator it = ray.begin(); it != ray.end(); ++it)
+  {
+    uint64_t code = keyToMorton(*it);
+    uint64_t& slot = cache[(code*0x9E3779B97F4A7C15ULL) >> cache_shift_];
+
+    if (slot == code)
+    {
+      suppressed++;
+      continue;
+    }
+
+    slot = code;
+    codes.push_back(code);
+  }
+
+  suppressed_threaded_[thread_idx] += suppressed;
+}
+
+void OccupancyKeyBatch::addFree(int thread_idx, const octomap::OcTreeKey& key)
+{
+  free_threaded_[thread_idx].push_back( keyToMorton(key) );
+}
+
+void OccupancyKeyBatch::addOccupied(int thread_idx, const octomap::OcTreeKey& key)
+{
+  occupied_threaded_[thread_idx].push_back( keyToMorton(key) );
+}
+
+void OccupancyKeyBatch::finalize()
+{
+  int num_threads = free_threaded_.size();
+
+  // == Sort and deduplicate each thread's buffer independently
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for (int i=0; i<2*num_threads; i++)
+  {
+    if (i < num_threads)
+      sortUnique(free_threaded_[i]);
+    else
+      sortUnique(occupied_threaded_[i-num_threads]);
+  }
+
+  // == Merge threads into a single sorted set
+  mergeSorted(free_threaded_, free_codes_);
+  mergeSorted(occupied_threaded_, occupied_codes_);
+
+  // == Prefer occupied cells over free ones (and make sets disjunct)
+  removeOccupiedFromFree();
+}
+
+void OccupancyKeyBatch::mergeSorted(std::vector<std::vector<uint64_t> >& sorted_in, std::vector<uint64_t>& merged_out)
+{
+  // Pairwise merge rounds, each round merges disjoint pairs in parallel
+  int n = sorted_in.size();
+  for (int step=1; step<n; step*=2)
+  {
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<n-step; i+=2*step)
+    {
+      std::vector<uint64_t>& a = sorted_in[i];
+      std::vector<uint64_t>& b = sorted_in[i+step];
+
+      std::vector<uint64_t> merged;
+      merged.reserve(a.size() + b.size());
+      std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(merged));
+      merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+
+      a.swap(merged);
+      b.clear();
+    }
+  }
+
+  // Hand the result over while keeping a buffer behind for the next scan
+  merged_out.swap(sorted_in[0]);
+  sorted_in[0].clear();
+}
+
+void OccupancyKeyBatch::removeOccupiedFromFree()
+{
+  if (occupied_codes_.empty() || free_codes_.empty())
+    return;
+
+  // Split the free codes into chunks, each chunk only needs the slice of occupied
+  // codes that falls within its range
+  int num_chunks = free_threaded_.size();
+  size_t chunk_size = (free_codes_.size() + num_chunks - 1)/num_chunks;
+  std::vector<size_t> chunk_kept(num_chunks, 0);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif
+  for (int c=0; c<num_chunks; c++)
+  {
+    size_t start = std::min(free_codes_.size(), c*chunk_size);
+    size_t end   = std::min(free_codes_.size(), start + chunk_size);
+    if (start == end)
+      continue;
+
+    std::vector<uint64_t>::iterator occ_it  = std::lower_bound(occupied_codes_.begin(), occupied_codes_.end(), free_codes_[start]);
+    std::vector<uint64_t>::iterator occ_end = std::upper_bound(occ_it, occupied_codes_.end(), free_codes_[end-1]);
+
+    // Compact in place within the chunk
+    size_t kept = start;
+    for (size_t i=start; i<end; i++)
+    {
+      while (occ_it != occ_end && *occ_it < free_codes_[i])
+        ++occ_it;
+
+      if (occ_it != occ_end && *occ_it == free_codes_[i])
+        continue;
+
+      free_codes_[kept++] = free_codes_[i];
+    }
+    chunk_kept[c] = kept - start;
+  }
+
+  // Close the gaps between chunks
+  size_t total = 0;
+  for (int c=0; c<num_chunks; c++)
+  {
+    size_t start = std::min(free_codes_.size(), c*chunk_size);
+    if (total != start)
+      std::copy(free_codes_.begin()+start, free_codes_.begin()+start+chunk_kept[c], free_codes_.begin()+total);
+    total += chunk_kept[c];
+  }
+  free_codes_.resize(total);
+}
+
+long OccupancyKeyBatch::getSuppressedCount() const
+{
+  long total = 0;
+  for (size_t i=0; i<suppressed_threaded_.size(); i++)
+    total += suppressed_threaded_[i];
+
+  return total;
+}
+
+void OccupancyKeyBatch::reset(int num_threads)
+{
+  if (num_threads < 1)
+    num_threads = 1;
+
+  free_threaded_.resize(num_threads);
+  occupied_threaded_.resize(num_threads);
+  suppressed_threaded_.assign(num_threads, 0);
+
+  for (int i=0; i<num_threads; i++)
+  {
+    free_threaded_[i].clear();
+    occupied_threaded_[i].clear();
+  }
+
+  resetCaches();
+
+  free_codes_.clear();
+  occupied_codes_.clear();
+}
+
+void OccupancyKeyBatch::resetCaches()
+{
+  // Codes are never all ones, so that value marks an empty cache slot
+  if (cache_shift_ == 0)
+    return;
+
+  int num_threads = free_threaded_.size();
+  cache_threaded_.resize(num_threads);
+  for (int i=0; i<num_threads; i++)
+    cache_threaded_[i].assign(size_t(1) << (64-cache_shift_), ~uint64_t(0));
+}
+
+void OccupancyKeyBatch::setEmissionCacheSize(int size)
+{
+  // Rounded up to a power of 2
+  int shift = 0;
+  if (size > 0)
+  {
+    int bits = 1;
+    while ((1 << bits) < size && bits < 24)
+      bits++;
+
+    shift = 64 - bits;
+  }
+
+  if (shift == cache_shift_)
+    return;
+
+  // Keys already collected are kept, so scans of several sensors can be batched together
+  cache_shift_ = shift;
+  cache_threaded_.clear();
+  resetCaches();
+}
+
+void OccupancyKeyBatch::updateNode(octomap::OcTree* tree, const octomap::OcTreeKey& key, float log_odds,
+                                   std::vector<VoxelChange>* changes)
+{
+  // The root can only be created by octomap, the voxel is then new
+  if (!changes || !tree->getRoot())
+  {
+    octomap::OcTreeNode* node = tree->updateNode(key, log_odds);
+    if (changes && node)
+    {
+      VoxelChange c;
+      c.key = key;
+      c.log_odds_old = std::numeric_limits<float>::quiet_NaN();
+      c.log_odds_new = node->getLogOdds();
+      changes->push_back(c);
+    }
+    return;
+  }
+
+  // Single descent, reading the old value on the way
+  uint64_t code = keyToMorton(key);
+  CodeSpan spans[2];
+  spans[0].begin = &code;
+  spans[0].end   = &code + 1;
+  spans[1].begin = spans[1].end = NULL;
+
+  TreeUpdate u;
+  u.tree = tree;
+  u.tree_depth = tree->getTreeDepth();
+  u.log_odds[0] = u.log_odds[1] = log_odds;
+  u.changes = changes;
+
+  updateRecurs(u, tree->getRoot(), false, 0, spans);
+}
+
+void OccupancyKeyBatch::updateTree(octomap::OcTree* tree, float free_log_odds, float occupied_log_odds, double occupied_min_height,
+                                   std::vector<VoxelChange>* changes)
+{
+  occupied_kept_.clear();
+  for (size_t i=0; i<occupied_codes_.size(); i++)
+  {
+    if (tree->keyToCoord(mortonToKey(occupied_codes_[i])).z() > occupied_min_height)
+      occupied_kept_.push_back(occupied_codes_[i]);
+  }
+
+  CodeSpan spans[2];
+  spans[0].begin = free_codes_.data();
+  spans[0].end   = free_codes_.data() + free_codes_.size();
+  spans[1].begin = occupied_kept_.data();
+  spans[1].end   = occupied_kept_.data() + occupied_kept_.size();
+
+  // The root can only be created by octomap, through a regular update
+  if (!tree->getRoot())
+  {
+    int kind = spans[0].empty() ? 1 : 0;
+    if (spans[kind].empty())
+      return;
+
+    updateNode(tree, mortonToKey(*spans[kind].begin), kind == 0 ? free_log_odds : occupied_log_odds, changes);
+    spans[kind].begin++;
+  }
+
+  TreeUpdate u;
+  u.tree = tree;
+  u.tree_depth = tree->getTreeDepth();
+  u.log_odds[0] = free_log_odds;
+  u.log_odds[1] = occupied_log_odds;
+  u.changes = changes;
+
+  if (!spans[0].empty() || !spans[1].empty())
+    updateRecurs(u, tree->getRoot(), false, 0, spans);
+}
+
+uint64_t OccupancyKeyBatch::keyToMorton(const octomap::OcTreeKey& key)
+{
+  // Bit order matches octomap's child index (x = 1, y = 2, z = 4)
+  return spreadBits(key[0]) | (spreadBits(key[1]) << 1) | (spreadBits(key[2]) << 2);
+}
+
+octomap::OcTreeKey OccupancyKeyBatch::mortonToKey(uint64_t code)
+{
+  return octomap::OcTreeKey(compactBits(code), compactBits(code >> 1), compactBits(code >> 2));
+}
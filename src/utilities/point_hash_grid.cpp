@@ -0,0 +1,101 @@
+#include "utilities/point_hash_grid.h"
+
+
+PointHashGrid::PointHashGrid():
+  cell_size_(0.1),
+  leaf_size_(0),
+  point_count_(0)
+{
+}
+
+PointHashGrid::PointHashGrid(double cell_size, double leaf_size):
+  point_count_(0)
+{
+  setResolution(cell_size, leaf_size);
+}
+
+void PointHashGrid::clear()
+{
+  buckets_.clear();
+  leaves_.clear();
+  point_count_ = 0;
+}
+
+bool PointHashGrid::empty()
+{
+  return point_count_ == 0;
+}
+
+bool PointHashGrid::insert(const pcl::PointXYZ& p)
+{
+  // Only one point is kept per leaf, mimicking the voxel grid filter
+  if (leaf_size_ > 0)
+  {
+    octomap::OcTreeKey leaf_key;
+    if (!voxel_hash::coordToKey(p.x, p.y, p.z, leaf_size_, leaf_key))
+      return false;
+
+    if (!leaves_.insert(leaf_key))
+      return false;
+  }
+
+  octomap::OcTreeKey key;
+  if (!voxel_hash::coordToKey(p.x, p.y, p.z, cell_size_, key))
+    return false;
+
+  buckets_[key].push_back(p);
+  point_count_++;
+  return true;
+}
+
+int PointHashGrid::radiusCount(const pcl::PointXYZ& p, double radius)
+{
+  octomap::OcTreeKey key_min, key_max;
+  if (!voxel_hash::coordToKey(p.x-radius, p.y-radius, p.z-radius, cell_size_, key_min) ||
+      !voxel_hash::coordToKey(p.x+radius, p.y+radius, p.z+radius, cell_size_, key_max))
+    return 0;
+
+  double r_sq = radius*radius;
+  int count = 0;
+
+  octomap::OcTreeKey key;
+  for (int x=key_min[0]; x<=key_max[0]; x++)
+  {
+    key[0] = x;
+    for (int y=key_min[1]; y<=key_max[1]; y++)
+    {
+      key[1] = y;
+      for (int z=key_min[2]; z<=key_max[2]; z++)
+      {
+        key[2] = z;
+
+        std::vector<pcl::PointXYZ>* bucket = buckets_.find(key);
+        if (!bucket)
+          continue;
+
+        for (size_t i=0; i<bucket->size(); i++)
+        {
+          const pcl::PointXYZ& q = (*bucket)[i];
+          double dx = q.x-p.x, dy = q.y-p.y, dz = q.z-p.z;
+
+          if (dx*dx + dy*dy + dz*dz <= r_sq)
+            count++;
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+void PointHashGrid::setResolution(double cell_size, double leaf_size)
+{
+  cell_size_ = cell_size;
+  leaf_size_ = leaf_size;
+  clear();
+}
+
+size_t PointHashGrid::size()
+{
+  return point_count_;
+}
@@ -0,0 +1,342 @@
+#include "utilities/ray_marcher.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+
+RayMarcher::RayMarcher():
+  tree_(NULL),
+  grid_(NULL),
+  block_level_(-1),
+  block_node_(NULL),
+  lookups_(0),
+  block_hits_(0)
+{
+}
+
+void RayMarcher::setTree(octomap::OcTree* tree, const DenseVoxelGrid* grid)
+{
+  tree_ = tree;
+  grid_ = grid;
+  block_level_ = -1;
+}
+
+void RayMarcher::clear()
+{
+  rays_.clear();
+  keys_.clear();
+  nodes_.clear();
+
+  // The tree may have changed since the last batch
+  block_level_ = -1;
+  lookups_ = 0;
+  block_hits_ = 0;
+}
+
+bool RayMarcher::castRay(const octomap::point3d& origin, const octomap::point3d& direction, double max_range, Ray& ray)
+{
+  /*
+   * Same traversal as OccupancyOcTreeBase::castRay(), see
+   * http://octomap.github.io/octomap/doc/OccupancyOcTreeBase_8hxx_source.html
+   *
+   * Voxels are only recorded once the ray leaves them, so the endpoint voxel
+   * is never part of the traversed keys (as with computeRayKeys(origin, endpoint))
+   */
+  ray.endpoint = origin;
+  ray.end_node = NULL;
+  ray.found_endpoint = false;
+  ray.has_end_key = false;
+  ray.first = keys_.size();
+  ray.count = 0;
+
+  octomap::OcTreeKey current_key;
+  if (!tree_ || !tree_->coordToKeyChecked(origin, current_key))
+    return false;
+
+  // == Occupied node at the origin
+  octomap::OcTreeNode* current_node = lookup(current_key);
+  if (current_node && tree_->isNodeOccupied(current_node))
+  {
+    ray.endpoint = tree_->keyToCoord(current_key);
+    ray.end_key = current_key;
+    ray.end_node = current_node;
+    ray.has_end_key = true;
+    ray.found_endpoint = true;
+    return true;
+  }
+
+  // == Initialization
+  int step[3];
+  double t_max[3];
+  double t_delta[3];
+
+  if (!initTraversal(origin, direction, current_key, step, t_max, t_delta))
+    return false;
+
+  bool max_range_set = (max_range > 0.0);
+  double max_range_sq = max_range*max_range;
+  unsigned int key_max = (1u << tree_->getTreeDepth()) - 1;
+
+  // == Incremental phase
+  while (true)
+  {
+    // The ray leaves the current voxel
+    keys_.push_back(current_key);
+    nodes_.push_back(current_node);
+    ray.count++;
+
+    int dim;
+    if (t_max[0] < t_max[1])
+      dim = (t_max[0] < t_max[2]) ? 0 : 2;
+    else
+      dim = (t_max[1] < t_max[2]) ? 1 : 2;
+
+    // Hit the bounds of the tree, return the border voxel nevertheless
+    if ((step[dim] < 0 && current_key[dim] == 0) || (step[dim] > 0 && current_key[dim] == key_max))
+    {
+      keys_.pop_back();
+      nodes_.pop_back();
+      ray.count--;
+
+      ray.endpoint = tree_->keyToCoord(current_key);
+      ray.end_key = current_key;
+      ray.end_node = current_node;
+      ray.has_end_key = true;
+      return false;
+    }
+
+    current_key[dim] += step[dim];
+    t_max[dim] += t_delta[dim];
+
+    ray.endpoint = tree_->keyToCoord(current_key);
+    ray.end_key = current_key;
+    ray.has_end_key = true;
+
+    // Beyond max range
+    if (max_range_set && (ray.endpoint - origin).norm_sq() > max_range_sq)
+    {
+      ray.end_node = lookup(current_key);
+      return false;
+    }
+
+    current_node = lookup(current_key);
+    if (current_node && tree_->isNodeOccupied(current_node))
+    {
+      ray.end_node = current_node;
+      ray.found_endpoint = true;
+      return true;
+    }
+  }
+}
+
+RayMarcher::Ray& RayMarcher::walkRay(const octomap::point3d& origin, const octomap::point3d& direction, double length)
+{
+  rays_.push_back(Ray());
+  Ray& ray = rays_.back();
+
+  ray.endpoint = origin;
+  ray.end_node = NULL;
+  ray.found_endpoint = false;
+  ray.has_end_key = false;
+  ray.first = keys_.size();
+  ray.count = 0;
+
+  if (!tree_)
+    return ray;
+
+  octomap::point3d dir = direction.normalized();
+  ray.endpoint = origin + dir*length;
+
+  // == Only the part within the snapshot, if any, is walked
+  double t_start = 0;
+  double t_end = length;
+
+  if (grid_ && grid_->size() > 0)
+  {
+    double half = tree_->getResolution()/2;
+    octomap::point3d box_min = tree_->keyToCoord(grid_->getMinKey());
+    octomap::point3d box_max = tree_->keyToCoord(grid_->getMaxKey());
+
+    for (int i=0; i<3; i++)
+    {
+      double lo = box_min(i) - half;
+      double hi = box_max(i) + half;
+
+      if (dir(i) == 0)
+      {
+        if (origin(i) < lo || origin(i) > hi)
+          return ray;
+        continue;
+      }
+
+      double t0 = (lo - origin(i))/dir(i);
+      double t1 = (hi - origin(i))/dir(i);
+      if (t0 > t1)
+        std::swap(t0, t1);
+
+      t_start = std::max(t_start, t0);
+      t_end   = std::min(t_end, t1);
+    }
+  }
+
+  if (t_start >= t_end)
+    return ray;
+
+  octomap::point3d start = origin + dir*t_start;
+  octomap::OcTreeKey current_key;
+  if (!tree_->coordToKeyChecked(start, current_key))
+    return ray;
+
+  int step[3];
+  double t_max[3];
+  double t_delta[3];
+
+  if (!initTraversal(start, dir, current_key, step, t_max, t_delta))
+    return ray;
+
+  double length_left = t_end - t_start;
+  unsigned int key_max = (1u << tree_->getTreeDepth()) - 1;
+
+  // == Record every voxel entered before the end of the ray
+  while (true)
+  {
+    keys_.push_back(current_key);
+    nodes_.push_back(NULL);
+    ray.count++;
+
+    int dim;
+    if (t_max[0] < t_max[1])
+      dim = (t_max[0] < t_max[2]) ? 0 : 2;
+    else
+      dim = (t_max[1] < t_max[2]) ? 1 : 2;
+
+    if (t_max[dim] >= length_left)
+      break;
+
+    if ((step[dim] < 0 && current_key[dim] == 0) || (step[dim] > 0 && current_key[dim] == key_max))
+      break;
+
+    current_key[dim] += step[dim];
+    t_max[dim] += t_delta[dim];
+  }
+
+  return ray;
+}
+
+void RayMarcher::castRays(const octomap::point3d& origin, const std::vector<octomap::point3d>& rays)
+{
+  clear();
+  rays_.resize(rays.size());
+
+  for (int i=0; i<(int)rays.size(); i++)
+    castRay(origin, rays[i], rays[i].norm(), rays_[i]);
+}
+
+void RayMarcher::castRays(const octomap::point3d& origin, const float* dir_x, const float* dir_y, const float* dir_z,
+                          const float* length, int count, const float* start, const int* parent)
+{
+  clear();
+  rays_.resize(count);
+
+  for (int i=0; i<count; i++)
+  {
+    octomap::point3d dir (dir_x[i], dir_y[i], dir_z[i]);
+
+    // A ray continuing a blocked one sees the same endpoint, and nothing in front of it
+    if (parent && parent[i] >= 0 && rays_[parent[i]].found_endpoint)
+    {
+      rays_[i] = rays_[parent[i]];
+      rays_[i].first = keys_.size();
+      rays_[i].count = 0;
+      continue;
+    }
+
+    if (start && start[i] > 0)
+      castRay(origin + dir*start[i], dir, length[i] - start[i], rays_[i]);
+    else
+      castRay(origin, dir, length[i], rays_[i]);
+  }
+}
+
+bool RayMarcher::initTraversal(const octomap::point3d& origin, const octomap::point3d& direction, const octomap::OcTreeKey& key,
+                               int* step, double* t_max, double* t_delta)
+{
+  octomap::point3d dir = direction.normalized();
+  double resolution = tree_->getResolution();
+
+  for (int i=0; i<3; i++)
+  {
+    if (dir(i) > 0.0)      step[i] =  1;
+    else if (dir(i) < 0.0) step[i] = -1;
+    else                   step[i] =  0;
+
+    if (step[i] != 0)
+    {
+      // Corner point of voxel (in direction of ray)
+      double voxel_border = tree_->keyToCoord(key[i]) + double(step[i] * resolution * 0.5);
+
+      t_max[i]   = (voxel_border - origin(i)) / dir(i);
+      t_delta[i] = resolution / fabs(dir(i));
+    }
+    else
+    {
+      t_max[i]   = std::numeric_limits<double>::max();
+      t_delta[i] = std::numeric_limits<double>::max();
+    }
+  }
+
+  return (step[0] != 0 || step[1] != 0 || step[2] != 0);
+}
+
+octomap::OcTreeNode* RayMarcher::lookup(const octomap::OcTreeKey& key)
+{
+  // == Still within the block of the previous descent
+  if (block_level_ >= 0 &&
+      (unsigned int)(key[0] >> block_level_) == block_key_[0] &&
+      (unsigned int)(key[1] >> block_level_) == block_key_[1] &&
+      (unsigned int)(key[2] >> block_level_) == block_key_[2])
+  {
+    block_hits_++;
+    return block_node_;
+  }
+
+  // == Unknown voxels of the snapshot have no node to descend to
+  if (grid_ && grid_->contains(key) && !grid_->isKnown(grid_->getCode(key)))
+  {
+    block_hits_++;
+    return NULL;
+  }
+
+  lookups_++;
+
+  // == Descend until the node covering the key, or the missing child, is found
+  int level = tree_->getTreeDepth();
+  octomap::OcTreeNode* node = tree_->getRoot();
+
+  while (node && level > 0)
+  {
+    unsigned int child_idx = octomap::computeChildIdx(key, level-1);
+    if (!tree_->nodeChildExists(node, child_idx))
+    {
+      // A leaf above the last level covers the whole block (pruned),
+      // otherwise the child's block is unknown
+      if (tree_->nodeHasChildren(node))
+      {
+        node = NULL;
+        level--;
+      }
+      break;
+    }
+
+    node = tree_->getNodeChild(node, child_idx);
+    level--;
+  }
+
+  block_level_ = level;
+  block_node_ = node;
+  for (int i=0; i<3; i++)
+    block_key_[i] = key[i] >> level;
+
+  return node;
+}
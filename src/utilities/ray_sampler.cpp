@@ -0,0 +1,130 @@
+#include "utilities/ray_sampler.h"
+
+#include <math.h>
+#include <random>
+
+
+namespace
+{
+// Radical inverse of i in the given base
+double halton(int i, int base)
+{
+  double f = 1, r = 0;
+  while (i > 0)
+  {
+    f /= base;
+    r += f*(i % base);
+    i /= base;
+  }
+  return r;
+}
+}
+
+
+RaySampler::RaySampler():
+  slope_h_(0),
+  slope_v_(0),
+  range_max_(0)
+{
+}
+
+void RaySampler::setCamera(double fov_h, double fov_v, double range_max)
+{
+  double deg2rad = M_PI/180;
+  slope_h_ = tan(fov_h/2 * deg2rad);
+  slope_v_ = tan(fov_v/2 * deg2rad);
+  range_max_ = range_max;
+}
+
+int RaySampler::countRays(double step, int& bands) const
+{
+  // Bands from the far plane inwards, until a single cell spans the whole view
+  int count = 0;
+  bands = 0;
+
+  while (true)
+  {
+    int nx = ceil(2*slope_h_/step);
+    int ny = ceil(2*slope_v_/step);
+    count += nx*ny;
+    bands++;
+
+    if (nx*ny == 1)
+      return count;
+
+    step *= 2;
+  }
+}
+
+void RaySampler::sample(double resolution, int budget, Jitter jitter, std::vector<Ray>& rays)
+{
+  rays.clear();
+  if (range_max_ <= 0 || resolution <= 0)
+    return;
+
+  // == Finest step, in slope units: one voxel at the far plane
+  double step = resolution/range_max_;
+  int bands;
+  int count = countRays(step, bands);
+
+  while (budget > 0 && count > budget)
+  {
+    step *= 1.05;
+    count = countRays(step, bands);
+  }
+
+  // == Bands from the sensor outwards, band b (of n) spans depths [R/2^(n-b), R/2^(n-b-1)]
+  // The first band starts at the sensor
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  int band_first = 0, parent_first = -1, parent_ny = 0;
+
+  for (int b=0; b<bands; b++)
+  {
+    double band_step = step * (1 << (bands-1-b));
+    double depth_far  = range_max_ / (1 << (bands-1-b));
+    double depth_near = (b == 0) ? 0 : depth_far/2;
+
+    int nx = ceil(2*slope_h_/band_step);
+    int ny = ceil(2*slope_v_/band_step);
+
+    for (int ix=0; ix<nx; ix++)
+    {
+      for (int iy=0; iy<ny; iy++)
+      {
+        // Cell, clipped to the view
+        double h0 = -slope_h_ + ix*band_step, h1 = std::min(h0 + band_step, slope_h_);
+        double v0 = -slope_v_ + iy*band_step, v1 = std::min(v0 + band_step, slope_v_);
+
+        double u = 0.5, w = 0.5;
+        if (jitter == JITTER_STRATIFIED)
+        {
+          u = uniform(rng);
+          w = uniform(rng);
+        }
+        else if (jitter == JITTER_HALTON)
+        {
+          u = halton(rays.size()+1, 2);
+          w = halton(rays.size()+1, 3);
+        }
+
+        Eigen::Vector3d dir (1, h0 + u*(h1-h0), v0 + w*(v1-v0));
+
+        Ray ray;
+        ray.far    = dir*depth_far;
+        ray.start  = dir.norm()*depth_near;
+        ray.range  = dir.norm()*range_max_;
+        ray.parent = (b == 0) ? -1 : parent_first + (ix/2)*parent_ny + iy/2;
+        ray.band   = b;
+        ray.ix     = ix;
+        ray.iy     = iy;
+        rays.push_back(ray);
+      }
+    }
+
+    parent_first = band_first;
+    parent_ny = ny;
+    band_first = rays.size();
+  }
+}
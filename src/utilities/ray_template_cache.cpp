@@ -0,0 +1,91 @@
+#include "utilities/ray_template_cache.h"
+
+#include <algorithm>
+#include <math.h>
+
+
+RayTemplateCache::RayTemplateCache():
+  hits_(0),
+  misses_(0)
+{
+}
+
+bool RayTemplateCache::Key::operator<(const Key& other) const
+{
+  return std::lexicographical_compare(q, q+9, other.q, other.q+9);
+}
+
+void RayTemplateCache::setRays(const std::vector<Eigen::Vector3d>& rays, const std::vector<float>& starts, const std::vector<float>& ranges,
+                               const std::vector<int>& parents, const std::vector<Eigen::Matrix3d>& cameras)
+{
+  if (rays == rays_ && starts == starts_ && ranges == ranges_ && parents == parents_ && cameras == cameras_)
+    return;
+
+  rays_ = rays;
+  starts_ = starts;
+  ranges_ = ranges;
+  parents_ = parents;
+  cameras_ = cameras;
+  clear();
+
+  rays_vehicle_.clear();
+  starts_vehicle_.clear();
+  ranges_vehicle_.clear();
+  parents_vehicle_.clear();
+
+  int count = rays.size();
+  for (int c=0; c<(int)cameras.size(); c++)
+  {
+    for (int r=0; r<count; r++)
+    {
+      rays_vehicle_.push_back(cameras[c]*rays[r]);
+      starts_vehicle_.push_back(r < (int)starts.size() ? starts[r] : 0);
+      ranges_vehicle_.push_back(r < (int)ranges.size() ? ranges[r] : rays[r].norm());
+      parents_vehicle_.push_back(r < (int)parents.size() && parents[r] >= 0 ? c*count + parents[r] : -1);
+    }
+  }
+}
+
+void RayTemplateCache::clear()
+{
+  bundles_.clear();
+}
+
+const RayTemplateCache::Bundle& RayTemplateCache::get(const Eigen::Matrix3d& rotation)
+{
+  Key key;
+  for (int i=0; i<9; i++)
+    key.q[i] = lround(rotation(i)*1e6);
+
+  std::map<Key, Bundle>::iterator it = bundles_.find(key);
+  if (it != bundles_.end())
+  {
+    hits_++;
+    return it->second;
+  }
+
+  misses_++;
+  Bundle& bundle = bundles_[key];
+
+  int count = rays_vehicle_.size();
+  bundle.dir_x.resize(count);
+  bundle.dir_y.resize(count);
+  bundle.dir_z.resize(count);
+  bundle.length.resize(count);
+  bundle.start  = starts_vehicle_;
+  bundle.range  = ranges_vehicle_;
+  bundle.parent = parents_vehicle_;
+
+  for (int i=0; i<count; i++)
+  {
+    Eigen::Vector3d ray = rotation*rays_vehicle_[i];
+    double length = ray.norm();
+
+    bundle.dir_x[i]  = ray[0]/length;
+    bundle.dir_y[i]  = ray[1]/length;
+    bundle.dir_z[i]  = ray[2]/length;
+    bundle.length[i] = length;
+  }
+
+  return bundle;
+}
@@ -15,6 +15,7 @@ TimeProfiler::TimeProfiler(bool b) {
 
 double TimeProfiler::getLatestTime(std::string s)
 {
+  std::lock_guard<std::mutex> lock(mutex_entries);
   return entries[s].last;
 }
 
@@ -23,14 +24,30 @@ void TimeProfiler::start() {
 }
 
 void TimeProfiler::start(std::string s) {
-    timers[s] = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_entries);
+    timers[s] = now;
 }
 
 void TimeProfiler::stop(std::string s) {
-    std::chrono::steady_clock::time_point begin = timers[s];
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_entries);
+    std::chrono::steady_clock::time_point begin = timers[s];
     double t = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1e3;
 
+    addEntryValue(s, t);
+}
+
+void TimeProfiler::record(std::string s, double value) {
+    // Non-timing statistics (e.g. hit rates) share the same min/avg/max bookkeeping
+    std::lock_guard<std::mutex> lock(mutex_entries);
+    addEntryValue(s, value);
+}
+
+void TimeProfiler::addEntryValue(std::string s, double t) {
+    // mutex_entries is held by the caller
     std::map<std::string,ProfilerEntry>::iterator it;
     it = entries.find(s);
 
@@ -106,6 +123,8 @@ std::string TimeProfiler::getEntryTitle(std::string s) {
 }
 
 void TimeProfiler::dump() {
+  std::lock_guard<std::mutex> lock(mutex_entries);
+
   // Write to CSV
   std::stringstream logfile;
   std::map<std::string,ProfilerEntry>::iterator it;
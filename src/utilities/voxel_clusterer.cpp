@@ -0,0 +1,273 @@
+#include "utilities/voxel_clusterer.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+VoxelClusterer::VoxelClusterer():
+  radius_(0)
+{
+  setRadius(1);
+}
+
+void VoxelClusterer::cluster(const std::vector<octomap::OcTreeKey>& keys, std::vector<std::vector<octomap::OcTreeKey> >& clusters, int min_size)
+{
+  clusters.clear();
+  int count = keys.size();
+  if (count == 0)
+    return;
+
+  // Atomics cannot be moved, so the forest is only ever replaced by a larger one
+  if (parent_.size() < count)
+    parent_ = std::vector<std::atomic<int> >(count);
+
+  // == Index the keys, a repeated key starts under its first occurrence
+  index_.clear();
+  index_.reserve(count);
+  for (int i=0; i<count; i++)
+  {
+    std::pair<int*, bool> result = index_.insert(keys[i], i);
+    parent_[i].store(result.second ? i : *result.first, std::memory_order_relaxed);
+  }
+
+  // == Join each key with the neighbors found in its half of the neighborhood
+  int offset_count = offsets_.size()/3;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic, 1024)
+  #endif
+  for (int i=0; i<count; i++)
+  {
+    const octomap::OcTreeKey& key = keys[i];
+    octomap::OcTreeKey n_key;
+
+    for (int o=0; o<offset_count; o++)
+    {
+      bool is_valid = true;
+      for (int k=0; k<3; k++)
+      {
+        int c = (int)key[k] + offsets_[3*o+k];
+        if (c < 0 || c > 65535)
+          is_valid = false;
+        n_key[k] = octomap::key_type(c);
+      }
+
+      if (!is_valid)
+        continue;
+
+      const int* j = index_.find(n_key);
+      if (j)
+        unite(i, *j);
+    }
+  }
+
+  // == Number the components in the order of their first key
+  cluster_ids_.assign(count, -1);
+  std::vector<int> sizes;
+  for (int i=0; i<count; i++)
+  {
+    int root = find(i);
+    if (cluster_ids_[root] < 0)
+    {
+      cluster_ids_[root] = sizes.size();
+      sizes.push_back(0);
+    }
+    cluster_ids_[i] = cluster_ids_[root];
+    sizes[cluster_ids_[i]]++;
+  }
+
+  // == Collect the clusters that are large enough
+  std::vector<int> output(sizes.size(), -1);
+  for (int c=0; c<sizes.size(); c++)
+  {
+    if (sizes[c] < min_size)
+      continue;
+
+    output[c] = clusters.size();
+    clusters.push_back(std::vector<octomap::OcTreeKey>());
+    clusters.back().reserve(sizes[c]);
+  }
+
+  for (int i=0; i<count; i++)
+  {
+    int c = output[cluster_ids_[i]];
+    if (c >= 0)
+      clusters[c].push_back(keys[i]);
+  }
+}
+
+void VoxelClusterer::reset()
+{
+  labels_.clear();
+  components_.clear();
+  free_components_.clear();
+}
+
+void VoxelClusterer::setRadius(int radius)
+{
+  if (radius < 1 || radius == radius_)
+    return;
+
+  radius_ = radius;
+  reset();
+
+  // Offsets after (0,0,0) in lexicographic order, the rest are their opposites
+  offsets_.clear();
+  for (int dx=0; dx<=radius; dx++)
+  {
+    for (int dy=-radius; dy<=radius; dy++)
+    {
+      for (int dz=-radius; dz<=radius; dz++)
+      {
+        if (dx == 0 && (dy < 0 || (dy == 0 && dz <= 0)))
+          continue;
+
+        offsets_.push_back(dx);
+        offsets_.push_back(dy);
+        offsets_.push_back(dz);
+      }
+    }
+  }
+}
+
+void VoxelClusterer::update(const std::vector<octomap::OcTreeKey>& keys, std::vector<std::vector<octomap::OcTreeKey> >& clusters, int min_size)
+{
+  clusters.clear();
+
+  current_.clear();
+  current_.reserve(keys.size());
+  for (size_t i=0; i<keys.size(); i++)
+    current_.insert(keys[i]);
+
+  // == Components that lost a key
+  is_dirty_.assign(components_.size(), 0);
+  dirty_.clear();
+  for (VoxelHashMap<int>::iterator it = labels_.begin(); it != labels_.end(); ++it)
+  {
+    if (!current_.count(it.key()))
+      markDirty(it.value());
+  }
+
+  // == Components bordering a new key, in either half of the neighborhood
+  pending_.clear();
+  int offset_count = offsets_.size()/3;
+  for (size_t i=0; i<keys.size(); i++)
+  {
+    if (labels_.find(keys[i]))
+      continue;
+
+    pending_.push_back(keys[i]);
+
+    octomap::OcTreeKey n_key;
+    for (int o=0; o<offset_count; o++)
+    {
+      for (int sign=-1; sign<=1; sign+=2)
+      {
+        bool is_valid = true;
+        for (int k=0; k<3; k++)
+        {
+          int c = (int)keys[i][k] + sign*offsets_[3*o+k];
+          if (c < 0 || c > 65535)
+            is_valid = false;
+          n_key[k] = octomap::key_type(c);
+        }
+
+        if (!is_valid)
+          continue;
+
+        const int* component = labels_.find(n_key);
+        if (component)
+          markDirty(*component);
+      }
+    }
+  }
+
+  // == Release the changed components, their remaining keys are clustered again with the new ones
+  for (size_t d=0; d<dirty_.size(); d++)
+  {
+    std::vector<octomap::OcTreeKey>& component = components_[dirty_[d]];
+    for (size_t i=0; i<component.size(); i++)
+    {
+      labels_.erase(component[i]);
+      if (current_.count(component[i]))
+        pending_.push_back(component[i]);
+    }
+
+    component.clear();
+    free_components_.push_back(dirty_[d]);
+  }
+
+  cluster(pending_, reclustered_, 1);
+
+  for (size_t r=0; r<reclustered_.size(); r++)
+  {
+    int c;
+    if (free_components_.empty())
+    {
+      c = components_.size();
+      components_.push_back(std::vector<octomap::OcTreeKey>());
+    }
+    else
+    {
+      c = free_components_.back();
+      free_components_.pop_back();
+    }
+
+    components_[c].swap(reclustered_[r]);
+    for (size_t i=0; i<components_[c].size(); i++)
+      labels_.insert(components_[c][i], c);
+  }
+
+  // == Report the components that are large enough
+  for (size_t c=0; c<components_.size(); c++)
+  {
+    if (!components_[c].empty() && components_[c].size() >= min_size)
+      clusters.push_back(components_[c]);
+  }
+}
+
+int VoxelClusterer::find(int i)
+{
+  while (true)
+  {
+    int p = parent_[i].load();
+    if (p == i)
+      return i;
+
+    // Path halving, parents only ever move to smaller indices
+    int gp = parent_[p].load();
+    if (gp != p)
+      parent_[i].compare_exchange_weak(p, gp);
+
+    i = gp;
+  }
+}
+
+void VoxelClusterer::unite(int a, int b)
+{
+  while (true)
+  {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+      return;
+
+    if (a < b)
+      std::swap(a, b);
+
+    // Link the larger root under the smaller one, only if it is still a root
+    int expected = a;
+    if (parent_[a].compare_exchange_strong(expected, b))
+      return;
+  }
+}
+
+void VoxelClusterer::markDirty(int component)
+{
+  if (is_dirty_[component])
+    return;
+
+  is_dirty_[component] = 1;
+  dirty_.push_back(component);
+}
@@ -0,0 +1,79 @@
+#include "utilities/voxel_grid_accumulator.h"
+
+
+VoxelGridAccumulator::VoxelGridAccumulator():
+  leaf_size_(0.1)
+{
+}
+
+VoxelGridAccumulator::VoxelGridAccumulator(double leaf_size):
+  leaf_size_(leaf_size)
+{
+}
+
+bool VoxelGridAccumulator::addPoint(const pcl::PointXYZ& p)
+{
+  octomap::OcTreeKey key;
+  if (!voxel_hash::coordToKey(p.x, p.y, p.z, leaf_size_, key))
+    return false;
+
+  Leaf& leaf = leaves_[key];
+  leaf.x += p.x;
+  leaf.y += p.y;
+  leaf.z += p.z;
+  leaf.count++;
+
+  // First point in this leaf
+  return leaf.count == 1;
+}
+
+int VoxelGridAccumulator::addPointCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud, double min_height)
+{
+  int new_leaves = 0;
+
+  for (size_t i=0; i<cloud.points.size(); i++)
+  {
+    const pcl::PointXYZ& p = cloud.points[i];
+
+    // NaNs fail this check as well
+    if (!(p.z >= min_height))
+      continue;
+
+    if (addPoint(p))
+      new_leaves++;
+  }
+
+  return new_leaves;
+}
+
+void VoxelGridAccumulator::clear()
+{
+  leaves_.clear();
+}
+
+void VoxelGridAccumulator::getPointCloud(pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  cloud_out.points.clear();
+  cloud_out.points.reserve(leaves_.size());
+
+  for (VoxelHashMap<Leaf>::iterator it = leaves_.begin(); it != leaves_.end(); ++it)
+  {
+    const Leaf& leaf = it.value();
+    cloud_out.points.push_back( pcl::PointXYZ(leaf.x/leaf.count, leaf.y/leaf.count, leaf.z/leaf.count) );
+  }
+
+  cloud_out.width    = cloud_out.points.size();
+  cloud_out.height   = 1;
+  cloud_out.is_dense = true;
+}
+
+void VoxelGridAccumulator::setLeafSize(double leaf_size)
+{
+  leaf_size_ = leaf_size;
+  leaves_.clear();
+}
+
+size_t VoxelGridAccumulator::size()
+{
+  return leaves_.size();
+}
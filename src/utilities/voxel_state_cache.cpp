@@ -0,0 +1,83 @@
+#include "utilities/voxel_state_cache.h"
+
+
+VoxelStateCache::VoxelStateCache(size_t capacity)
+{
+  reset(capacity);
+}
+
+void VoxelStateCache::reset(size_t capacity)
+{
+  // Rounded up to a power of 2
+  size_t cap = 2;
+  while (cap < capacity)
+    cap <<= 1;
+
+  mask_ = cap - 1;
+  if (slots_.size() != cap)
+    slots_ = std::vector<Slot>(cap);
+  else
+    clear();
+}
+
+void VoxelStateCache::clear()
+{
+  for (size_t i=0; i<slots_.size(); i++)
+  {
+    slots_[i].key.store(voxel_hash::EMPTY_KEY, std::memory_order_relaxed);
+    slots_[i].ready.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool VoxelStateCache::find(const octomap::OcTreeKey& key, VoxelState& state) const
+{
+  uint64_t packed = voxel_hash::packKey(key);
+  size_t i = voxel_hash::mix(packed) & mask_;
+
+  for (size_t probe=0; probe<MAX_PROBES; probe++, i = (i+1) & mask_)
+  {
+    const Slot& slot = slots_[i];
+    uint64_t k = slot.key.load(std::memory_order_acquire);
+
+    if (k == voxel_hash::EMPTY_KEY)
+      return false;
+
+    if (k == packed)
+    {
+      // Claimed but possibly still being written
+      if (!slot.ready.load(std::memory_order_acquire))
+        return false;
+
+      state = slot.state;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void VoxelStateCache::insert(const octomap::OcTreeKey& key, const VoxelState& state)
+{
+  uint64_t packed = voxel_hash::packKey(key);
+  size_t i = voxel_hash::mix(packed) & mask_;
+
+  for (size_t probe=0; probe<MAX_PROBES; probe++, i = (i+1) & mask_)
+  {
+    Slot& slot = slots_[i];
+    uint64_t expected = slot.key.load(std::memory_order_acquire);
+
+    if (expected == voxel_hash::EMPTY_KEY &&
+        slot.key.compare_exchange_strong(expected, packed, std::memory_order_acq_rel))
+    {
+      slot.state = state;
+      slot.ready.store(1, std::memory_order_release);
+      return;
+    }
+
+    // Another thread inserted (or is inserting) the same voxel
+    if (expected == packed)
+      return;
+  }
+
+  // Too crowded, leave this voxel uncached
+}
@@ -20,6 +20,9 @@
 #include "nbv_exploration/common.h"
 
 ViewGeneratorBase::ViewGeneratorBase():
+  mapping_module_(NULL),
+  collision_tree_(NULL),
+  collision_version_(0),
   vis_sphere_counter_(0),
   vis_marker_array_prev_size_(0)
 {
@@ -88,43 +91,34 @@ bool ViewGeneratorBase::isCollidingWithOctree(geometry_msgs::Pose p)
   /* Collision detection based on octomap
    * 
    * Source: https://github.com/kuri-kustar/laser_collision_detection/blob/master/src/laser_obstacle_detect.cpp#L135-L228
+   *
+   * The UAV is a sphere, tested against the occupied boxes of the octree near it only
    */
-  
-  // Create UAV collision object
-  fcl::Sphere Shpere0(collision_radius_);
-  std::shared_ptr<fcl::CollisionGeometry > cgeomSphere_(&Shpere0);
-  //boost::shared_ptr<fcl::Sphere>
-  
-  fcl::Transform3f tf0;
-  tf0.setIdentity();
-  tf0.setTranslation(fcl::Vec3f(p.position.x, p.position.y, p.position.z));
-
-
-  fcl::CollisionObject* co0 = new fcl::CollisionObject(cgeomSphere_, tf0);
+  octomap::point3d pt (
+        p.position.x,
+        p.position.y,
+        p.position.z);
 
   // Visualize
   visualizeDrawSphere(p, collision_radius_);
-  
-  bool collisionDetected = false;
 
-  for(size_t i = 0; i < collision_boxes_.size(); ++i)
+  // Far enough from every occupied voxel in the distance field, no need to test the boxes
+  // The margin covers the voxel half-diagonal both at the query point and at the obstacle,
+  // plus a voxel diagonal for the error of propagating nearest obstacles between neighbors.
+  // Closer poses fall back to the index
+  EsdfMap* esdf = mapping_module_ ? mapping_module_->getEsdf() : NULL;
+  if (esdf)
   {
-    fcl::CollisionObject* box =  collision_boxes_[i];
-    static const int num_max_contacts = std::numeric_limits<int>::max();
-    static const bool enable_contact = true ;
+    double margin = collision_radius_ + 2*esdf->getResolution()*sqrt(3);
+    octomap::point3d extent (margin, margin, margin);
 
-    fcl::CollisionResult result;
-    fcl::CollisionRequest request(num_max_contacts, enable_contact);
-    fcl::collide(co0, box, request, result);
-
-    if ( result.isCollision() )
-    {
-      collisionDetected = true;
-      break;
-    }
+    if (margin < esdf->getMaxDistance() &&
+        esdf->contains(pt - extent) && esdf->contains(pt + extent) &&
+        esdf->getDistance(pt) > margin)
+      return false;
   }
-  
-  return collisionDetected;
+
+  return collision_index_.isSphereColliding(pt, collision_radius_);
 }
 
 bool ViewGeneratorBase::isInFreeSpace(geometry_msgs::Pose p)
@@ -187,6 +181,9 @@ bool ViewGeneratorBase::isValidViewpoint(geometry_msgs::Pose p)
 void ViewGeneratorBase::setCollisionRadius(double r)
 {
   collision_radius_ = r;
+
+  // A sphere query reaches half a voxel past the radius, so it spans at most 4 cells per axis
+  collision_index_.setCellSize(r);
 }
 
 void ViewGeneratorBase::setCurrentPose(geometry_msgs::Pose p)
@@ -241,24 +238,80 @@ void ViewGeneratorBase::setObjectBounds(double x_min, double x_max, double y_min
 
 void ViewGeneratorBase::updateCollisionBoxesFromOctomap()
 {
-  // convert the octomap::octree to fcl::octree fcl_octree object
-  fcl::OcTree* tree2 = new fcl::OcTree(std::shared_ptr<const octomap::OcTree>(tree_));
-  std::vector<std::array<fcl::FCL_REAL, 6> > boxes = tree2->toBoxes();
+  if (!tree_)
+  {
+    collision_index_.clear();
+    collision_tree_ = NULL;
+    return;
+  }
 
-  collision_boxes_.clear();
-  for(std::size_t i = 0; i < boxes.size(); ++i)
+  // Read before the changes, anything integrated meanwhile is replayed next time (replaying has no effect)
+  unsigned long version = mapping_module_->getMapVersion();
+
+  bool is_full_update = (tree_ != collision_tree_);
+  if (!is_full_update)
+  {
+    // Falls back to a full rebuild if the change log no longer reaches back to the index
+    map_changes_.clear();
+    is_full_update = !mapping_module_->getMapChanges(collision_version_, map_changes_);
+  }
+
+  if (is_full_update)
+  {
+    timer.start("[ViewGeneratorBase]updateCollisionBoxesFromOctomap-full");
+    collision_index_.clear();
+    collision_index_.setResolution(tree_->getResolution());
+
+    // Pruned leaves are split into voxels, so single voxels can later be erased
+    int max_depth = tree_->getTreeDepth();
+    for (octomap::OcTree::leaf_iterator it = tree_->begin_leafs(), end = tree_->end_leafs(); it != end; ++it)
+    {
+      if (!tree_->isNodeOccupied(*it))
+        continue;
+
+      octomap::OcTreeKey key_min = it.getIndexKey();
+      int side = 1 << (max_depth - it.getDepth());
+
+      octomap::OcTreeKey key;
+      for (int x=0; x<side; x++)
+      {
+        key[0] = key_min[0] + x;
+        for (int y=0; y<side; y++)
+        {
+          key[1] = key_min[1] + y;
+          for (int z=0; z<side; z++)
+          {
+            key[2] = key_min[2] + z;
+            collision_index_.insert(key);
+          }
+        }
+      }
+    }
+    timer.stop("[ViewGeneratorBase]updateCollisionBoxesFromOctomap-full");
+  }
+  else
+  {
+    // Only the voxels changed since the last update are touched
+    float occupied_log_odds = tree_->getOccupancyThresLog();
+    for (size_t i=0; i<map_changes_.size(); i++)
+    {
+      // NaN (unknown) compares false, i.e. not occupied
+      if (map_changes_[i].log_odds_new >= occupied_log_odds)
+        collision_index_.insert(map_changes_[i].key);
+      else
+        collision_index_.erase(map_changes_[i].key);
+    }
+  }
+
+  collision_tree_ = tree_;
+  collision_version_ = version;
+
+  if (is_debug_)
   {
-    fcl::FCL_REAL x = boxes[i][0];
-    fcl::FCL_REAL y = boxes[i][1];
-    fcl::FCL_REAL z = boxes[i][2];
-    fcl::FCL_REAL size = boxes[i][3];
-    fcl::FCL_REAL cost = boxes[i][4];
-    fcl::FCL_REAL threshold = boxes[i][5];
-    fcl::Box* box = new fcl::Box(size, size, size);
-    box->cost_density = cost;
-    box->threshold_occupied = threshold;
-    fcl::CollisionObject* obj = new fcl::CollisionObject(std::shared_ptr<fcl::CollisionGeometry>(box), fcl::Transform3f(fcl::Vec3f(x, y, z)));
-    collision_boxes_.push_back(obj);
+    if (is_full_update)
+      std::cout << "[ViewGeneratorBase]: Rebuilt collision index of " << collision_index_.size() << " voxels\n";
+    else
+      std::cout << "[ViewGeneratorBase]: Updated collision index with " << map_changes_.size() << " changed voxels\n";
   }
 }
 
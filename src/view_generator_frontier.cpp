@@ -1,5 +1,4 @@
 #include <iostream>
-#include <queue>          // std::queue
 #include <stdlib.h>
 #include <ros/ros.h>
 
@@ -22,6 +21,12 @@ ViewGeneratorFrontier::ViewGeneratorFrontier():
   ros::param::param<double>("~view_generator_frontier_cylinder_radius", cylinder_radius_, 3.0);
   ros::param::param<double>("~view_generator_frontier_cylinder_height", cylinder_height_, 1.0);
   ros::param::param<double>("~view_generator_frontier_density_threshold", density_threshold_, 10);
+  ros::param::param<bool>("~view_generator_frontier_use_entropy", is_using_entropy_frontiers_, false);
+
+  // Same neighborhood as isNear()
+  clusterer_.setRadius(2);
+  density_clusterer_.setRadius(2);
+  frontier_clusterer_.setRadius(2);
 
   ros::NodeHandle ros_node;
   pub_vis_frontier_points_ = ros_node.advertise<sensor_msgs::PointCloud2>("nbv_exploration/generation/frontier_points", 10);
@@ -30,64 +35,9 @@ ViewGeneratorFrontier::ViewGeneratorFrontier():
 std::vector<std::vector<octomap::OcTreeKey> >
 ViewGeneratorFrontier::findFrontierAdjacencies(std::vector<octomap::OcTreeKey>& cells)
 {
+  // Cells are linked when they are near (see isNear()), small clusters do not count as frontiers
   std::vector<std::vector<octomap::OcTreeKey> > list;
-  int cell_count = cells.size();
-
-  std::vector<bool> was_cell_checked;
-  was_cell_checked.assign(cell_count, false); //fill the vector with "false"
-
-  for (int i_cell=0; i_cell<cell_count && ros::ok(); i_cell++)
-  {
-    // Cell was already checked, move along
-    if (was_cell_checked[i_cell])
-      continue;
-
-    // key_list contains the final linked keys
-    // key_queue is pushed and popped recursively until we find all linked cells
-    std::vector<octomap::OcTreeKey> key_list;
-    std::queue<KeyIndex> key_queue;
-
-    KeyIndex ki;
-    ki.key = cells[i_cell];
-    ki.index = i_cell;
-
-    key_queue.push(ki);
-
-    // @todo: requires HEAVY optimization
-    // Looks around the current cell for linked cells
-    while (key_queue.size() > 0)
-    {
-      KeyIndex ki_dequeue = key_queue.front();
-      key_queue.pop();
-
-      if (was_cell_checked[ki_dequeue.index])
-        continue;
-      was_cell_checked[ki_dequeue.index] = true;
-      key_list.push_back(ki_dequeue.key);
-
-      // Check if any remaining cells are neighbors
-      for (int i_check=0; i_check<cell_count; i_check++)
-      {
-        if (was_cell_checked[i_check])
-          continue;
-
-        if ( isNear(cells[ki_dequeue.index], cells[i_check]) )
-        {
-          KeyIndex ki_new;
-          ki_new.key = cells[i_check];
-          ki_new.index = i_check;
-
-          key_queue.push(ki_new);
-        }
-      } //end checking for neighbors
-    } //end queue
-
-    // Not enough frontier cells, do not count this as a frontier
-    if (key_list.size() < minimum_frontier_size_)
-      continue;
-
-    list.push_back(key_list);
-  } //end for
+  clusterer_.cluster(cells, list, minimum_frontier_size_);
 
   return list;
 }
@@ -97,6 +47,13 @@ std::vector<octomap::OcTreeKey> ViewGeneratorFrontier::findFrontierCells()
   int treeDepth = 16;
   std::vector<octomap::OcTreeKey> frontier_keys;
 
+  // Maintained by the mapping module as frames are integrated
+  if (mapping_module_->isTrackingFrontiers())
+  {
+    mapping_module_->getFrontierCells(frontier_keys);
+    return frontier_keys;
+  }
+
 
   for (octomap::OcTree::iterator it = tree_->begin(treeDepth), end = tree_->end(); it != end; ++it)
   {
@@ -149,21 +106,26 @@ std::vector<octomap::OcTreeKey> ViewGeneratorFrontier::findFrontierCells()
 
 std::vector<std::vector<octomap::OcTreeKey> > ViewGeneratorFrontier::findFrontiers()
 {
-  /*
-  std::vector<octomap::OcTreeKey> frontier_cells = findFrontierCells();
+  // Frontier cells are only used when asked for and the mapping module keeps them up to date,
+  // finding them in the whole tree at every iteration is too slow
+  std::vector<octomap::OcTreeKey> frontier_cells;
   std::vector<std::vector<octomap::OcTreeKey> > frontier_list;
-  frontier_list = findFrontierAdjacencies(frontier_cells);
-  */
+  if (is_using_entropy_frontiers_ && mapping_module_->isTrackingFrontiers())
+  {
+    frontier_cells = findFrontierCells();
+    frontier_clusterer_.update(frontier_cells, frontier_list, minimum_frontier_size_);
+  }
 
+  // The low density cells change little between iterations, only the clusters they touch are rebuilt
   std::vector<octomap::OcTreeKey> low_density_cells = findLowDensityCells();
   std::vector<std::vector<octomap::OcTreeKey> > density_list;
-  density_list  = findFrontierAdjacencies(low_density_cells);
+  density_clusterer_.update(low_density_cells, density_list, minimum_frontier_size_);
 
-  //printf("[ViewGeneratorFrontier] Frontiers -- Entropy: %lu\tDensity: %lu\n", frontier_list.size(), density_list.size() );
-  printf("[ViewGeneratorFrontier] Density Frontiers -- Cells %lu\tClusters: %lu\n", low_density_cells.size(), density_list.size() );
+  printf("[ViewGeneratorFrontier] Frontiers -- Entropy: %lu (%lu cells)\tDensity: %lu (%lu cells)\n",
+         frontier_list.size(), frontier_cells.size(), density_list.size(), low_density_cells.size() );
 
   std::vector<std::vector<octomap::OcTreeKey> > final_list;
-  //final_list.insert(final_list.end(), frontier_list.begin(), frontier_list.end());
+  final_list.insert(final_list.end(), frontier_list.begin(), frontier_list.end());
   final_list.insert(final_list.end(), density_list.begin(), density_list.end());
 
   return final_list;
@@ -174,6 +136,13 @@ std::vector<octomap::OcTreeKey> ViewGeneratorFrontier::findLowDensityCells()
   int treeDepth = 16;
   std::vector<octomap::OcTreeKey> density_keys;
 
+  // Maintained by the mapping module as densities are updated
+  if (mapping_module_->isTrackingFrontiers())
+  {
+    mapping_module_->getLowDensityCells(density_keys);
+    return density_keys;
+  }
+
   for (octomap::OcTree::iterator it = tree_->begin(treeDepth), end = tree_->end(); it != end; ++it)
   {
     octomap::OcTreeKey key = it.getKey();
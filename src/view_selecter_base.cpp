@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <ros/ros.h>
@@ -15,15 +16,45 @@
 #include "nbv_exploration/common.h"
 
 
+namespace
+{
+// Orders candidate indices by decreasing coarse utility, then in generation order
+struct CoarseUtilityGreater
+{
+  const std::vector<ViewSelecterBase::ViewContext>& contexts;
+
+  CoarseUtilityGreater(const std::vector<ViewSelecterBase::ViewContext>& c) : contexts(c) {}
+
+  bool operator()(int a, int b) const
+  {
+    if (contexts[a].utility_coarse != contexts[b].utility_coarse)
+      return contexts[a].utility_coarse > contexts[b].utility_coarse;
+    return a < b;
+  }
+};
+}
+
+
 ViewSelecterBase::ViewSelecterBase():
   info_iteration_(0),
   info_distance_total_(0),
   info_selected_utility_(-std::numeric_limits<float>::infinity()), //-inf
   info_selected_utility_density_(std::numeric_limits<double>::quiet_NaN()),
-  temp_utility_distance_(std::numeric_limits<double>::quiet_NaN()),
+  info_selected_utility_distance_(std::numeric_limits<double>::quiet_NaN()),
   info_selected_utility_entropy_(std::numeric_limits<double>::quiet_NaN()),
   info_selected_utility_prediction_(std::numeric_limits<double>::quiet_NaN()),
-  info_selected_occupied_voxels_(0)
+  info_selected_occupied_voxels_(0),
+  is_drawing_rays_(false),
+  is_rendering_predicted_(false),
+  voxel_cache_version_(0),
+  voxel_cache_tree_(NULL),
+  grid_version_(0),
+  grid_entropy_(0),
+  grid_updates_since_full_(0),
+  coarse_evaluations_(0),
+  rays_h_count_(0),
+  rays_v_count_(0),
+  rays_step_(0)
 {
   ros::NodeHandle n;
   marker_pub     = n.advertise<visualization_msgs::Marker>("visualization_marker", 10);
@@ -36,6 +67,27 @@ ViewSelecterBase::ViewSelecterBase():
   ros::param::param("~debug_view_selecter", is_debug_, true);
   ros::param::param("~view_selecter_must_see_occupied", must_see_occupied_, true);
   ros::param::param("~view_selecter_ignore_entropies_at_clamping_points", is_ignoring_clamping_entropies_, true);
+  ros::param::param("~view_selecter_voxel_cache_size", voxel_cache_size_, 1<<20);
+  ros::param::param("~view_selecter_entropy_full_update_interval", grid_full_update_interval_, 10);
+  ros::param::param("~view_selecter_visibility_type", visibility_type_, (int)VISIBILITY_RAYCAST);
+  ros::param::param("~view_selecter_ray_cache_size", ray_cache_size_, 256);
+  ros::param::param("~view_selecter_ray_sampling", ray_sampling_, (int)RAY_SAMPLING_GRID);
+  ros::param::param("~view_selecter_ray_jitter", ray_jitter_, (int)RaySampler::JITTER_NONE);
+  ros::param::param("~view_selecter_ray_budget", ray_budget_, 0);
+
+  // The z-buffer draws into the pixels of a regular grid
+  if (visibility_type_ == VISIBILITY_ZBUFFER && ray_sampling_ != RAY_SAMPLING_GRID)
+  {
+    std::cout << "[ViewSelecterBase]: " << cc.yellow << "Warning: z-buffer visibility requires grid ray sampling, ignoring ray sampling setting\n" << cc.reset;
+    ray_sampling_ = RAY_SAMPLING_GRID;
+  }
+
+  ros::param::param("~view_selecter_coarse_pruning", is_coarse_pruning_, false);
+  ros::param::param("~view_selecter_coarse_top_k", coarse_top_k_, 10);
+  ros::param::param("~view_selecter_coarse_ray_step", coarse_ray_step_, 4);
+  ros::param::param("~view_selecter_coarse_depth", coarse_depth_, 14);
+  ros::param::param("~view_selecter_coarse_check_interval", coarse_check_interval_, 10);
+  coarse_ray_step_ = std::max(coarse_ray_step_, 1);
 
 
 
@@ -55,30 +107,35 @@ ViewSelecterBase::ViewSelecterBase():
   getCameraRotationMtxs();
 }
 
-void ViewSelecterBase::addToRayMarkers(octomap::point3d origin, octomap::point3d endpoint)
+void ViewSelecterBase::addToRayMarkers(ViewContext& ctx, octomap::point3d origin, octomap::point3d endpoint)
 {
+  if (!is_drawing_rays_)
+    return;
+
   geometry_msgs::Point p;
 
   // Start
   p.x = origin.x();
   p.y = origin.y();
   p.z = origin.z();
-  ray_msg.points.push_back(p);
+  ctx.ray_msg.points.push_back(p);
 
   // End
   p.x = endpoint.x();
   p.y = endpoint.y();
   p.z = endpoint.z();
-  ray_msg.points.push_back(p);
+  ctx.ray_msg.points.push_back(p);
 }
 
-double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
+double ViewSelecterBase::calculateIG(ViewContext& ctx)
 {
   // Source: Borrowed partially from
   // https://github.com/uzh-rpg/rpg_ig_active_reconstruction/blob/master/ig_active_reconstruction_octomap/src/code_base/octomap_basic_ray_ig_calculator.inl
   double t_start, t_end;
   t_start = ros::Time::now().toSec();
 
+  const geometry_msgs::Pose& p = ctx.pose;
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
   octomap::point3d origin (p.position.x, p.position.y, p.position.z);
 
   int nodes_traversed = 0;
@@ -87,27 +144,33 @@ double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
   int nodes_unknown = 0;
   int nodes_unobserved = 0;
 
-  std::set<octomap::OcTreeKey, OctomapKeyCompare> nodes; //all nodes in a set are UNIQUE
+  VoxelHashSet& nodes = ctx.keys; //all nodes in a set are UNIQUE
+  nodes.clear();
 
-  clearRayMarkers();
+  clearRayMarkers(ctx);
   double ig_total = 0;
 
-  for (int i=0; i<rays_far_plane_at_pose_.size(); i++)
+  // Cast through unknown cells as well as free cells, collecting the traversed nodes in the same pass
+  castRays(ctx, origin);
+  const RayMarcher& marcher = ctx.ray_marcher;
+
+  const std::vector<octomap::OcTreeKey>&   ray_keys  = marcher.getKeys();
+  const std::vector<octomap::OcTreeNode*>& ray_nodes = marcher.getNodes();
+
+  for (int i=0; i<rays.size(); i++)
   {
+    const RayMarcher::Ray& marched = marcher.getRays()[i];
     double ig_ray = 0;
     octomap::point3d endpoint;
 
     // Get length of beam to the far plane of sensor
-    double range = rays_far_plane_at_pose_[i].norm();
+    double range = rays.length[i];
 
     // Get the direction of the ray
-    octomap::point3d dir = rays_far_plane_at_pose_[i].normalize();
+    octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
 
-
-
-
-    // Cast through unknown cells as well as free cells
-    bool found_endpoint = tree_->castRay(origin, dir, endpoint, true, range);
+    bool found_endpoint = marched.found_endpoint;
+    endpoint = marched.endpoint;
     if (!found_endpoint)
     {
       endpoint = origin + dir * range;
@@ -130,12 +193,9 @@ double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
      *
      */
 
-    octomap::KeyRay ray;
-    tree_->computeRayKeys( origin, endpoint, ray );
-
-    for( octomap::KeyRay::iterator it = ray.begin() ; it!=ray.end(); ++it )
+    for (int k=marched.first; k<marched.first+marched.count; k++)
     {
-      octomap::point3d p = tree_->keyToCoord(*it);
+      octomap::point3d p = tree_->keyToCoord(ray_keys[k]);
 
       if (!entered_valid_range)
       {
@@ -164,13 +224,13 @@ double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
       }
 
       // Add point to IG
-      octomap::OcTreeNode* node = tree_->search(*it);
-      ig_ray += getNodeEntropy(node);
+      VoxelStateCache::VoxelState state = getVoxelState(ctx, ray_keys[k], ray_nodes[k]);
+      ig_ray += state.entropy;
 
       //nodes.insert(*it);
       nodes_traversed++;
 
-      double prob = getNodeOccupancy(node);
+      double prob = state.occupancy;
       if (prob > 0.8)
         nodes_occ++;
       else if (prob < 0.2)
@@ -207,18 +267,12 @@ double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
     start_pt = origin + dir * (dir.dot(start_pt-origin)/dir.dot(dir));
     end_pt = origin + dir * (dir.dot(end_pt-origin)/dir.dot(dir));
 
-    addToRayMarkers(start_pt, end_pt);
+    addToRayMarkers(ctx, start_pt, end_pt);
   }
 
-  //if(is_debug_)
-  //{
-    publishRayMarkers();
-    publishPose(p);
-  //}
-
   /*
   int nodes_processed = nodes.size();
-  for (std::set<octomap::OcTreeKey>::iterator it=nodes.begin(); it!=nodes.end(); ++it)
+  for (VoxelHashSet::iterator it=nodes.begin(); it!=nodes.end(); ++it)
   {
     octomap::OcTreeNode* node = tree_->search(*it);
     ig_total += getNodeEntropy(node);
@@ -247,7 +301,7 @@ double ViewSelecterBase::calculateIG(geometry_msgs::Pose p)
     std::cout << "\nIG: " << ig_total << "\tAverage IG: " << ig_total/nodes_processed <<"\n";
     std::cout << "Unobserved: " << nodes_unobserved << "\tUnknown: " << nodes_unknown << "\tOcc: " << nodes_occ << "\tFree: " << nodes_free << "\n";
     std::cout << "Time: " << t_end-t_start << " sec\tNodes: " << nodes_processed << "/" << nodes_traversed<< " (" << 1000*(t_end-t_start)/nodes_processed << " ms/node)\n";
-    std::cout << "\tAverage nodes per ray: " << nodes_traversed/rays_far_plane_at_pose_.size() << "\n";
+    std::cout << "\tAverage nodes per ray: " << nodes_traversed/rays.size() << "\n";
   }
   return ig_total;
 }
@@ -280,17 +334,132 @@ double ViewSelecterBase::calculateAngularDistance(geometry_msgs::Pose p)
   return fabs(yaw_diff);
 }
 
-double ViewSelecterBase::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterBase::calculateUtility(ViewContext& ctx)
 {
   std::cout << "[ViewSelecterBase]: " << cc.yellow << "Warning: calculateUtility() not implimented, defaulting to classical IG calculation\n" << cc.reset;
-  double IG = calculateIG(p);
+  double IG = calculateIG(ctx);
   //double effort = calculateDistance(p) + calculateAngularDistance(p)/M_PI;
 
   return IG;// /effort;
 }
 
-void ViewSelecterBase::clearRayMarkers()
+void ViewSelecterBase::castRays(ViewContext& ctx, const octomap::point3d& origin)
 {
+  if (visibility_type_ == VISIBILITY_ZBUFFER)
+  {
+    castRaysZBuffer(ctx, origin);
+    return;
+  }
+
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
+  ctx.ray_marcher.setTree(tree_, &grid_);
+  ctx.ray_marcher.castRays(origin, rays.dir_x.data(), rays.dir_y.data(), rays.dir_z.data(), rays.length.data(), rays.size(),
+                           rays.start.data(), rays.parent.data());
+}
+
+bool ViewSelecterBase::castRayPredicted(ViewContext& ctx, octomap::OcTree* tree_predicted, int ray, const octomap::point3d& origin,
+                                        const octomap::point3d& dir, double range, octomap::point3d& endpoint)
+{
+  // First occupied voxel of the predicted tree along the ray, read from the z-buffer when it was drawn
+  if (visibility_type_ == VISIBILITY_ZBUFFER && is_rendering_predicted_)
+  {
+    int voxel = ctx.predicted_hits[ray];
+    if (voxel < 0)
+      return false;
+
+    endpoint = tree_->keyToCoord(predicted_keys_[voxel]);
+    return true;
+  }
+
+  return tree_predicted->castRay(origin, dir, endpoint, true, range);
+}
+
+void ViewSelecterBase::castRaysZBuffer(ViewContext& ctx, const octomap::point3d& origin)
+{
+  /*
+   * Same results as RayMarcher::castRays(), but the first hit of each ray
+   * comes from a z-buffer of the occupied voxels in the snapshot. Pixels are
+   * the far plane rays of each camera, and only the voxels in front of the hit
+   * and within the snapshot are walked. No node is looked up, getVoxelState()
+   * reads the snapshot instead.
+   *
+   * Occupied voxels outside the bounds are not drawn, so they do not occlude.
+   *
+   * When a selecter uses the predicted tree, its occupied voxels are drawn
+   * into a second buffer, and castRayPredicted() reads the hits from there.
+   */
+  RayMarcher& marcher = ctx.ray_marcher;
+  DepthRasterizer& rasterizer = ctx.rasterizer;
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
+
+  marcher.setTree(tree_, &grid_);
+  marcher.clear();
+
+  double deg2rad = M_PI/180;
+  rasterizer.setCamera(rays_h_count_, rays_v_count_,
+                       -tan(fov_horizontal_/2 * deg2rad),
+                       -tan(fov_vertical_/2 * deg2rad),
+                       rays_step_/range_max_);
+
+  Eigen::Matrix3d r_pose = pose_conversion::getRotationMatrix(ctx.pose);
+  Eigen::Vector3d position (origin.x(), origin.y(), origin.z());
+  int rays_per_camera = rays_far_plane_.size();
+
+  if (is_rendering_predicted_)
+  {
+    ctx.rasterizer_predicted.setCamera(rays_h_count_, rays_v_count_,
+                                       -tan(fov_horizontal_/2 * deg2rad),
+                                       -tan(fov_vertical_/2 * deg2rad),
+                                       rays_step_/range_max_);
+    ctx.predicted_hits.assign(rays.size(), -1);
+  }
+
+  // Cameras are rendered one after the other into the context's rasterizer and marcher.
+  // Candidates are already evaluated concurrently, one context per thread, so a parallel
+  // loop here would only nest inside a loop that already uses every core
+  for (int c=0; c<camera_count_; c++)
+  {
+    rasterizer.render(r_pose * camera_rotation_mtx_[c], position,
+                      occupied_x_.data(), occupied_y_.data(), occupied_z_.data(), occupied_x_.size(),
+                      tree_resolution_/2, range_max_);
+
+    for (int r=0; r<rays_per_camera; r++)
+    {
+      int i = c*rays_per_camera + r;
+      octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
+      double range = rays.length[i];
+      int voxel = rasterizer.getVoxel(r);
+
+      // Stop just before the ray enters the hit voxel
+      double length = range;
+      if (voxel >= 0)
+        length = rasterizer.getDepth(r) - 1e-3*tree_resolution_;
+
+      RayMarcher::Ray& marched = marcher.walkRay(origin, dir, length);
+      if (voxel >= 0)
+      {
+        marched.endpoint = tree_->keyToCoord(occupied_keys_[voxel]);
+        marched.end_key = occupied_keys_[voxel];
+        marched.has_end_key = true;
+        marched.found_endpoint = true;
+      }
+    }
+
+    if (is_rendering_predicted_)
+    {
+      ctx.rasterizer_predicted.render(r_pose * camera_rotation_mtx_[c], position,
+                                      predicted_x_.data(), predicted_y_.data(), predicted_z_.data(), predicted_x_.size(),
+                                      tree_resolution_/2, range_max_);
+
+      for (int r=0; r<rays_per_camera; r++)
+        ctx.predicted_hits[c*rays_per_camera + r] = ctx.rasterizer_predicted.getVoxel(r);
+    }
+  }
+}
+
+void ViewSelecterBase::clearRayMarkers(ViewContext& ctx)
+{
+  visualization_msgs::Marker& ray_msg = ctx.ray_msg;
   ray_msg.id = 0;
   ray_msg.type = visualization_msgs::Marker::LINE_LIST;
   ray_msg.scale.x = 0.05;
@@ -308,6 +477,33 @@ void ViewSelecterBase::clearRayMarkers()
 double ViewSelecterBase::computeRelativeRays()
 {
   rays_far_plane_.clear();
+  rays_start_.clear();
+  rays_range_.clear();
+  rays_parent_.clear();
+  rays_coarse_idx_.clear();
+  rays_h_count_ = rays_v_count_ = 0;
+
+  if (ray_sampling_ == RAY_SAMPLING_BANDS)
+  {
+    std::vector<RaySampler::Ray> rays;
+    ray_sampler_.setCamera(fov_horizontal_, fov_vertical_, range_max_);
+    ray_sampler_.sample(tree_resolution_, ray_budget_, (RaySampler::Jitter)ray_jitter_, rays);
+
+    // Coarse estimates sample whole rays, taken from the band that reaches the far plane
+    int last_band = rays.empty() ? 0 : rays.back().band;
+
+    for (int i=0; i<rays.size(); i++)
+    {
+      if (rays[i].band == last_band && rays[i].ix % coarse_ray_step_ == 0 && rays[i].iy % coarse_ray_step_ == 0)
+        rays_coarse_idx_.push_back(i);
+
+      rays_far_plane_.push_back(rays[i].far);
+      rays_start_.push_back(rays[i].start);
+      rays_range_.push_back(rays[i].range);
+      rays_parent_.push_back(rays[i].parent);
+    }
+    return 0;
+  }
 
   double deg2rad = M_PI/180;
   double min_x = -range_max_ * tan(fov_horizontal_/2 * deg2rad);
@@ -315,42 +511,37 @@ double ViewSelecterBase::computeRelativeRays()
   double max_x =  range_max_ * tan(fov_horizontal_/2 * deg2rad);
   double max_y =  range_max_ * tan(fov_vertical_/2 * deg2rad);
 
-  double x_step = tree_resolution_;
-  double y_step = tree_resolution_;
+  // Widen the grid evenly until it fits the budget
+  rays_step_ = tree_resolution_;
+  while (ray_budget_ > 0 && (floor((max_x-min_x)/rays_step_)+1)*(floor((max_y-min_y)/rays_step_)+1) > ray_budget_)
+    rays_step_ *= 1.05;
+
+  double x_step = rays_step_;
+  double y_step = rays_step_;
 
-  for( double x = min_x; x<=max_x; x+=x_step )
+  int ix = 0;
+  for( double x = min_x; x<=max_x; x+=x_step, ix++ )
   {
-    for( double y = min_y; y<=max_y; y+=y_step )
+    int iy = 0;
+    for( double y = min_y; y<=max_y; y+=y_step, iy++ )
     {
+      if (ix % coarse_ray_step_ == 0 && iy % coarse_ray_step_ == 0)
+        rays_coarse_idx_.push_back(rays_far_plane_.size());
+
       Eigen::Vector3d p_far(range_max_, x, y);
       rays_far_plane_.push_back(p_far);
     }
   }
+
+  rays_h_count_ = ix;
+  rays_v_count_ = (ix > 0) ? rays_far_plane_.size()/ix : 0;
+  return 0;
 }
 
-void ViewSelecterBase::computeRaysAtPose(geometry_msgs::Pose p)
+void ViewSelecterBase::computeRaysAtPose(ViewContext& ctx)
 {
-  rays_far_plane_at_pose_.clear();
-
-  Eigen::Matrix3d r_pose, rotation_mtx_;
-  r_pose = pose_conversion::getRotationMatrix( p );
-
-  // For each camera, compute the rays
-  for (int c=0; c<camera_count_; c++)
-  {
-    rotation_mtx_ = r_pose * camera_rotation_mtx_[c];
-
-    for (int r=0; r<rays_far_plane_.size(); r++)
-    {
-      // Rotate ray to its final position
-      Eigen::Vector3d temp = rotation_mtx_*rays_far_plane_[r];
-
-      // Create an octomap point to later cast a ray
-      octomap::point3d p (temp[0], temp[1], temp[2]);
-      rays_far_plane_at_pose_.push_back(p);
-    }
-  }
-
+  // Not thread safe, rays are looked up before candidates are evaluated concurrently
+  ctx.rays = &ray_cache_.get( pose_conversion::getRotationMatrix(ctx.pose) );
 }
 
 void ViewSelecterBase::evaluate()
@@ -358,44 +549,133 @@ void ViewSelecterBase::evaluate()
   update();
 
   timer.start("[ViewSelecterBase]evaluate");
+
+  // Candidates only build ray markers if they can be published
+  is_drawing_rays_ = is_debug_ || marker_pub.getNumSubscribers() > 0;
+
   // Reset all variables of interest
   info_selected_utility_ = 0; //- std::numeric_limits<float>::infinity(); //-inf
   info_utilities_.clear();
   selected_pose_.position.x = std::numeric_limits<double>::quiet_NaN();
 
+  int pose_count = view_gen_->generated_poses.size();
+  view_contexts_.resize(pose_count);
+
+  // Rays are cached per orientation across evaluations, within a bound
+  if (ray_cache_.size() > ray_cache_size_)
+    ray_cache_.clear();
 
-  for (int i=0; i<view_gen_->generated_poses.size() && ros::ok(); i++)
+  long ray_cache_hits   = ray_cache_.getHitCount();
+  long ray_cache_misses = ray_cache_.getMissCount();
+
+  for (int i=0; i<pose_count; i++)
   {
-    geometry_msgs::Pose p = view_gen_->generated_poses[i];
-    computeRaysAtPose(p);
+    view_contexts_[i].pose = view_gen_->generated_poses[i];
+    computeRaysAtPose(view_contexts_[i]);
+    view_contexts_[i].utility = -1;
+    view_contexts_[i].is_pruned = false;
+    view_contexts_[i].cache_hits = 0;
+    view_contexts_[i].cache_misses = 0;
+  }
 
-    double utility = calculateUtility(p);
+  ray_cache_hits   = ray_cache_.getHitCount() - ray_cache_hits;
+  ray_cache_misses = ray_cache_.getMissCount() - ray_cache_misses;
+  if (pose_count > 0)
+    timer.record("[ViewSelecterBase]rayCache-hitRate", 100.0*ray_cache_hits/(ray_cache_hits + ray_cache_misses));
 
-    // Ignore invalid utility values (may arise if we rejected pose based on IG requirements)
-    if (utility>=0)
-      info_utilities_.push_back(utility);
+  // Cheap estimate first, only the most promising candidates are evaluated at full resolution
+  // Now and then all candidates are still evaluated, to see whether pruning changed the selection
+  int pruned_count = 0;
+  bool is_checking_pruning = false;
+  if (is_coarse_pruning_ && !is_debug_ && coarse_top_k_ > 0 && pose_count > coarse_top_k_)
+  {
+    pruned_count = pruneCandidates();
 
-    if (utility > info_selected_utility_)
-    {
-      info_selected_utility_            = utility;
-      info_selected_utility_density_    = temp_utility_density_;
-      info_selected_utility_distance_   = temp_utility_distance_;
-      info_selected_utility_entropy_    = temp_utility_entropy_;
-      info_selected_utility_prediction_ = temp_utility_prediction_;
-      info_selected_occupied_voxels_    = temp_occupied_voxels_;
-
-      selected_pose_ = p;
-    }
+    coarse_evaluations_++;
+    is_checking_pruning = (coarse_check_interval_ > 0 && coarse_evaluations_ % coarse_check_interval_ == 0);
+  }
 
-    if (is_debug_)
+  if (is_debug_)
+  {
+    // Step through poses one at a time
+    for (int i=0; i<pose_count && ros::ok(); i++)
     {
-      std::cout << "Utility of pose[" << i << "]: " << utility << "\n";
+      evaluateCandidate(view_contexts_[i]);
+      publishRayMarkers(view_contexts_[i]);
+      publishPose(view_contexts_[i].pose);
+
+      std::cout << "Utility of pose[" << i << "]: " << view_contexts_[i].utility << "\n";
 
       //std::cout << "[ViewSelecterBase::evaluate] Looking at pose[" << i << "]:\nx = " << p.position.x << "\ty = "  << p.position.y << "\tz = "  << p.position.z << "\n";
       std::cout << "Press ENTER to continue\n";
       std::cin.get();
     }
-  } //end for
+  }
+  else
+  {
+    // Candidates only read the octrees and density map, and write to their own context,
+    // so they are scored concurrently
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<pose_count; i++)
+    {
+      if (ros::ok() && (!view_contexts_[i].is_pruned || is_checking_pruning))
+        evaluateCandidate(view_contexts_[i]);
+    }
+  }
+
+  if (is_checking_pruning)
+  {
+    // Best full utility with and without the pruned candidates
+    int best_all = -1, best_kept = -1;
+    for (int i=0; i<pose_count; i++)
+    {
+      const ViewContext& ctx = view_contexts_[i];
+      if (ctx.utility > 0 && (best_all < 0 || ctx.utility > view_contexts_[best_all].utility))
+        best_all = i;
+      if (!ctx.is_pruned && ctx.utility > 0 && (best_kept < 0 || ctx.utility > view_contexts_[best_kept].utility))
+        best_kept = i;
+    }
+
+    timer.record("[ViewSelecterBase]coarse-selectionChanged", best_all != best_kept ? 100 : 0);
+    if (best_all != best_kept)
+      std::cout << "[ViewSelecterBase]: " << cc.yellow << "Coarse pruning would have discarded the best view (" << best_all << " instead of " << best_kept << ")\n" << cc.reset;
+  }
+
+  if (pruned_count > 0)
+    timer.record("[ViewSelecterBase]coarse-pruneRate", 100.0*pruned_count/pose_count);
+
+  // Pick the best pose in generation order, so ties resolve as in a sequential scan
+  int selected_idx = -1;
+  long cache_hits = 0;
+  long cache_lookups = 0;
+  for (int i=0; i<pose_count; i++)
+  {
+    const ViewContext& ctx = view_contexts_[i];
+    cache_hits    += ctx.cache_hits;
+    cache_lookups += ctx.cache_hits + ctx.cache_misses;
+
+    // Ignore invalid utility values (may arise if we rejected pose based on IG requirements)
+    if (ctx.utility>=0)
+      info_utilities_.push_back(ctx.utility);
+
+    if (ctx.utility > info_selected_utility_)
+    {
+      info_selected_utility_            = ctx.utility;
+      info_selected_utility_density_    = ctx.utility_density;
+      info_selected_utility_distance_   = ctx.utility_distance;
+      info_selected_utility_entropy_    = ctx.utility_entropy;
+      info_selected_utility_prediction_ = ctx.utility_prediction;
+      info_selected_occupied_voxels_    = ctx.occupied_voxels;
+
+      selected_pose_ = ctx.pose;
+      selected_idx = i;
+    }
+  }
+
+  if (cache_lookups > 0)
+    timer.record("[ViewSelecterBase]voxelCache-hitRate", 100.0*cache_hits/cache_lookups);
 
 
   // No valid poses found, end
@@ -404,6 +684,13 @@ void ViewSelecterBase::evaluate()
     return;
   }
 
+  // Show the rays of the selected pose
+  if (!is_debug_)
+  {
+    publishRayMarkers(view_contexts_[selected_idx]);
+    publishPose(selected_pose_);
+  }
+
   // Increase total distance travelled
   info_distance_total_ += calculateDistance(selected_pose_);
   publishTrajectory();
@@ -411,6 +698,77 @@ void ViewSelecterBase::evaluate()
   timer.stop("[ViewSelecterBase]evaluate");
 }
 
+void ViewSelecterBase::evaluateCandidate(ViewContext& ctx)
+{
+  // Components are only filled in by selecters that report them
+  ctx.utility_density    = std::numeric_limits<float>::quiet_NaN();
+  ctx.utility_distance   = std::numeric_limits<float>::quiet_NaN();
+  ctx.utility_entropy    = std::numeric_limits<float>::quiet_NaN();
+  ctx.utility_prediction = std::numeric_limits<float>::quiet_NaN();
+  ctx.occupied_voxels    = 0;
+
+  ctx.utility = calculateUtility(ctx);
+}
+
+double ViewSelecterBase::estimateUtilityCoarse(ViewContext& ctx)
+{
+  /*
+   * Entropy along a sparse subset of the rays, sampled once per voxel of the
+   * coarse depth. Samples read the snapshot of the bounds, so rays only count
+   * within the bounds. A ray stops at the first occupied sample.
+   */
+  const geometry_msgs::Pose& p = ctx.pose;
+  octomap::point3d origin (p.position.x, p.position.y, p.position.z);
+
+  int levels = tree_->getTreeDepth() - coarse_depth_;
+  if (levels < 0)
+    levels = 0;
+  double weight = 1 << levels; // Voxels represented by one sample
+  double step = tree_resolution_ * weight;
+  double occupancy_thres = tree_->getOccupancyThres();
+
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
+  int rays_per_camera = rays_far_plane_.size();
+
+  double ig_total = 0;
+  int samples_occ = 0;
+
+  for (int c=0; c<camera_count_; c++)
+  {
+    for (int r=0; r<rays_coarse_idx_.size(); r++)
+    {
+      int i = c*rays_per_camera + rays_coarse_idx_[r];
+      double range = rays.range[i];
+      octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
+
+      for (double t=step/2; t<range; t+=step)
+      {
+        octomap::OcTreeKey key;
+        if (!tree_->coordToKeyChecked(origin + dir*t, key))
+          break;
+
+        if (!grid_.contains(key))
+          continue;
+
+        int8_t code = grid_.getCode(key);
+        if (grid_.isKnown(code) && grid_.getOccupancy(code) >= occupancy_thres)
+        {
+          samples_occ++;
+          break;
+        }
+
+        ig_total += weight * grid_.getEntropy(code, is_ignoring_clamping_entropies_);
+      }
+    }
+  }
+
+  // Same rejection as the full evaluation
+  if (must_see_occupied_ && samples_occ == 0)
+    return -1;
+
+  return ig_total;
+}
+
 void ViewSelecterBase::getCameraRotationMtxs()
 {
   tf::TransformListener tf_listener;
@@ -509,6 +867,74 @@ double ViewSelecterBase::getNodeEntropy(octomap::OcTreeNode* node)
   return - p*log(p) - (1-p)*log(1-p);
 }
 
+VoxelStateCache::VoxelState ViewSelecterBase::getVoxelState(ViewContext& ctx, const octomap::OcTreeKey& key, octomap::OcTreeNode* node)
+{
+  VoxelStateCache::VoxelState state;
+
+  if (voxel_cache_size_ > 0 && voxel_cache_.find(key, state))
+  {
+    ctx.cache_hits++;
+    return state;
+  }
+
+  ctx.cache_misses++;
+
+  // Rays of the z-buffer carry no nodes, voxels within the snapshot are read from it
+  if (visibility_type_ == VISIBILITY_ZBUFFER && grid_.contains(key))
+  {
+    int8_t code = grid_.getCode(key);
+    state.known     = grid_.isKnown(code);
+    state.occupancy = grid_.getOccupancy(code);
+  }
+  else
+  {
+    state.known     = (node != NULL);
+    state.occupancy = getNodeOccupancy(node);
+  }
+
+  // Entropy is tabulated per snapshot code, occupancy read from nodes stays exact for the threshold checks
+  if (grid_.contains(key))
+    state.entropy = grid_.getEntropy(grid_.getCode(key), is_ignoring_clamping_entropies_);
+  else
+    state.entropy = getNodeEntropy(node);
+
+  // Densities are only used for occupied voxels
+  if (state.known && state.occupancy >= tree_->getOccupancyThres())
+    state.density = getPointCountAtOcTreeKey(key);
+  else
+    state.density = -1;
+
+  if (voxel_cache_size_ > 0)
+    voxel_cache_.insert(key, state);
+
+  return state;
+}
+
+int ViewSelecterBase::pruneCandidates()
+{
+  timer.start("[ViewSelecterBase]evaluate-coarse");
+  int pose_count = view_contexts_.size();
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for (int i=0; i<pose_count; i++)
+    view_contexts_[i].utility_coarse = estimateUtilityCoarse(view_contexts_[i]);
+
+  // Keep the top k estimates, ties resolved in generation order
+  std::vector<int> order(pose_count);
+  for (int i=0; i<pose_count; i++)
+    order[i] = i;
+
+  std::nth_element(order.begin(), order.begin() + coarse_top_k_, order.end(), CoarseUtilityGreater(view_contexts_));
+
+  for (int i=coarse_top_k_; i<pose_count; i++)
+    view_contexts_[order[i]].is_pruned = true;
+
+  timer.stop("[ViewSelecterBase]evaluate-coarse");
+  return pose_count - coarse_top_k_;
+}
+
 geometry_msgs::Pose ViewSelecterBase::getTargetPose()
 {
   return selected_pose_;
@@ -550,12 +976,15 @@ bool ViewSelecterBase::isPointInBounds(octomap::point3d &p)
   return result;
 }
 
-void ViewSelecterBase::publishRayMarkers()
+void ViewSelecterBase::publishRayMarkers(ViewContext& ctx)
 {
-  ray_msg.header.frame_id = "world";
-  ray_msg.header.stamp = ros::Time::now();
+  if (marker_pub.getNumSubscribers() == 0)
+    return;
 
-  marker_pub.publish(ray_msg);
+  ctx.ray_msg.header.frame_id = "world";
+  ctx.ray_msg.header.stamp = ros::Time::now();
+
+  marker_pub.publish(ctx.ray_msg);
 }
 
 void ViewSelecterBase::publishPose(geometry_msgs::Pose p)
@@ -634,6 +1063,8 @@ void ViewSelecterBase::update()
   tree_->setBBXMax( max );
 
   computeRelativeRays();
+  ray_cache_.setRays(rays_far_plane_, rays_start_, rays_range_, rays_parent_, camera_rotation_mtx_);
+  updateVoxelCache();
 
   if (is_debug_)
   {
@@ -642,71 +1073,149 @@ void ViewSelecterBase::update()
   }
 
   //=======
-  // Find total entropy remaining in system
-  // * This is the slowest part of the update, optimize this for additional performance
+  // Snapshot the bounded region and find total entropy remaining in system
   //=======
-  info_entropy_total_=0;
+  timer.start("[ViewSelecterBase]update-snapshot");
+  updateSnapshot(min, max);
+  timer.stop("[ViewSelecterBase]update-snapshot");
 
-  std::vector<double> total_entropy_threaded;
-  #ifdef _OPENMP
-    #pragma omp parallel
-    #pragma omp critical
-    {
-      if (omp_get_thread_num() == 0){
-        total_entropy_threaded.resize(omp_get_num_threads());
-      }
+  if (visibility_type_ == VISIBILITY_ZBUFFER)
+  {
+    timer.start("[ViewSelecterBase]update-occupied");
+    updateOccupiedVoxels();
+    timer.stop("[ViewSelecterBase]update-occupied");
+  }
 
-    } // end critical
-  #else
-    total_entropy_threaded.resize(1);
-  #endif
+  if (is_debug_)
+  {
+    std::cout << "[ViewSelecterBase]: Total entropy remaining: " << info_entropy_total_ << "\n";
+  }
 
-  int num_threads = total_entropy_threaded.size();
-  double res = tree_->getResolution();
+  timer.stop("[ViewSelecterBase]update");
+}
+
+int ViewSelecterBase::getPointCountAtOcTreeKey(octomap::OcTreeKey key)
+{
+  return mapping_module_->getDensityAtOcTreeKey(key);
+}
 
-  // OpenMP loops require integer counters, so we determine the number of iterations here
-  int max_iteration = (view_gen_->obj_bounds_x_max_ - view_gen_->obj_bounds_x_min_)/res;
+void ViewSelecterBase::updateOccupiedVoxels()
+{
+  // Same threshold as isNodeOccupied(), applied to the quantized log-odds
+  grid_.getKeysAbove(tree_->getOccupancyThresLog(), occupied_keys_);
 
-  #ifdef _OPENMP
-  omp_set_num_threads(num_threads);
-  #pragma omp parallel for schedule(guided)
-  #endif
-  for (int i=0; i < max_iteration; i++)
+  int count = occupied_keys_.size();
+  occupied_x_.resize(count);
+  occupied_y_.resize(count);
+  occupied_z_.resize(count);
+
+  for (int i=0; i<count; i++)
   {
-    // Compute the corresponding "x" coordinate
-    double x = view_gen_->obj_bounds_x_min_ + res*i;
+    octomap::point3d p = tree_->keyToCoord(occupied_keys_[i]);
+    occupied_x_[i] = p.x();
+    occupied_y_[i] = p.y();
+    occupied_z_[i] = p.z();
+  }
+}
 
-    unsigned threadIdx = 0;
-    #ifdef _OPENMP
-    threadIdx = omp_get_thread_num();
-    #endif
+void ViewSelecterBase::updatePredictedVoxels(octomap::OcTree* tree_predicted)
+{
+  // Only drawn for the z-buffer, with voxels aligned with tree_
+  is_rendering_predicted_ = false;
+  predicted_keys_.clear();
+  predicted_x_.clear();
+  predicted_y_.clear();
+  predicted_z_.clear();
+
+  if (visibility_type_ != VISIBILITY_ZBUFFER || !tree_predicted || grid_.size() == 0 ||
+      tree_predicted->getResolution() != tree_resolution_)
+    return;
 
-    for (double y=view_gen_->obj_bounds_y_min_; y < view_gen_->obj_bounds_y_max_; y+=res)
-    {
-      for (double z=view_gen_->obj_bounds_z_min_; z < view_gen_->obj_bounds_z_max_; z+=res)
-      {
-        octomap::OcTreeKey key = tree_->coordToKey(x,y,z);
-        octomap::OcTreeNode* node = tree_->search(key);
-        total_entropy_threaded[threadIdx] += getNodeEntropy(node);
-      }
-    }
+  timer.start("[ViewSelecterBase]update-predicted");
+  grid_predicted_.build(tree_predicted, tree_->keyToCoord(grid_.getMinKey()), tree_->keyToCoord(grid_.getMaxKey()));
+  grid_predicted_.getKeysAbove(tree_predicted->getOccupancyThresLog(), predicted_keys_);
+
+  int count = predicted_keys_.size();
+  predicted_x_.resize(count);
+  predicted_y_.resize(count);
+  predicted_z_.resize(count);
+
+  for (int i=0; i<count; i++)
+  {
+    octomap::point3d p = tree_->keyToCoord(predicted_keys_[i]);
+    predicted_x_[i] = p.x();
+    predicted_y_[i] = p.y();
+    predicted_z_[i] = p.z();
   }
 
-  // Merge threaded values
-  for (int i=0; i<num_threads; i++)
+  is_rendering_predicted_ = true;
+  timer.stop("[ViewSelecterBase]update-predicted");
+}
+
+void ViewSelecterBase::updateSnapshot(const octomap::point3d& min, const octomap::point3d& max)
+{
+  // Read before the changes, anything integrated meanwhile is replayed next time (replaying has no effect)
+  unsigned long version = mapping_module_->getMapVersion();
+
+  bool is_full_update = !grid_.isSnapshotOf(tree_, min, max) ||
+      grid_updates_since_full_ >= grid_full_update_interval_;
+
+  if (!is_full_update)
   {
-    info_entropy_total_ += total_entropy_threaded[i];
+    // Falls back to a full rebuild if the change log no longer reaches back to the snapshot
+    map_changes_.clear();
+    is_full_update = !mapping_module_->getMapChanges(grid_version_, map_changes_);
   }
 
-  if (is_debug_)
+  if (is_full_update)
   {
-    std::cout << "[ViewSelecterBase]: Total entropy remaining: " << info_entropy_total_ << "\n";
+    grid_.build(tree_, min, max);
+    grid_entropy_ = grid_.getEntropySum(is_ignoring_clamping_entropies_);
+    grid_updates_since_full_ = 0;
+  }
+  else
+  {
+    // Only the voxels changed since the last update contribute
+    for (size_t i=0; i<map_changes_.size(); i++)
+      grid_entropy_ += grid_.applyChange(map_changes_[i].key, map_changes_[i].log_odds_new, is_ignoring_clamping_entropies_);
+
+    grid_updates_since_full_++;
   }
 
-  timer.stop("[ViewSelecterBase]update");
+  grid_version_ = version;
+  info_entropy_total_ = grid_entropy_;
+
+  if (is_debug_)
+  {
+    if (is_full_update)
+      std::cout << "[ViewSelecterBase]: Rebuilt snapshot of " << grid_.size() << " voxels\n";
+    else
+      std::cout << "[ViewSelecterBase]: Updated snapshot with " << map_changes_.size() << " changed voxels\n";
+  }
 }
 
-int ViewSelecterBase::getPointCountAtOcTreeKey(octomap::OcTreeKey key)
+void ViewSelecterBase::updateVoxelCache()
 {
-  return mapping_module_->getDensityAtOcTreeKey(key);
+  if (voxel_cache_size_ <= 0)
+    return;
+
+  // Cached states stay valid until the mapping module integrates new data
+  unsigned long version = mapping_module_->getMapVersion();
+  if (version == voxel_cache_version_ && tree_ == voxel_cache_tree_)
+    return;
+
+  // Candidates only see voxels within the bounds, so twice that count keeps probing short
+  double res = tree_->getResolution();
+  double voxels_in_bounds =
+      ceil((view_gen_->obj_bounds_x_max_ - view_gen_->obj_bounds_x_min_)/res) *
+      ceil((view_gen_->obj_bounds_y_max_ - view_gen_->obj_bounds_y_min_)/res) *
+      ceil((view_gen_->obj_bounds_z_max_ - view_gen_->obj_bounds_z_min_)/res);
+
+  size_t capacity = voxel_cache_size_;
+  if (2*voxels_in_bounds < capacity)
+    capacity = 2*voxels_in_bounds;
+
+  voxel_cache_.reset(capacity);
+  voxel_cache_version_ = version;
+  voxel_cache_tree_    = tree_;
 }
@@ -15,9 +15,9 @@ ViewSelecterIg::ViewSelecterIg():
 {
 }
 
-double ViewSelecterIg::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterIg::calculateUtility(ViewContext& ctx)
 {
-  double IG = calculateIG(p);
+  double IG = calculateIG(ctx);
   return IG;
 }
 
@@ -10,10 +10,10 @@ ViewSelecterIgExpDistance::ViewSelecterIgExpDistance():
   ros::param::param<double>("~view_selecter_weight_distance", w_dist_, 1.0);
 }
 
-double ViewSelecterIgExpDistance::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterIgExpDistance::calculateUtility(ViewContext& ctx)
 {
-  double IG = calculateIG(p);
-  double dist = calculateDistance(p);
+  double IG = calculateIG(ctx);
+  double dist = calculateDistance(ctx.pose);
   return IG*exp(-dist*w_dist_);
 }
 
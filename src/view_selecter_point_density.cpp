@@ -8,31 +8,35 @@ ViewSelecterPointDensity::ViewSelecterPointDensity():
 {
 }
 
-double ViewSelecterPointDensity::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterPointDensity::calculateUtility(ViewContext& ctx)
 {
+  const geometry_msgs::Pose& p = ctx.pose;
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
+
   int num_of_voxels = 0;
   int num_of_points = 0;
 
-  std::vector <octomap::OcTreeKey> checked_keys;
-  clearRayMarkers();
+  VoxelHashSet& checked_keys = ctx.keys;
+  checked_keys.clear();
+  clearRayMarkers(ctx);
 
-  for (int i=0; i<rays_far_plane_at_pose_.size(); i++)
+  for (int i=0; i<rays.size(); i++)
   {
     octomap::point3d endpoint;
 
-    // Get length of beam to the far plane of sensor
-    double range = rays_far_plane_at_pose_[i].norm();
+    // Get length of beam to the far plane of sensor, past the band of the ray
+    double range = rays.range[i];
 
     // Get the direction of the ray
     octomap::point3d origin (p.position.x, p.position.y, p.position.z);
-    octomap::point3d dir = rays_far_plane_at_pose_[i].normalize();
+    octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
 
     // Cast through unknown cells as well as free cells
     bool found_endpoint = tree_->castRay(origin, dir, endpoint, true, range);
     if (!found_endpoint)
       continue;
 
-    addToRayMarkers(origin, endpoint);
+    addToRayMarkers(ctx, origin, endpoint);
 
     // Check if endpoint exists (ie. occupied)
     octomap::OcTreeKey end_key;
@@ -40,28 +44,14 @@ double ViewSelecterPointDensity::calculateUtility(geometry_msgs::Pose p)
       continue;
 
     // Check if endpoint has not been considered before
-    bool unique=true;
-    for (int c=0; c<checked_keys.size(); c++)
-    {
-      if (checked_keys[c] == end_key)
-      {
-        unique = false;
-        break;
-      }
-    }
-
-    if (!unique)
+    if (!checked_keys.insert(end_key))
       continue;
 
     // Get number of points inside endpoint
-    checked_keys.push_back(end_key);
     num_of_points += getPointCountAtOcTreeKey(end_key);
     num_of_voxels++;
   }
 
-  publishRayMarkers();
-  publishPose(p);
-
   if (num_of_voxels == 0)
     return -1;
 
@@ -70,7 +60,7 @@ double ViewSelecterPointDensity::calculateUtility(geometry_msgs::Pose p)
   //printf("Density: %lf, Voxels: %d, Points: %d\n", density, num_of_voxels, num_of_points);
   //return 1.0/density;
 
-  return calculateIG(p)/density;
+  return calculateIG(ctx)/density;
 }
 
 
@@ -49,7 +49,7 @@ ViewSelecterProposed::ViewSelecterProposed():
   max_density_ = 3*std::pow( (octomap_vox_size/filter_vox_size), 2);
 }
 
-double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterProposed::calculateUtility(ViewContext& ctx)
 {
   // Modified version of ViewSelecterBase::calculateIG()
   // Computes classical entropy as well as entropy in predicted voxel grid
@@ -57,6 +57,8 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
   // Source: Borrowed partially from
   // https://github.com/uzh-rpg/rpg_ig_active_reconstruction/blob/master/ig_active_reconstruction_octomap/src/code_base/octomap_basic_ray_ig_calculator.inl
 
+  const geometry_msgs::Pose& p = ctx.pose;
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
   octomap::point3d origin (p.position.x, p.position.y, p.position.z);
 
   int num_nodes_traversed = 0;
@@ -67,30 +69,43 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
 
   int num_of_points = 0;
 
-  std::set<octomap::OcTreeKey, OctomapKeyCompare> key_list;
-  std::set<octomap::OcTreeKey, OctomapKeyCompare> key_predicted_list;
+  VoxelHashMap<octomap::OcTreeNode*>& key_list = ctx.key_nodes; // Unique traversed keys and their nodes
+  VoxelHashSet& key_predicted_list = ctx.keys_predicted;
+  key_list.clear();
+  key_predicted_list.clear();
 
 
 
-  clearRayMarkers();
+  clearRayMarkers(ctx);
   double ig_total = 0;
 
-  for (int i=0; i<rays_far_plane_at_pose_.size(); i++)
+  // ========
+  // Cast all rays through main octomap in a single pass each,
+  //  getting endpoints, traversed keys and their nodes together
+  // ========
+  castRays(ctx, origin);
+  const RayMarcher& marcher = ctx.ray_marcher;
+
+  const std::vector<octomap::OcTreeKey>&   ray_keys  = marcher.getKeys();
+  const std::vector<octomap::OcTreeNode*>& ray_nodes = marcher.getNodes();
+
+  for (int i=0; i<rays.size(); i++)
   {
+    const RayMarcher::Ray& marched = marcher.getRays()[i];
     octomap::point3d endpoint, endpoint_predicted;
     double ray_length, ray_predicted_length;
 
-    // Get length of beam to the far plane of sensor
-    double range = rays_far_plane_at_pose_[i].norm();
+    // Get length of beam to the far plane of sensor, past the band of the ray
+    double range = rays.range[i];
 
     // Get the direction of the ray
-    octomap::point3d dir = rays_far_plane_at_pose_[i].normalize();
+    octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
 
     // ========
-    // Get endpoint of ray when cast through main octomap
-    //  using castRay() is expensive when done repeatedly
+    // Get endpoint of ray in main octomap
     // ========
-    bool found_endpoint = tree_->castRay(origin, dir, endpoint, true, range);
+    bool found_endpoint = marched.found_endpoint;
+    endpoint = marched.endpoint;
     if (found_endpoint)
     {
       ray_length = (origin-endpoint).norm();
@@ -102,11 +117,11 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
 
     // ========
     // Get endpoint of ray when cast through predicted octomap
-    //  using castRay() is expensive when done repeatedly
+    //  using castRay() is expensive when done repeatedly, the z-buffer draws it once per view
     // ========
     if(weight_prediction_ > 0)
     {
-      found_endpoint = tree_predicted_->castRay(origin, dir, endpoint_predicted, true, range);
+      found_endpoint = castRayPredicted(ctx, tree_predicted_, i, origin, dir, range, endpoint_predicted);
       if (found_endpoint)
       {
         ray_predicted_length = (origin-endpoint_predicted).norm();
@@ -138,15 +153,12 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
     bool entered_valid_range = false;
     bool exited_valid_range = false;
 
-    octomap::KeyRay ray;
-    tree_->computeRayKeys( origin, endpoint, ray );
-
     // ======
     // Iterate through each node in ray
     // ======
-    for( octomap::KeyRay::iterator it = ray.begin() ; it!=ray.end(); ++it )
+    for (int k=marched.first; k<marched.first+marched.count; k++)
     {
-      octomap::point3d p = tree_->keyToCoord(*it);
+      octomap::point3d p = tree_->keyToCoord(ray_keys[k]);
 
       // ======
       // Compute ray start and end point for visualization
@@ -180,7 +192,7 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
         }
       }
 
-      insertKeyIfUnique(key_list, *it);
+      key_list.insert(ray_keys[k], ray_nodes[k]);
     }// end ray iterator
 
 
@@ -189,10 +201,9 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
     // ======
     if (found_endpoint && !exited_valid_range)
     {
-      octomap::OcTreeKey end_key;
-      if( tree_->coordToKeyChecked(endpoint, end_key) )
+      if( marched.has_end_key )
       {
-        insertKeyIfUnique(key_list, end_key);
+        key_list.insert(marched.end_key, marched.end_node);
       }
     }
 
@@ -203,7 +214,7 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
     start_pt = origin + dir * (dir.dot(start_pt-origin)/dir.dot(dir));
     end_pt = origin + dir * (dir.dot(end_pt-origin)/dir.dot(dir));
 
-    addToRayMarkers(start_pt, end_pt);
+    addToRayMarkers(ctx, start_pt, end_pt);
   }//end ray casting
 
   //========
@@ -213,30 +224,32 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
   num_nodes_predicted = key_predicted_list.size();
 
   // Normal octomap
-  std::set<octomap::OcTreeKey>::iterator it;
+  VoxelHashMap<octomap::OcTreeNode*>::iterator it;
   for (it = key_list.begin(); it != key_list.end(); ++it)
   {
-    octomap::OcTreeKey key = *it;
-    octomap::OcTreeNode* node = tree_->search(key);
+    octomap::OcTreeKey key = it.key();
+    octomap::OcTreeNode* node = it.value();
 
 
+    VoxelStateCache::VoxelState state = getVoxelState(ctx, key, node);
+
     num_nodes_traversed++;
-    if (!node)
+    if (!state.known)
       num_nodes_unknown++;
-    else if (isNodeOccupied(*node))
+    else if (state.occupancy >= tree_->getOccupancyThres())
     {
       num_nodes_occ++;
 
       // Get number of points to compute density
-      num_of_points += getPointCountAtOcTreeKey(key);
+      num_of_points += state.density;
     }
-    else if (isNodeFree(*node))
+    else if (state.occupancy <= 1-tree_->getOccupancyThres())
       num_nodes_free++;
     else
       num_nodes_unknown++;
 
     // Entropy
-    ig_total += getNodeEntropy(node);
+    ig_total += state.entropy;
   }
 
   //=======
@@ -328,32 +341,22 @@ double ViewSelecterProposed::calculateUtility(geometry_msgs::Pose p)
     printf("Utility ----- IG: %f, Density: %f, Predicted: %f, Total: %f\n", weighted_entropy, weighted_density, weighted_prediction, utility);
     printf("Predicted: %d\tUnknown: %d\tOccupied: %d\tFree: %d\n", num_nodes_predicted, num_nodes_unknown, num_nodes_occ, num_nodes_free);
 
-    //std::cout << "\tAverage nodes per ray: " << num_nodes_traversed/rays_far_plane_at_pose_.size() << "\n";
+    //std::cout << "\tAverage nodes per ray: " << num_nodes_traversed/rays.size() << "\n";
   }
 
-  temp_utility_density_    = weighted_density;
-  temp_utility_distance_   = weighted_distance;
-  temp_utility_entropy_    = weighted_entropy;
-  temp_utility_prediction_ = weighted_prediction;
-  temp_occupied_voxels_    = num_nodes_occ;
-
-  // ======
-  // Visualize
-  // ======
-  publishRayMarkers();
-  publishPose(p);
+  ctx.utility_density    = weighted_density;
+  ctx.utility_distance   = weighted_distance;
+  ctx.utility_entropy    = weighted_entropy;
+  ctx.utility_prediction = weighted_prediction;
+  ctx.occupied_voxels    = num_nodes_occ;
 
   return utility;
 }
 
-void ViewSelecterProposed::insertKeyIfUnique(std::set<octomap::OcTreeKey, OctomapKeyCompare>& list, octomap::OcTreeKey key)
+void ViewSelecterProposed::insertKeyIfUnique(VoxelHashSet& list, octomap::OcTreeKey key)
 {
-  //TODO: This function takes most of the time in the evaluator
-  if (list.count(key) == 0)
-  {
-    // Key not found, insert
-    list.insert(key);
-  }
+  // The hash set ignores keys that are already present
+  list.insert(key);
 }
 
 std::string ViewSelecterProposed::getMethodName()
@@ -377,4 +380,5 @@ void ViewSelecterProposed::update()
 {
   ViewSelecterBase::update(); //Call base class update
   tree_predicted_ = view_gen_->tree_prediction_;
+  updatePredictedVoxels(weight_prediction_ > 0 ? tree_predicted_ : NULL);
 }
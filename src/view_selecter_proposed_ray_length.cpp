@@ -14,7 +14,7 @@ ViewSelecterProposedRayLength::ViewSelecterProposedRayLength():
 {
 }
 
-double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
+double ViewSelecterProposedRayLength::calculateUtility(ViewContext& ctx)
 {
   // Modified version of ViewSelecterBase::calculateIG()
   // Computes length of rays in original and predicted and uses those as weights for entropies
@@ -24,6 +24,8 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
   double t_start, t_end;
   t_start = ros::Time::now().toSec();
 
+  const geometry_msgs::Pose& p = ctx.pose;
+  const RayTemplateCache::Bundle& rays = *ctx.rays;
   octomap::point3d origin (p.position.x, p.position.y, p.position.z);
 
   int nodes_traversed = 0;
@@ -32,26 +34,35 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
   int nodes_unknown = 0;
   int nodes_unobserved = 0;
 
-  std::set<octomap::OcTreeKey, OctomapKeyCompare> nodes; //all nodes in a set are UNIQUE
+  VoxelHashSet& nodes = ctx.keys; //all nodes in a set are UNIQUE
+  nodes.clear();
 
-  clearRayMarkers();
+  clearRayMarkers(ctx);
   double ig_total = 0;
 
-  for (int i=0; i<rays_far_plane_at_pose_.size(); i++)
+  // Cast through unknown cells as well as free cells, collecting the traversed nodes in the same pass
+  castRays(ctx, origin);
+  const RayMarcher& marcher = ctx.ray_marcher;
+
+  const std::vector<octomap::OcTreeKey>&   ray_keys  = marcher.getKeys();
+  const std::vector<octomap::OcTreeNode*>& ray_nodes = marcher.getNodes();
+
+  for (int i=0; i<rays.size(); i++)
   {
+    const RayMarcher::Ray& marched = marcher.getRays()[i];
     double ig_ray = 0;
 
     octomap::point3d endpoint, endpoint_predicted;
     double ray_len, ray_len_predicted;
 
-    // Get length of beam to the far plane of sensor
-    double range = rays_far_plane_at_pose_[i].norm();
+    // Get length of beam to the far plane of sensor, past the band of the ray
+    double range = rays.range[i];
 
     // Get the direction of the ray
-    octomap::point3d dir = rays_far_plane_at_pose_[i].normalize();
+    octomap::point3d dir (rays.dir_x[i], rays.dir_y[i], rays.dir_z[i]);
 
-    // Cast through unknown cells as well as free cells
-    bool found_endpoint = tree_->castRay(origin, dir, endpoint, true, range);
+    bool found_endpoint = marched.found_endpoint;
+    endpoint = marched.endpoint;
     if (!found_endpoint)
     {
       endpoint = origin + dir * range;
@@ -63,7 +74,7 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
     }
 
     // Cast ray through predicted map
-    found_endpoint = tree_predicted_->castRay(origin, dir, endpoint_predicted, true, range);
+    found_endpoint = castRayPredicted(ctx, tree_predicted_, i, origin, dir, range, endpoint_predicted);
     if (!found_endpoint)
       ray_len_predicted = range;
     else
@@ -87,12 +98,9 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
      * If the ray exits the bounds, we stop adding nodes to IG and discard the endpoint.
      */
 
-    octomap::KeyRay ray;
-    tree_->computeRayKeys( origin, endpoint, ray );
-
-    for( octomap::KeyRay::iterator it = ray.begin() ; it!=ray.end(); ++it )
+    for (int k=marched.first; k<marched.first+marched.count; k++)
     {
-      octomap::point3d p = tree_->keyToCoord(*it);
+      octomap::point3d p = tree_->keyToCoord(ray_keys[k]);
 
       if (!entered_valid_range)
       {
@@ -121,13 +129,13 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
       }
 
       // Add point to IG
-      octomap::OcTreeNode* node = tree_->search(*it);
-      ig_ray += getNodeEntropy(node);
+      VoxelStateCache::VoxelState state = getVoxelState(ctx, ray_keys[k], ray_nodes[k]);
+      ig_ray += state.entropy;
 
       //nodes.insert(*it);
       nodes_traversed++;
 
-      double prob = getNodeOccupancy(node);
+      double prob = state.occupancy;
       if (prob > 0.8)
         nodes_occ++;
       else if (prob < 0.2)
@@ -167,15 +175,9 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
     start_pt = origin + dir * (dir.dot(start_pt-origin)/dir.dot(dir));
     end_pt = origin + dir * (dir.dot(end_pt-origin)/dir.dot(dir));
 
-    addToRayMarkers(start_pt, end_pt);
+    addToRayMarkers(ctx, start_pt, end_pt);
   }
 
-  //if(is_debug_)
-  //{
-    publishRayMarkers();
-    publishPose(p);
-  //}
-
   int nodes_processed = nodes_traversed;
 
   // Views that do not see a single occupied cell are discarded
@@ -189,7 +191,7 @@ double ViewSelecterProposedRayLength::calculateUtility(geometry_msgs::Pose p)
     std::cout << "\nIG: " << ig_total << "\tAverage IG: " << ig_total/nodes_processed <<"\n";
     std::cout << "Unobserved: " << nodes_unobserved << "\tUnknown: " << nodes_unknown << "\tOcc: " << nodes_occ << "\tFree: " << nodes_free << "\n";
     std::cout << "Time: " << t_end-t_start << " sec\tNodes: " << nodes_processed << "/" << nodes_traversed<< " (" << 1000*(t_end-t_start)/nodes_processed << " ms/node)\n";
-    std::cout << "\tAverage nodes per ray: " << nodes_traversed/rays_far_plane_at_pose_.size() << "\n";
+    std::cout << "\tAverage nodes per ray: " << nodes_traversed/rays.size() << "\n";
   }
 
   return ig_total;
@@ -204,4 +206,5 @@ void ViewSelecterProposedRayLength::update()
 {
   ViewSelecterBase::update(); //Call base class update
   tree_predicted_ = view_gen_->tree_prediction_;
+  updatePredictedVoxels(tree_predicted_);
 }